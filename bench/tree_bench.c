@@ -0,0 +1,471 @@
+#include "../src/includes.h"
+#include "../src/init.h"
+#include "../src/setup.h"
+#include "../src/timestep.h"
+#include "../src/domain.h"
+#include "../src/peano.h"
+#include "../src/properties.h"
+#include "../src/Gravity/tree.h"
+
+#define RESULT_FILE "tree_bench.txt" // appended, one line per stage
+
+static void preamble(int argc, char *argv[]);
+static void make_particles(const int model);
+static void hernquist_position(unsigned short seed[3], const double a,
+		const double rmax, double pos[3]);
+static void run_stages(const int model);
+static double time_stage(const int model, const char *stage,
+		void (*func)(), const char *name, const double nPart,
+		const double nSub);
+static double sum_interactions();
+
+enum Bench_Model { UNIFORM, HERNQUIST, CLUSTERED, NMODELS };
+
+static const char *Model_Name[NMODELS] = { "uniform", "hernquist",
+										   "clustered" };
+
+static int NRep = 3;
+static int Huge_Page_Size = -1; // from the command line, else Param
+
+static const double Active_Fraction = 1.0/16; // of random sinks in the walks
+
+/*
+ * Standalone micro-benchmark of the tree gravity. We read a parameter file
+ * and initialise the code as in Read_and_Init() and Setup(), but instead of
+ * reading ICs we generate uniform, Hernquist and clustered particle sets.
+ * For each of them we decompose the domain once and then time the Peano
+ * sort, tree build, tree walk and periodic tree walk NRep times each, using
+ * the wall times of the profiler sections. As in a run with block time
+ * steps only a random Active_Fraction of the particles are sinks in the
+ * walks, their Part_per_s counts active particles only. With all particles
+ * active the relative criterion opens nearly all nodes of a uniform periodic
+ * box and the walks are close to N^2. The fastest repetition is appended to
+ * RESULT_FILE as
+ *
+ *   Model Npart NRank NThreads HugePageSize Stage Seconds Part_per_s
+ *   Interactions_per_s
+ *
+ * The thread count is set via OMP_NUM_THREADS, i.e. one run per thread
+ * count, the huge page size in MB (0 is off) on the command line to compare
+ * tree walks with and without huge pages, see "make bench".
+ */
+
+int main(int argc, char *argv[])
+{
+	preamble(argc, argv);
+
+	Init_Profiler();
+
+	Profile("Bench");
+
+	Read_Parameter_File(Param.File);
+
+	MPI_Bcast(&Sim.Boxsize, 3, MPI_DOUBLE, MASTER, MPI_COMM_WORLD);
+
+	if (Huge_Page_Size >= 0)
+		Param.Huge_Page_Size = Huge_Page_Size;
+
+	const size_t nBytes_sort = Sim.Npart_Total * sizeof(size_t) * NThreads;
+
+	Param.Buffer_Size = MAX(Param.Buffer_Size, // no growth in Peano sort
+			Param.Part_Alloc_Factor * nBytes_sort / NRank / 1024 / 1024 + 1);
+
+	Init_Memory_Management();
+
+	Init_Units();
+
+	Init_Constants();
+
+	Init_Cosmology(); // COMOVING
+
+	Allocate_Particle_Structures();
+
+	int nPart_Get[NPARTYPE] = { 0 };
+
+	nPart_Get[1] = Sim.Npart[1] * (Task.Rank + 1) / NRank
+				 - Sim.Npart[1] * Task.Rank / NRank;
+
+	Reallocate_P(nPart_Get, NULL); // P is empty, only type 1
+
+	if (Param.Grav_Softening[1] < 0)
+		Param.Grav_Softening[1] = Sim.Boxsize[0]
+			/ cbrt(Sim.Npart_Total) / 7.0;
+
+	make_particles(UNIFORM);
+
+	Init_Periodic(); // PERIODIC
+
+	Gravity_Periodic_Init();
+
+	Setup();
+
+	Time.Max_Active_Bin = 0; // only bin 0 is active, see make_particles()
+
+	for (int model = 0; model < NMODELS; model++) {
+
+		if (model > 0)
+			make_particles(model);
+
+		#pragma omp parallel
+		run_stages(model);
+	}
+
+	Profile("Bench");
+
+	Finish_Profiler();
+
+	Finish_Domain_Decomposition();
+
+	Finish_Memory_Management();
+
+	MPI_Finalize();
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Decompose and sort the set once, so the Peano sort below works on the
+ * nearly ordered particles of a running simulation. The BH criterion of the
+ * first step is close to N^2 here, so we start the relative criterion from
+ * the acceleration scale of the box and iterate twice, untimed.
+ * Gravity_Tree_Acceleration() includes the periodic walk, so we time that
+ * first and subtract its interactions.
+ */
+
+static void run_stages(const int model)
+{
+	Domain_Decomposition();
+
+	time_stage(model, "peano_sort", &Sort_Particles_By_Peano_Key,
+			"Peano-Hilbert order", Sim.Npart_Total, 0);
+
+	Reverse_Peano_Keys(); // as after Domain_Decomposition(), for the tree
+
+	time_stage(model, "tree_build", &Gravity_Tree_Build, "Grav Tree Build",
+			Sim.Npart_Total, 0);
+
+	static double nActive = 0, nActive_local = 0;
+
+	#pragma omp single
+	{
+
+	nActive_local = NActive_Particles;
+
+	MPI_Allreduce(&nActive_local, &nActive, 1, MPI_DOUBLE, MPI_SUM,
+			MPI_COMM_WORLD);
+
+	} // omp single
+
+	const double acc_box = Const.Gravity * Prop.Total_Mass / p2(Sim.Boxsize[0]);
+
+	#pragma omp for
+	for (int ipart = 0; ipart < Task.Npart_Total; ipart++)
+		P.Last_Acc_Mag[ipart] = acc_box;
+
+	for (int i = 0; i < 2; i++) {
+
+		#pragma omp for
+		for (int ipart = 0; ipart < Task.Npart_Total; ipart++)
+			P.Acc[0][ipart] = P.Acc[1][ipart] = P.Acc[2][ipart] = 0;
+
+		Gravity_Tree_Acceleration();
+
+		#pragma omp for
+		for (int ipart = 0; ipart < Task.Npart_Total; ipart++)
+			P.Last_Acc_Mag[ipart] = SQRT(p2(P.Acc[0][ipart])
+					+ p2(P.Acc[1][ipart]) + p2(P.Acc[2][ipart]));
+	}
+
+	double nEwald = 0;
+
+#ifdef PERIODIC
+	nEwald = time_stage(model, "tree_periodic", &Gravity_Tree_Periodic,
+			"Grav Tree Periodic", nActive, 0);
+#endif
+
+	time_stage(model, "tree_accel", &Gravity_Tree_Acceleration,
+			"Grav Tree Accel", nActive, nEwald);
+
+	return ;
+}
+
+/*
+ * Run "func" NRep times and keep the fastest wall time of its profiler
+ * section "name". The tree walks count their interactions in P.Cost, we
+ * return the count of the last repetition minus "nSub".
+ */
+
+static double time_stage(const int model, const char *stage,
+		void (*func)(), const char *name, const double nPart,
+		const double nSub)
+{
+	static double t_min = DBL_MAX;
+
+	#pragma omp single
+	t_min = DBL_MAX;
+
+	for (int rep = 0; rep < NRep; rep++) {
+
+		#pragma omp for
+		for (int ipart = 0; ipart < Task.Npart_Total; ipart++)
+			P.Acc[0][ipart] = P.Acc[1][ipart] = P.Acc[2][ipart] = P.Cost[ipart]
+				= 0;
+
+		(*func)();
+
+		#pragma omp single
+		t_min = fmin(t_min, Profile_Last(name));
+	}
+
+	const double nInter = sum_interactions() - nSub;
+
+	#pragma omp master
+	{
+
+	double t_max = 0;
+
+	MPI_Allreduce(&t_min, &t_max, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+
+	if (Task.Is_MPI_Master) {
+
+		FILE *fp = fopen(RESULT_FILE, "a");
+
+		Assert(fp != NULL, "Can't open %s for writing", RESULT_FILE);
+
+		fprintf(fp, "%s %"PRIu64" %d %d %d %s %g %g %g\n",
+				Model_Name[model], Sim.Npart_Total, NRank, NThreads,
+				Param.Huge_Page_Size, stage, t_max, nPart / t_max,
+				nInter / t_max);
+
+		fclose(fp);
+
+		printf("\nBench: %s %s %g sec, %g part/s, %g interactions/s\n\n",
+				Model_Name[model], stage, t_max, nPart / t_max,
+				nInter / t_max);
+	}
+
+	} // omp master
+
+	#pragma omp barrier
+
+	return nInter;
+}
+
+static double sum_interactions()
+{
+	static double sum = 0, total = 0;
+
+	#pragma omp single
+	sum = 0;
+
+	#pragma omp for reduction(+:sum)
+	for (int ipart = 0; ipart < Task.Npart_Total; ipart++)
+		sum += P.Cost[ipart];
+
+	#pragma omp single
+	MPI_Allreduce(&sum, &total, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+	return total;
+}
+
+/*
+ * Particle sets in the box, every rank makes its own share with a
+ * reproducible seed. "uniform" is a random homogeneous box, "hernquist" a
+ * concentrated halo with a = L/50 in the box center, "clustered" puts 90%
+ * of the particles into 100 small halos at random positions on top of a
+ * uniform background. With COMOVING the total mass is the matter density
+ * of the box.
+ */
+
+static void make_particles(const int model)
+{
+	const double L = Sim.Boxsize[0];
+
+	double mtot = 1;
+
+#ifdef COMOVING
+	mtot = Cosmo.Omega_Matter * p3(L) * 3 * p2(Cosmo.Hubble_Constant)
+		/ (8 * PI * Const.Gravity);
+#endif
+
+	const int nClumps = 100;
+
+	double center[100][3] = { { 0 } };
+
+	unsigned short seed[3] = { 42, 4711, 0 };
+
+	for (int i = 0; i < nClumps; i++) // same on all ranks
+		for (int j = 0; j < 3; j++)
+			center[i][j] = L * erand48(seed);
+
+	seed[0] = 1 + model;
+	seed[2] = Task.Rank;
+
+	const uint64_t id_offset = Sim.Npart_Total * Task.Rank / NRank;
+
+	for (int ipart = 0; ipart < Task.Npart_Total; ipart++) {
+
+		double pos[3] = { 0 };
+
+		switch (model) {
+
+		case UNIFORM:
+
+			for (int j = 0; j < 3; j++)
+				pos[j] = L * erand48(seed);
+
+			break;
+
+		case HERNQUIST:
+
+			hernquist_position(seed, L/50, 0.45*L, pos);
+
+			for (int j = 0; j < 3; j++)
+				pos[j] += 0.5 * L;
+
+			break;
+
+		case CLUSTERED:
+
+			if (erand48(seed) < 0.1) {
+
+				for (int j = 0; j < 3; j++)
+					pos[j] = L * erand48(seed);
+
+				break;
+			}
+
+			int i = erand48(seed) * nClumps;
+
+			hernquist_position(seed, L/1000, L/20, pos);
+
+			for (int j = 0; j < 3; j++)
+				pos[j] = fmod(pos[j] + center[i][j] + L, L);
+
+			break;
+
+		default:
+
+			Assert(false, "Model %d not handled", model);
+		}
+
+		P.Type[ipart] = 1;
+		P.ID[ipart] = id_offset + ipart + 1;
+		P.Mass[ipart] = mtot / Sim.Npart_Total;
+		P.Time_Bin[ipart] = erand48(seed) < Active_Fraction ? 0 : 1;
+
+		for (int j = 0; j < 3; j++) {
+
+			P.Pos[j][ipart] = pos[j];
+			P.Vel[j][ipart] = P.Acc[j][ipart] = 0;
+		}
+	}
+
+	rprintf("\nBench: generated %"PRIu64" particles, model %s\n",
+			Sim.Npart_Total, Model_Name[model]);
+
+	return ;
+}
+
+/*
+ * Invert M(<r)/M = r^2/(r+a)^2, reject r > rmax, isotropic direction
+ */
+
+static void hernquist_position(unsigned short seed[3], const double a,
+		const double rmax, double pos[3])
+{
+	double r = DBL_MAX;
+
+	while (r > rmax) {
+
+		double q = sqrt(erand48(seed));
+
+		r = a * q / (1 - q);
+	}
+
+	const double cos_theta = 2 * erand48(seed) - 1;
+	const double sin_theta = sqrt(1 - cos_theta * cos_theta);
+	const double phi = 2 * PI * erand48(seed);
+
+	pos[0] = r * sin_theta * cos(phi);
+	pos[1] = r * sin_theta * sin(phi);
+	pos[2] = r * cos_theta;
+
+	return ;
+}
+
+/*
+ * OpenMP and MPI init as in main.c, the command line gives the parameter
+ * file, the number of particles, the number of repetitions and the huge
+ * page size.
+ */
+
+static void preamble(int argc, char *argv[])
+{
+	int provided = 0;
+
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+
+	Assert(provided == MPI_THREAD_MULTIPLE,
+		   "MPI thread multiple not supported, have %d :-(", provided);
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &Task.Rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &NRank);
+
+	MPI_Is_thread_main(&Task.Is_Thread_Main);
+
+	#pragma omp parallel
+	{
+
+	#pragma omp single
+	{
+
+	NThreads = omp_get_num_threads();
+	NTask = NRank * NThreads;
+
+	} // omp single
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &Task.Rank); // Task is threadprivate
+
+	Task.Thread_ID = omp_get_thread_num();
+
+	if (Task.Rank == MASTER && Task.Thread_ID == MASTER)
+		Task.Is_Master = true;
+
+	if (Task.Rank == MASTER)
+		Task.Is_MPI_Master = true;
+
+	Task.Seed[2] = 14041981L * Task.Thread_ID;
+
+	erand48(Task.Seed);
+
+	} // omp parallel
+
+	if (Task.Is_Master) {
+
+		printf("#### Tandav Tree Benchmark ####\n\n");
+
+		Print_Compile_Time_Settings();
+
+		printf("\nUsing %d MPI tasks, %d OpenMP threads \n\n",
+				NRank, NThreads);
+
+		Assert((argc >= 3) && (argc < 6), "Wrong number of arguments: \n\n"
+			"	USAGE: ./Tandav_Bench ParameterFile Npart <NRep> "
+			"<HugePageSize>\n");
+	}
+
+	strncpy(Param.File, argv[1], CHARBUFSIZE);
+
+	Sim.Npart[1] = Sim.Npart_Total = atoll(argv[2]);
+
+	if (argc > 3)
+		NRep = atoi(argv[3]);
+
+	if (argc > 4)
+		Huge_Page_Size = atoi(argv[4]);
+
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	return ;
+}
@@ -0,0 +1,1161 @@
+#include <float.h>
+
+#include "fof.h"
+
+#ifdef FOF
+
+/*
+ * In-situ Friends-of-Friends group finder (Davis et al. 1985). We link all
+ * particles closer than FOF_LINKING_LENGTH times the mean interparticle
+ * separation. The neighbour search runs over the leaf vectors of the PH
+ * ordered particles and walks the gravity tree, whose nodes get a tight
+ * bounding box first. Threads link particles in a lock-free union-find,
+ * where every root is the smallest particle index in the set. Groups
+ * spanning several ranks are stitched with the smallest particle ID as
+ * global label: we export particles close to the top nodes of a neighbour
+ * rank, link them as ghosts into the local sets and exchange the labels of
+ * the ghosts until they agree. The MPI master merges the group fragments
+ * and writes the catalogue.
+ */
+
+#define FOF_NRANK_BOXES 64 // boxes per rank to find the neighbours
+
+struct FoF_Box {
+	Float Min[3];
+	Float Max[3];
+};
+
+struct Group_Fragment {		// part of a group on this rank
+	ID_t Label;				// smallest particle ID in the group
+	int Npart;
+	bool Is_Boundary;		// might continue on another rank
+	double Mass;
+	double CoM[3];
+	double Vel[3];			// mass weighted
+};
+
+struct FoF_Tree_Node {		// binary tree over the top nodes
+	struct FoF_Box Box;
+	int Last;				// largest particle index + 1
+};
+
+static void set_linking_length();
+static void find_node_boxes();
+static void box_from_particles(const int, const int, struct FoF_Box *);
+static void box_from_children(const int, struct FoF_Box *);
+static bool boxes_are_apart(const struct FoF_Box *, const struct FoF_Box *);
+static bool box_is_empty(const struct FoF_Box *);
+static void find_top_tree();
+static int next_top_node(int *, const struct FoF_Box *, const int);
+static void link_leaf_vector(const int);
+static void link_subtree(const int, const int, const struct FoF_Box *,
+		const int);
+static void link_particles(const int, const int, const int, const int);
+static int find_root(int);
+static void union_sets(int, int);
+static void find_group_fragments();
+static void add_to_fragment(const int, const Float *, struct Group_Fragment *);
+static void exchange_ghost_particles();
+static void find_rank_boxes();
+static void find_exports(int *, int *);
+static void link_ghost_particle(const int);
+static void stitch_groups_across_ranks();
+static void write_group_catalogue();
+static int compare_int(const void *, const void *);
+static int compare_fragment_labels(const void *, const void *);
+static int compare_fragment_npart(const void *, const void *);
+
+static double Link_Length = 0, Link_Length2 = 0;
+
+static int * restrict Group = NULL; // union-find parent, then fragment index
+static size_t * restrict Perm = NULL;
+
+static struct FoF_Box * restrict Node_Box = NULL; // bounding boxes of Tree
+static struct FoF_Box * restrict Top_Box = NULL; // bounding boxes of D
+static int * restrict Node_First = NULL; // first particle in Tree node
+
+static struct FoF_Tree_Node * restrict Top_Tree = NULL; // leaves are D
+static int NTop_Leaves = 0;
+
+static struct Group_Fragment * restrict Frag = NULL;
+static int NFrag = 0;
+
+static struct FoF_Box * restrict Rank_Box = NULL; // of all ranks
+static int * restrict Export = NULL; // particles, ordered by rank
+static int * restrict NExport = NULL, * restrict NGhost = NULL; // per rank
+static int * restrict Thread_Count = NULL; // exports per thread and rank
+static Float (* restrict Ghost_Pos)[3] = NULL; // imported particles
+static int NExport_Total = 0, NGhost_Total = 0;
+
+void FoF()
+{
+	Profile("FoF");
+
+	#pragma omp single
+	{
+
+	Assert(Tree != NULL, "FoF needs the gravity tree");
+
+	set_linking_length();
+
+	Group = Malloc(Task.Npart_Total * sizeof(*Group), "FoF Group");
+	Perm = Malloc(Task.Npart_Total * sizeof(*Perm), "FoF Perm");
+	Node_Box = Malloc((NNodes + 1) * sizeof(*Node_Box), "FoF Node Box");
+	Node_First = Malloc((NNodes + 1) * sizeof(*Node_First), // NNodes may be 0
+			"FoF Node First");
+	Top_Box = Malloc(NTop_Nodes * sizeof(*Top_Box), "FoF Top Box");
+
+	} // omp single
+
+	#pragma omp for
+	for (int ipart = 0; ipart < Task.Npart_Total; ipart++)
+		Group[ipart] = ipart;
+
+	find_node_boxes();
+
+	#pragma omp single
+	find_top_tree();
+
+	#pragma omp for schedule(dynamic)
+	for (int i = 0; i < NVec; i++)
+		link_leaf_vector(i);
+
+	exchange_ghost_particles(); // MPI
+
+	#pragma omp for schedule(dynamic)
+	for (int i = 0; i < NGhost_Total; i++)
+		link_ghost_particle(i);
+
+	#pragma omp for
+	for (int i = 0; i < Task.Npart_Total + NGhost_Total; i++)
+		Group[i] = find_root(i);
+
+	find_group_fragments();
+
+	stitch_groups_across_ranks();
+
+	write_group_catalogue();
+
+	#pragma omp single
+	{
+
+	Free(Frag); Free(Top_Tree); Free(Top_Box); Free(Node_First);
+	Free(Node_Box); Free(Perm); Free(Group);
+
+	} // omp single
+
+	Profile("FoF");
+
+	return ;
+}
+
+/*
+ * The linking length is relative to the mean interparticle separation of
+ * the high resolution (type 1) particles.
+ */
+
+static void set_linking_length()
+{
+	uint64_t npart = Sim.Npart[1];
+
+	if (npart == 0)
+		npart = Sim.Npart_Total;
+
+#ifdef PERIODIC
+	double volume = Sim.Boxsize[0] * Sim.Boxsize[1] * Sim.Boxsize[2];
+#else
+	double volume = p3(Domain.Size);
+#endif
+
+	Link_Length = FOF_LINKING_LENGTH * cbrt(volume / npart);
+	Link_Length2 = p2(Link_Length);
+
+	if (Task.Is_MPI_Master)
+		printf("FoF: Linking length %g \n", Link_Length);
+
+	return ;
+}
+
+/*
+ * Particles have moved since the tree build, so we recompute the bounding
+ * boxes bottom up. Nodes are stored depth first, hence the children of a
+ * node follow it and a backwards loop sees them first.
+ */
+
+static void find_node_boxes()
+{
+	#pragma omp for schedule(dynamic)
+	for (int j = 0; j < NTop_Nodes; j++) {
+
+		const int first = D[j].TNode.First_Part;
+		const int npart = D[j].TNode.Npart;
+
+		if (npart <= VECTOR_SIZE) { // top node without subtree
+
+			box_from_particles(first, first + npart, &Top_Box[j]);
+
+			continue;
+		}
+
+		const int start = D[j].TNode.Target;
+		const int end = start + Tree[start].DNext;
+
+		for (int node = end - 1; node >= start; node--) {
+
+			if (Tree[node].DNext < 0) { // particle bundle
+
+				Node_First[node] = -Tree[node].DNext - 1;
+
+				box_from_particles(Node_First[node],
+						Node_First[node] + Tree[node].Npart, &Node_Box[node]);
+			} else {
+
+				Node_First[node] = Node_First[node + 1];
+
+				box_from_children(node, &Node_Box[node]);
+			}
+		}
+
+		Top_Box[j] = Node_Box[start];
+	}
+
+	return ;
+}
+
+static void box_from_particles(const int first, const int last,
+		struct FoF_Box *box)
+{
+	for (int i = 0; i < 3; i++) {
+
+		box->Min[i] = FLT_MAX;
+		box->Max[i] = -FLT_MAX;
+	}
+
+	for (int ipart = first; ipart < last; ipart++) {
+
+		for (int i = 0; i < 3; i++) {
+
+			box->Min[i] = fmin(box->Min[i], P.Pos[i][ipart]);
+			box->Max[i] = fmax(box->Max[i], P.Pos[i][ipart]);
+		}
+	}
+
+	return ;
+}
+
+static void box_from_children(const int node, struct FoF_Box *box)
+{
+	const int end = node + Tree[node].DNext;
+
+	box_from_particles(0, 0, box); // empty box
+
+	int child = node + 1;
+
+	while (child < end) {
+
+		for (int i = 0; i < 3; i++) {
+
+			box->Min[i] = fmin(box->Min[i], Node_Box[child].Min[i]);
+			box->Max[i] = fmax(box->Max[i], Node_Box[child].Max[i]);
+		}
+
+		child += imax(1, Tree[child].DNext); // skip grand children
+	}
+
+	return ;
+}
+
+/*
+ * Conservative test, the boxes are further apart than the linking length.
+ * With periodic boundaries we need the nearest image of the box centers.
+ */
+
+static bool boxes_are_apart(const struct FoF_Box *a, const struct FoF_Box *b)
+{
+	double d2 = 0;
+
+	for (int i = 0; i < 3; i++) {
+
+		double dc = 0.5 * (a->Min[i] + a->Max[i] - b->Min[i] - b->Max[i]);
+		double half = 0.5 * (a->Max[i] - a->Min[i] + b->Max[i] - b->Min[i]);
+
+		dc = fabs(dc);
+
+#ifdef PERIODIC
+		if (dc > 0.5 * Sim.Boxsize[i])
+			dc = Sim.Boxsize[i] - dc;
+#endif
+
+		double d = dc - half;
+
+		if (d > 0)
+			d2 += d*d;
+	}
+
+	return d2 > Link_Length2;
+}
+
+static bool box_is_empty(const struct FoF_Box *box)
+{
+	return box->Min[0] > box->Max[0];
+}
+
+/*
+ * A complete binary tree over the top nodes in PH order, stored as a heap:
+ * node k has the children 2k and 2k+1, the root is 1 and top node j is the
+ * leaf NTop_Leaves + j. As the top nodes are neighbours on the curve, the
+ * boxes stay compact and a walk finds the top nodes near a box in
+ * O(log NTop_Nodes).
+ */
+
+static void find_top_tree()
+{
+	NTop_Leaves = 1;
+
+	while (NTop_Leaves < NTop_Nodes)
+		NTop_Leaves *= 2;
+
+	Top_Tree = Malloc_Uninit(2 * NTop_Leaves * sizeof(*Top_Tree),
+			"FoF Top Tree");
+
+	for (int j = 0; j < NTop_Leaves; j++) {
+
+		struct FoF_Tree_Node *leaf = &Top_Tree[NTop_Leaves + j];
+
+		if (j < NTop_Nodes && D[j].TNode.Npart > 0) {
+
+			leaf->Box = Top_Box[j];
+			leaf->Last = D[j].TNode.First_Part + D[j].TNode.Npart;
+
+		} else {
+
+			box_from_particles(0, 0, &leaf->Box); // empty box
+			leaf->Last = 0;
+		}
+	}
+
+	for (int k = NTop_Leaves - 1; k > 0; k--) {
+
+		const struct FoF_Tree_Node *a = &Top_Tree[2*k];
+		const struct FoF_Tree_Node *b = &Top_Tree[2*k + 1];
+
+		for (int i = 0; i < 3; i++) {
+
+			Top_Tree[k].Box.Min[i] = fmin(a->Box.Min[i], b->Box.Min[i]);
+			Top_Tree[k].Box.Max[i] = fmax(a->Box.Max[i], b->Box.Max[i]);
+		}
+
+		Top_Tree[k].Last = imax(a->Last, b->Last);
+	}
+
+	return ;
+}
+
+/*
+ * Continue the walk of the top tree at node *k and return the next top node
+ * with particles beyond "first" that is not apart from box, or -1 at the
+ * end. Start with *k = 1.
+ */
+
+static int next_top_node(int *k, const struct FoF_Box *box, const int first)
+{
+	int node = *k;
+
+	while (node > 0) {
+
+		bool skip = (Top_Tree[node].Last <= first)
+				 || boxes_are_apart(box, &Top_Tree[node].Box);
+
+		if (! skip && node < NTop_Leaves) {
+
+			node *= 2; // open
+
+			continue;
+		}
+
+		const int j = node - NTop_Leaves;
+
+		while (node & 1) // up to the next sibling
+			node /= 2;
+
+		if (node > 0)
+			node++;
+
+		if (! skip) {
+
+			*k = node;
+
+			return j;
+		}
+	}
+
+	*k = 0;
+
+	return -1;
+}
+
+/*
+ * Link the particles of leaf vector i to all particles with higher index.
+ * Pairs with lower index particles are found by the other vectors.
+ */
+
+static void link_leaf_vector(const int i)
+{
+	const int first = Vec[i];
+	const int last = Vec[i+1];
+
+	struct FoF_Box box = { { 0 } };
+
+	box_from_particles(first, last, &box);
+
+	int k = 1, j = 0;
+
+	while ((j = next_top_node(&k, &box, first)) >= 0) {
+
+		const int tfirst = D[j].TNode.First_Part;
+		const int tnpart = D[j].TNode.Npart;
+
+		if (tnpart <= VECTOR_SIZE)
+			link_particles(first, last, tfirst, tfirst + tnpart);
+		else
+			link_subtree(first, last, &box, D[j].TNode.Target);
+	}
+
+	return ;
+}
+
+static void link_subtree(const int first, const int last,
+		const struct FoF_Box *box, const int start)
+{
+	const int end = start + Tree[start].DNext;
+
+	int node = start;
+
+	while (node < end) {
+
+		const int nfirst = Node_First[node];
+		const int nlast = nfirst + Tree[node].Npart;
+
+		if (nlast <= first || boxes_are_apart(box, &Node_Box[node])) {
+
+			node += imax(1, Tree[node].DNext); // skip
+
+			continue;
+		}
+
+		if (Tree[node].DNext < 0) // particle bundle
+			link_particles(first, last, nfirst, nlast);
+
+		node++; // open
+	}
+
+	return ;
+}
+
+static void link_particles(const int first, const int last,
+		const int jfirst, const int jlast)
+{
+	for (int ipart = first; ipart < last; ipart++) {
+
+		for (int jpart = imax(jfirst, ipart + 1); jpart < jlast; jpart++) {
+
+			Float dr[3] = { P.Pos[0][ipart] - P.Pos[0][jpart],
+							P.Pos[1][ipart] - P.Pos[1][jpart],
+							P.Pos[2][ipart] - P.Pos[2][jpart] };
+
+			Periodic_Nearest(dr); // PERIODIC
+
+			Float r2 = p2(dr[0]) + p2(dr[1]) + p2(dr[2]);
+
+			if (r2 <= Link_Length2)
+				union_sets(ipart, jpart);
+		}
+	}
+
+	return ;
+}
+
+/*
+ * Lock-free union-find. Roots only ever move to a smaller index, so a
+ * compare-and-swap on the root is sufficient, a failed swap means another
+ * thread was faster and we retry. Path halving shortens the trees on the
+ * way, stale parents are harmless because they still point into the set.
+ */
+
+static int find_root(int i)
+{
+	for (;;) {
+
+		int parent = __atomic_load_n(&Group[i], __ATOMIC_RELAXED);
+
+		if (parent == i)
+			return i;
+
+		int grand_parent = __atomic_load_n(&Group[parent], __ATOMIC_RELAXED);
+
+		if (grand_parent != parent)
+			__atomic_store_n(&Group[i], grand_parent, __ATOMIC_RELAXED);
+
+		i = grand_parent;
+	}
+
+	return -1;
+}
+
+static void union_sets(int a, int b)
+{
+	for (;;) {
+
+		a = find_root(a);
+		b = find_root(b);
+
+		if (a == b)
+			return ;
+
+		if (a < b) { // hang the larger root below the smaller one
+
+			int tmp = a;
+			a = b;
+			b = tmp;
+		}
+
+		if (__sync_bool_compare_and_swap(&Group[a], a, b))
+			return ;
+	}
+
+	return ;
+}
+
+/*
+ * Sort the particles by root and reduce the sets to group fragments.
+ * Afterwards Group holds the fragment index of every particle.
+ */
+
+static void find_group_fragments()
+{
+	Qsort_Index(Perm, Group, Task.Npart_Total, sizeof(*Group), &compare_int);
+
+	#pragma omp single
+	{
+
+	NFrag = 0;
+
+	for (int i = 0; i < Task.Npart_Total; i++)
+		if (i == 0 || Group[Perm[i]] != Group[Perm[i-1]])
+			NFrag++;
+
+	Frag = Malloc(NFrag * sizeof(*Frag), "FoF Fragments");
+
+	memset(Frag, 0, NFrag * sizeof(*Frag));
+
+	int ifrag = -1, last_root = -1;
+	Float ref[3] = { 0 }; // periodic reference position
+
+	for (int i = 0; i < Task.Npart_Total; i++) {
+
+		int ipart = Perm[i];
+
+		if (Group[ipart] != last_root) { // new fragment
+
+			ifrag++;
+
+			last_root = Group[ipart];
+
+			Frag[ifrag].Label = P.ID[ipart];
+
+			for (int j = 0; j < 3; j++)
+				ref[j] = P.Pos[j][ipart];
+		}
+
+		Group[ipart] = ifrag;
+
+		add_to_fragment(ipart, ref, &Frag[ifrag]);
+	}
+
+	for (int i = 0; i < NFrag; i++) {
+
+		for (int j = 0; j < 3; j++) {
+
+			Frag[i].CoM[j] /= Frag[i].Mass;
+			Frag[i].Vel[j] /= Frag[i].Mass;
+		}
+	}
+
+	} // omp single
+
+	return ;
+}
+
+/*
+ * Add particle ipart to the fragment, positions relative to ref respect the
+ * periodic boundaries. We store CoM in absolute coordinates, multiplied
+ * by the mass until the end.
+ */
+
+static void add_to_fragment(const int ipart, const Float *ref,
+		struct Group_Fragment *frag)
+{
+	Float dr[3] = { P.Pos[0][ipart] - ref[0],
+					P.Pos[1][ipart] - ref[1],
+					P.Pos[2][ipart] - ref[2] };
+
+	Periodic_Nearest(dr); // PERIODIC
+
+	double m = P.Mass[ipart];
+
+	frag->Npart++;
+	frag->Mass += m;
+
+	for (int i = 0; i < 3; i++) {
+
+		frag->CoM[i] += m * (ref[i] + dr[i]);
+		frag->Vel[i] += m * P.Vel[i][ipart];
+	}
+
+	frag->Label = MIN(frag->Label, P.ID[ipart]);
+
+	return ;
+}
+
+/*
+ * Particles within a linking length of a box of another rank are sent
+ * there. Every rank announces FOF_NRANK_BOXES boxes of its top tree, so we
+ * only talk to our neighbours. Imported particles become ghosts in the
+ * union-find, with index Task.Npart_Total + i, and are linked like local
+ * particles. Ghosts never become roots of local particles.
+ */
+
+static void exchange_ghost_particles()
+{
+	#pragma omp single
+	{
+
+	NGhost_Total = NExport_Total = 0;
+
+	if (NRank > 1) {
+
+		find_rank_boxes();
+
+		Thread_Count = Malloc(NThreads * NRank * sizeof(*Thread_Count),
+				"FoF Thread Count");
+		NExport = Malloc(NRank * sizeof(*NExport), "FoF NExport");
+		NGhost = Malloc(NRank * sizeof(*NGhost), "FoF NGhost");
+	}
+
+	} // omp single
+
+	if (NRank == 1)
+		return ;
+
+	int *count = &Thread_Count[Task.Thread_ID * NRank];
+
+	find_exports(count, NULL);
+
+	#pragma omp single
+	{
+
+	for (int task = 0; task < NRank; task++) { // offsets into Export
+
+		for (int i = 0; i < NThreads; i++) {
+
+			int n = Thread_Count[i*NRank + task];
+
+			Thread_Count[i*NRank + task] = NExport_Total;
+
+			NExport_Total += n;
+		}
+
+		NExport[task] = NExport_Total;
+	}
+
+	for (int task = NRank - 1; task > 0; task--)
+		NExport[task] -= NExport[task-1];
+
+	Export = Malloc_Uninit(NExport_Total * sizeof(*Export), "FoF Export");
+
+	} // omp single
+
+	find_exports(count, Export);
+
+	#pragma omp single
+	{
+
+	MPI_Alltoall(NExport, 1, MPI_INT, NGhost, 1, MPI_INT, MPI_COMM_WORLD);
+
+	int send_bytes[NRank], send_offset[NRank];
+	int recv_bytes[NRank], recv_offset[NRank];
+
+	for (int task = 0; task < NRank; task++) {
+
+		send_bytes[task] = NExport[task] * sizeof(*Ghost_Pos);
+		recv_bytes[task] = NGhost[task] * sizeof(*Ghost_Pos);
+
+		send_offset[task] = task == 0 ? 0
+						  : send_offset[task-1] + send_bytes[task-1];
+		recv_offset[task] = task == 0 ? 0
+						  : recv_offset[task-1] + recv_bytes[task-1];
+
+		NGhost_Total += NGhost[task];
+	}
+
+	Float (*send)[3] = Malloc_Uninit(NExport_Total * sizeof(*send),
+			"FoF Send");
+
+	for (int i = 0; i < NExport_Total; i++)
+		for (int j = 0; j < 3; j++)
+			send[i][j] = P.Pos[j][Export[i]];
+
+	Ghost_Pos = Malloc_Uninit(NGhost_Total * sizeof(*Ghost_Pos),
+			"FoF Ghost Pos");
+
+	MPI_Alltoallv(send, send_bytes, send_offset, MPI_BYTE, Ghost_Pos,
+			recv_bytes, recv_offset, MPI_BYTE, MPI_COMM_WORLD);
+
+	Free(send);
+
+	Group = Realloc(Group, (Task.Npart_Total + NGhost_Total)
+			* sizeof(*Group), "FoF Group");
+
+	for (int i = 0; i < NGhost_Total; i++)
+		Group[Task.Npart_Total + i] = Task.Npart_Total + i;
+
+	int nExport_Sum = 0;
+
+	MPI_Reduce(&NExport_Total, &nExport_Sum, 1, MPI_INT, MPI_SUM, MASTER,
+			MPI_COMM_WORLD);
+
+	if (Task.Is_MPI_Master)
+		printf("FoF: Exchanged %d ghost particles \n", nExport_Sum);
+
+	} // omp single
+
+	return ;
+}
+
+/*
+ * We announce the boxes of one level of the top tree, the leaves if the tree
+ * is smaller. Unused boxes stay empty.
+ */
+
+static void find_rank_boxes()
+{
+	struct FoF_Box box[FOF_NRANK_BOXES];
+
+	const int level = imin(NTop_Leaves, FOF_NRANK_BOXES);
+
+	for (int i = 0; i < FOF_NRANK_BOXES; i++) {
+
+		if (i < level && Top_Tree[level + i].Last > 0)
+			box[i] = Top_Tree[level + i].Box;
+		else
+			box_from_particles(0, 0, &box[i]);
+	}
+
+	Rank_Box = Malloc_Uninit(NRank * sizeof(box), "FoF Rank Box");
+
+	MPI_Allgather(box, sizeof(box), MPI_BYTE, Rank_Box, sizeof(box),
+			MPI_BYTE, MPI_COMM_WORLD);
+
+	return ;
+}
+
+/*
+ * Find the particles to send: every local top node collects the boxes of
+ * other ranks within a linking length, its particles go to the ranks with a
+ * box close to them. Called twice with the same static schedule, first to
+ * count per thread and rank, then to fill "export" from the thread offsets
+ * in "count".
+ */
+
+static void find_exports(int *count, int *export)
+{
+	if (export == NULL)
+		memset(count, 0, NRank * sizeof(*count));
+
+	const size_t mark = Scratch_Push();
+
+	int *close = Scratch_Alloc(NRank * FOF_NRANK_BOXES * sizeof(*close));
+
+	#pragma omp for schedule(static)
+	for (int j = 0; j < NTop_Nodes; j++) {
+
+		if (D[j].TNode.Npart == 0)
+			continue;
+
+		int nClose = 0;
+
+		for (int task = 0; task < NRank; task++) {
+
+			if (task == Task.Rank)
+				continue;
+
+			for (int i = 0; i < FOF_NRANK_BOXES; i++) {
+
+				const int b = task * FOF_NRANK_BOXES + i;
+
+				if (box_is_empty(&Rank_Box[b])
+						|| boxes_are_apart(&Top_Box[j], &Rank_Box[b]))
+					continue;
+
+				close[nClose++] = b;
+			}
+		}
+
+		if (nClose == 0)
+			continue;
+
+		const int first = D[j].TNode.First_Part;
+		const int last = first + D[j].TNode.Npart;
+
+		for (int ipart = first; ipart < last; ipart++) {
+
+			struct FoF_Box pbox = { { 0 } };
+
+			for (int i = 0; i < 3; i++)
+				pbox.Min[i] = pbox.Max[i] = P.Pos[i][ipart];
+
+			int last_task = -1;
+
+			for (int i = 0; i < nClose; i++) {
+
+				const int task = close[i] / FOF_NRANK_BOXES;
+
+				if (task == last_task
+						|| boxes_are_apart(&pbox, &Rank_Box[close[i]]))
+					continue;
+
+				if (export != NULL)
+					export[count[task]] = ipart;
+
+				count[task]++;
+
+				last_task = task;
+			}
+		}
+	}
+
+	Scratch_Pop(mark);
+
+	return ;
+}
+
+/*
+ * Link a ghost to all local particles within a linking length. As tree walk
+ * with a point-like box.
+ */
+
+static void link_ghost_particle(const int i)
+{
+	const int ighost = Task.Npart_Total + i;
+
+	struct FoF_Box box = { { 0 } };
+
+	for (int j = 0; j < 3; j++)
+		box.Min[j] = box.Max[j] = Ghost_Pos[i][j];
+
+	int k = 1, j = 0;
+
+	while ((j = next_top_node(&k, &box, 0)) >= 0) {
+
+		int first = D[j].TNode.First_Part;
+		int last = first + D[j].TNode.Npart;
+
+		int node = 0, end = 0;
+
+		if (D[j].TNode.Npart > VECTOR_SIZE) {
+
+			node = D[j].TNode.Target;
+			end = node + Tree[node].DNext;
+		}
+
+		do {
+
+			if (node < end) {
+
+				if (boxes_are_apart(&box, &Node_Box[node])) {
+
+					node += imax(1, Tree[node].DNext);
+
+					continue;
+				}
+
+				if (Tree[node].DNext > 0) {
+
+					node++;
+
+					continue;
+				}
+
+				first = Node_First[node];
+				last = first + Tree[node].Npart;
+
+				node++;
+			}
+
+			for (int ipart = first; ipart < last; ipart++) {
+
+				Float dr[3] = { P.Pos[0][ipart] - Ghost_Pos[i][0],
+								P.Pos[1][ipart] - Ghost_Pos[i][1],
+								P.Pos[2][ipart] - Ghost_Pos[i][2] };
+
+				Periodic_Nearest(dr); // PERIODIC
+
+				if (p2(dr[0]) + p2(dr[1]) + p2(dr[2]) <= Link_Length2)
+					union_sets(ipart, ighost);
+			}
+
+			first = last = 0;
+
+		} while (node < end);
+	}
+
+	return ;
+}
+
+/*
+ * Every rank sends the labels of its exported particles to the owners of the
+ * ghosts, who lower the label of the fragment the ghost is linked to. This
+ * is repeated until no label changes anywhere, i.e. a few times for groups
+ * that span several ranks.
+ */
+
+static void stitch_groups_across_ranks()
+{
+	if (NRank == 1)
+		return ;
+
+	#pragma omp single
+	{
+
+	int *ghost_frag = Malloc_Uninit(NGhost_Total * sizeof(*ghost_frag),
+			"FoF Ghost Frag");
+
+	for (int i = 0; i < NGhost_Total; i++) {
+
+		const int root = Group[Task.Npart_Total + i];
+
+		if (root < Task.Npart_Total) { // linked to a local particle
+
+			ghost_frag[i] = Group[root];
+
+			Frag[ghost_frag[i]].Is_Boundary = true;
+
+		} else {
+
+			ghost_frag[i] = -1;
+		}
+	}
+
+	for (int i = 0; i < NExport_Total; i++)
+		Frag[Group[Export[i]]].Is_Boundary = true;
+
+	int send_bytes[NRank], send_offset[NRank];
+	int recv_bytes[NRank], recv_offset[NRank];
+
+	for (int task = 0; task < NRank; task++) {
+
+		send_bytes[task] = NExport[task] * sizeof(ID_t);
+		recv_bytes[task] = NGhost[task] * sizeof(ID_t);
+
+		send_offset[task] = task == 0 ? 0
+						  : send_offset[task-1] + send_bytes[task-1];
+		recv_offset[task] = task == 0 ? 0
+						  : recv_offset[task-1] + recv_bytes[task-1];
+	}
+
+	ID_t *send = Malloc_Uninit(NExport_Total * sizeof(*send), "FoF Send");
+	ID_t *recv = Malloc_Uninit(NGhost_Total * sizeof(*recv), "FoF Recv");
+
+	int nIter = 0, changed = true;
+
+	while (changed) {
+
+		for (int i = 0; i < NExport_Total; i++)
+			send[i] = Frag[Group[Export[i]]].Label;
+
+		MPI_Alltoallv(send, send_bytes, send_offset, MPI_BYTE, recv,
+				recv_bytes, recv_offset, MPI_BYTE, MPI_COMM_WORLD);
+
+		changed = false;
+
+		for (int i = 0; i < NGhost_Total; i++) {
+
+			const int ifrag = ghost_frag[i];
+
+			if (ifrag < 0 || recv[i] >= Frag[ifrag].Label)
+				continue;
+
+			Frag[ifrag].Label = recv[i];
+
+			changed = true;
+		}
+
+		MPI_Allreduce(MPI_IN_PLACE, &changed, 1, MPI_INT, MPI_LOR,
+				MPI_COMM_WORLD);
+
+		nIter++;
+	}
+
+	if (Task.Is_MPI_Master)
+		printf("FoF: Stitched groups across ranks in %d iterations \n",
+				nIter);
+
+	Free(recv); Free(send); Free(ghost_frag);
+	Free(Ghost_Pos); Free(Export); Free(NGhost); Free(NExport);
+	Free(Thread_Count); Free(Rank_Box);
+
+	} // omp single
+
+	return ;
+}
+
+/*
+ * The MPI master collects all fragments that are large enough or might be
+ * part of a larger group, merges them by label and writes the groups with
+ * at least FOF_MIN_NPART particles in descending order.
+ */
+
+static void write_group_catalogue()
+{
+	#pragma omp single
+	{
+
+	int nSend = 0;
+
+	for (int i = 0; i < NFrag; i++)
+		if (Frag[i].Npart >= FOF_MIN_NPART || Frag[i].Is_Boundary)
+			Frag[nSend++] = Frag[i];
+
+	int nSend_Bytes = nSend * sizeof(*Frag);
+
+	int nBytes[NRank], offset[NRank];
+
+	MPI_Gather(&nSend_Bytes, 1, MPI_INT, nBytes, 1, MPI_INT, MASTER,
+			MPI_COMM_WORLD);
+
+	int nRecv = 0;
+
+	if (Task.Is_MPI_Master) {
+
+		offset[0] = 0;
+
+		for (int i = 1; i < NRank; i++)
+			offset[i] = offset[i-1] + nBytes[i-1];
+
+		nRecv = (offset[NRank-1] + nBytes[NRank-1]) / sizeof(*Frag);
+	}
+
+	struct Group_Fragment *recv = Malloc((nRecv + 1) * sizeof(*recv),
+			"FoF Catalogue");
+
+	MPI_Gatherv(Frag, nSend_Bytes, MPI_BYTE, recv, nBytes, offset, MPI_BYTE,
+			MASTER, MPI_COMM_WORLD);
+
+	if (Task.Is_MPI_Master) {
+
+		qsort(recv, nRecv, sizeof(*recv), &compare_fragment_labels);
+
+		int nGroups = 0;
+
+		for (int i = 0; i < nRecv; i++) { // merge fragments into groups
+
+			struct Group_Fragment *grp = &recv[nGroups];
+
+			if (i == 0 || recv[i].Label != recv[nGroups-1].Label) {
+
+				*grp = recv[i];
+
+				nGroups++;
+
+				continue;
+			}
+
+			grp = &recv[nGroups-1];
+
+			Float dr[3] = { recv[i].CoM[0] - grp->CoM[0],
+							recv[i].CoM[1] - grp->CoM[1],
+							recv[i].CoM[2] - grp->CoM[2] };
+
+			Periodic_Nearest(dr); // PERIODIC
+
+			double mass = grp->Mass + recv[i].Mass;
+
+			for (int j = 0; j < 3; j++) {
+
+				grp->CoM[j] += recv[i].Mass * dr[j] / mass;
+				grp->Vel[j] = (grp->Mass * grp->Vel[j]
+							+ recv[i].Mass * recv[i].Vel[j]) / mass;
+			}
+
+			grp->Mass = mass;
+			grp->Npart += recv[i].Npart;
+		}
+
+		qsort(recv, nGroups, sizeof(*recv), &compare_fragment_npart);
+
+		while (nGroups > 0 && recv[nGroups-1].Npart < FOF_MIN_NPART)
+			nGroups--;
+
+#ifdef PERIODIC
+		for (int i = 0; i < nGroups; i++) // same image on any NRank
+			for (int j = 0; j < 3; j++)
+				recv[i].CoM[j] = fmod(recv[i].CoM[j] + Sim.Boxsize[j],
+									  Sim.Boxsize[j]);
+#endif
+
+		char fname[CHARBUFSIZE] = { "" };
+
+		sprintf(fname, "%s_%03d", Param.FoF_File_Base, Time.Snap_Counter);
+
+		FILE *fp = fopen(fname, "w");
+
+		Assert(fp != NULL, "Can't open file %s", fname);
+
+		fprintf(fp, "# Time %g, NGroups %d, Linking length %g \n"
+				"# Label Npart Mass CoM[0] CoM[1] CoM[2] Vel[0] Vel[1] "
+				"Vel[2] \n", Time.Current, nGroups, Link_Length);
+
+		for (int i = 0; i < nGroups; i++)
+			fprintf(fp, "%"PRIu64" %d %g %g %g %g %g %g %g \n",
+					(uint64_t) recv[i].Label, recv[i].Npart, recv[i].Mass,
+					recv[i].CoM[0], recv[i].CoM[1], recv[i].CoM[2],
+					recv[i].Vel[0], recv[i].Vel[1], recv[i].Vel[2]);
+
+		fclose(fp);
+
+		printf("FoF: Wrote %d groups with >= %d particles to %s \n",
+				nGroups, FOF_MIN_NPART, fname);
+	}
+
+	Free(recv);
+
+	} // omp single
+
+	return ;
+}
+
+static int compare_int(const void *a, const void *b)
+{
+	const int *x = (const int *) a;
+	const int *y = (const int *) b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+static int compare_fragment_labels(const void *a, const void *b)
+{
+	const struct Group_Fragment *x = (const struct Group_Fragment *) a;
+	const struct Group_Fragment *y = (const struct Group_Fragment *) b;
+
+	return (x->Label > y->Label) - (x->Label < y->Label);
+}
+
+static int compare_fragment_npart(const void *a, const void *b)
+{
+	const struct Group_Fragment *x = (const struct Group_Fragment *) a;
+	const struct Group_Fragment *y = (const struct Group_Fragment *) b;
+
+	return (x->Npart < y->Npart) - (x->Npart > y->Npart);
+}
+
+#endif // FOF
@@ -0,0 +1,38 @@
+#ifndef FOF_H
+#define FOF_H
+
+/*
+ * In-situ Friends-of-Friends group finder
+ */
+
+#include "../includes.h"
+#include "../domain.h"
+#include "../periodic.h"
+#include "../sort.h"
+#include "../timestep.h"
+#include "../vector.h"
+#include "../Gravity/tree.h"
+
+#ifdef FOF
+
+#ifndef GRAVITY_TREE
+#error FOF requires GRAVITY_TREE for the neighbour search
+#endif
+
+#ifndef FOF_LINKING_LENGTH
+#define FOF_LINKING_LENGTH 0.2 // in units of the mean particle separation
+#endif
+
+#ifndef FOF_MIN_NPART
+#define FOF_MIN_NPART 32
+#endif
+
+void FoF();
+
+#else // ! FOF
+
+static inline void FoF() {};
+
+#endif // FOF
+
+#endif // FOF_H
@@ -2,175 +2,231 @@
 
 #ifdef GRAVITY_FORCETEST
 
-#define NTEST 10
+static void direct_summation(const int ipart, double acc[3]);
+static void write_percentiles();
+static int compare_errors(const void *a, const void *b);
 
-//static const Float H = 105/32 * GRAV_SOFTENING; // Plummer equiv softening
-
-static Float H = 0;
-
-static double Mean_Error = 0, Max_Error = 0;
+static int NSample = 0;
+static int *Sample = NULL;		// particle index of the random subsample
+static double *Error = NULL;	// relative force error of the sample
 static int Worst_Part = -1;
-
-static double xacc_i = 0, yacc_i = 0, zacc_i = 0, pot_i = 0;
-static int idx[NTEST] = { 0 };
+static double Percentile[4] = { 0 }; // 50, 90, 99, 100
 
 /*
- * This computes the gravitational interaction via direct summation and shows
- * the relative error resp. the old force. Note that the total relative error 
- * can become large if one component of the force is close to 0 without 
- * consequence. We check NTEST particles only.
+ * This computes the gravitational acceleration of a random subsample of
+ * FORCETEST_NPART active particles via direct summation and compares it with
+ * the acceleration from the tree. The samples are distributed over the
+ * threads, the sum over all particles is a simd loop. With PERIODIC we add
+ * the Ewald correction. The percentiles of the relative error
+ * |a - a_direct|/|a_direct| are written to the "forcetest" log, to tune
+ * TREE_OPEN_PARAM_* and VECTOR_SIZE at a fixed accuracy. One rank only.
  */
 
 void Gravity_Forcetest()
 {
-	Profile("Gravity_Simple");
-
-	rprintf("Direct Gravity, N = %d \n"
-			"      ID          Errors                 Tree Accel.         "
-			"             Direct Accel. \n", NTEST);
+	Profile("Gravity Forcetest");
 
 	#pragma omp single
 	{
 
-	Mean_Error = Max_Error = 0;
+	NSample = imin(FORCETEST_NPART, NActive_Particles);
 
-	Worst_Part = -1;
+	Sample = Malloc_Uninit(NSample * sizeof(*Sample), "Forcetest Sample");
+	Error = Malloc_Uninit(NSample * sizeof(*Error), "Forcetest Error");
 
-	H = -41.0/32.0 * Param.Grav_Softening[1];
+	for (int i = 0; i < NSample; i++) // with repetition
+		Sample[i] = Active_Particle_List[(int) (erand48(Task.Seed)
+				* NActive_Particles)];
 
 	} // omp single
 
-	
-	#pragma omp single
-	for (int i = 0; i < NTEST; i++) 
-		idx[i] = erand48(Task.Seed) * NActive_Particles;		
+	rprintf("Direct Gravity, N = %d ", NSample);
+
+	#pragma omp for schedule(dynamic)
+	for (int i = 0; i < NSample; i++) {
 
-	for (int i = 0; i < NTEST; i++) {
+		const int ipart = Sample[i];
 
-		int ipart = Active_Particle_List[idx[i]];
+		double acc[3] = { 0 };
 
-		const double acc_old[3] = { P.Acc[0][ipart], 
-									P.Acc[1][ipart], 
-									P.Acc[2][ipart] };
+		direct_summation(ipart, acc);
 
-		const double pos_i[3] = { P.Pos[0][ipart], 
-								  P.Pos[1][ipart], 
-								  P.Pos[2][ipart] };
+		double err = sqrt(p2(P.Acc[0][ipart] - acc[0])
+				+ p2(P.Acc[1][ipart] - acc[1]) + p2(P.Acc[2][ipart] - acc[2]));
 
-		#pragma omp single 
-		xacc_i = yacc_i = zacc_i = pot_i = 0;
+		Error[i] = err / sqrt(p2(acc[0]) + p2(acc[1]) + p2(acc[2]));
+	}
 
-		#pragma omp for reduction(+:xacc_i,yacc_i,zacc_i,pot_i)
-		for (int jpart = 0; jpart < Sim.Npart_Total; jpart++) {
+	#pragma omp single
+	{
 
-			Float dr[3] = { P.Pos[0][jpart] - pos_i[0],
-							P.Pos[1][jpart] - pos_i[1],
-							P.Pos[2][jpart] - pos_i[2] };
+	write_percentiles();
 
-			Periodic_Nearest(dr); // PERIODIC 
+	Free(Error); Free(Sample);
 
-			double r2 = dr[0]*dr[0] + dr[1]*dr[1] + dr[2]*dr[2];
+	} // omp single
 
-			if (r2 > 0) {
+	rprintf("done \nForce test: rel. error 50%% %g, 90%% %g, 99%% %g, "
+			"max %g @ ID %"PRIu64" \n\n", Percentile[0], Percentile[1],
+			Percentile[2], Percentile[3], (uint64_t) P.ID[Worst_Part]);
 
-				Float fac = Const.Gravity * P.Mass[jpart];
-				Float fac_pot = Const.Gravity * P.Mass[jpart];
+	Profile("Gravity Forcetest");
 
-				if (r2 < Epsilon2[1]) { 
+	return ;
+}
 
-					Float u2 = r2 / Epsilon2[1];
-	
-					fac *= (175 - u2 * (294 - u2 * 135)) / (16*Epsilon3[1]) ;
+/*
+ * Same K1 kernel as in the tree, see tree_accel.c. The nearest image is
+ * found arithmetically to keep the loop vectorisable, the Ewald correction
+ * follows in a second loop.
+ */
 
-					fac_pot *= (u2 * (175 - (u2 * 147  - u2 * 45)) - 105)
-								/(32*Epsilon[1]);
+static void direct_summation(const int ipart, double acc[3])
+{
+	const Float x = P.Pos[0][ipart];
+	const Float y = P.Pos[1][ipart];
+	const Float z = P.Pos[2][ipart];
+
+#ifdef ADAPTIVE_SOFTENING
+	const Float h_i = P.Softening[ipart];
+#else
+	const Float h = Epsilon[1];
+#endif
 
-				} else {
+#ifdef PERIODIC
+	const Float L[3] = { Sim.Boxsize[0], Sim.Boxsize[1], Sim.Boxsize[2] };
+	const Float L_inv[3] = { 1/L[0], 1/L[1], 1/L[2] };
+#endif
 
-					Float r_inv = 1/SQRT(r2); // tempt the compiler for rsqrts
+	double ax = 0, ay = 0, az = 0;
 
-					fac *= r_inv * r_inv * r_inv;
-					fac_pot *= r_inv;
-				}
+	#pragma omp simd reduction(+:ax,ay,az)
+	for (int jpart = 0; jpart < Task.Npart_Total; jpart++) {
 
-				xacc_i += fac * dr[0];
-				yacc_i += fac * dr[1];
-				zacc_i += fac * dr[2];
+		Float dx = P.Pos[0][jpart] - x;
+		Float dy = P.Pos[1][jpart] - y;
+		Float dz = P.Pos[2][jpart] - z;
 
 #ifdef PERIODIC
-				Float result[3] = { 0 };
-	
-				Ewald_Correction(dr, &result[0]);
+		dx -= L[0] * rint(dx * L_inv[0]);
+		dy -= L[1] * rint(dy * L_inv[1]);
+		dz -= L[2] * rint(dz * L_inv[2]);
+#endif
 
-				xacc_i += Const.Gravity * P.Mass[jpart] * result[0];
-				yacc_i += Const.Gravity * P.Mass[jpart] * result[1];
-				zacc_i += Const.Gravity * P.Mass[jpart] * result[2];
+#ifdef ADAPTIVE_SOFTENING // as in the tree
+		const Float h = fmax(h_i, P.Softening[jpart]);
+#endif
 
-#endif // PERIODIC
+		const Float r2 = dx*dx + dy*dy + dz*dz;
 
-#ifdef GRAVITY_POTENTIAL
-				if (r < H) { // WC2 kernel softening
+		Float fac = 0;
 
-					double u = r/H;
-					double u2 = u*u;
-					double u3 = u2*u;
+		if (r2 > 0) {
 
-					rinv = (7*u2-21*u2*u2+28*u3*u2-15*u3*u3+u3*u3*u*8-3)/H;
-				}
+			if (r2 < h*h) {
 
-				pot_i += Const.Gravity * P.Mass[jpart] *rinv;
-#endif
+				Float u2 = r2 / (h*h);
+
+				fac = (175 - u2 * (294 - u2 * 135)) / (16*h*h*h);
+
+			} else {
+
+				Float r_inv = 1/SQRT(r2);
 
-#if defined (GRAVITY_POTENTIAL) && defined(PERIODIC)
-				Float pot_corr = 0;
+				fac = r_inv * r_inv * r_inv;
+			}
+		}
+
+		fac *= Const.Gravity * P.Mass[jpart];
+
+		ax += fac * dx;
+		ay += fac * dy;
+		az += fac * dz;
+	}
+
+#ifdef PERIODIC
+	for (int jpart = 0; jpart < Task.Npart_Total; jpart++) {
+
+		Float dr[3] = { P.Pos[0][jpart] - x, P.Pos[1][jpart] - y,
+						P.Pos[2][jpart] - z };
 
-				Ewald_Potential(dr, &pot_corr); // PERIODIC
+		Periodic_Nearest(dr);
 
-				pot_i += Const.Gravity * P.Mass[jpart] * pot_corr;
-#endif 
+		if (dr[0] == 0 && dr[1] == 0 && dr[2] == 0)
+			continue;
 
-			} // r2 > 0
-		} // for jpart
+		Float result[3] = { 0 };
 
-		#pragma omp single
-		{
+		Ewald_Correction(dr, &result[0]);
+
+		ax += Const.Gravity * P.Mass[jpart] * result[0];
+		ay += Const.Gravity * P.Mass[jpart] * result[1];
+		az += Const.Gravity * P.Mass[jpart] * result[2];
+	}
+#endif // PERIODIC
+
+	acc[0] = ax;
+	acc[1] = ay;
+	acc[2] = az;
+
+	return ;
+}
 
-		double error[3] = { (acc_old[0] - xacc_i) / xacc_i,
-							(acc_old[1] - yacc_i) / yacc_i,
-							(acc_old[2] - zacc_i) / zacc_i };
+/*
+ * Sort the errors and append the 50, 90, 99 percentiles and the maximum to
+ * the log file.
+ */
 
-		double error1 = sqrt( p2(error[0]) + p2(error[1]) + p2(error[2]));
-	
-		double acc = sqrt( p2(xacc_i) + p2(yacc_i) + p2(zacc_i) );
-		double acc2 = sqrt( p2(acc_old[0]) + p2(acc_old[1]) + p2(acc_old[2]) );
+static void write_percentiles()
+{
+	static bool first_call = true;
 
-		double error2 = (acc2 - acc) /acc;
+	double max_error = 0;
 
-		Mean_Error += error2;
+	for (int i = 0; i < NSample; i++) {
 
-		if (error2 > Max_Error) {
+		if (Error[i] >= max_error) {
 
-			Max_Error = error2;
-			Worst_Part = ipart;
+			max_error = Error[i];
+			Worst_Part = Sample[i];
 		}
+	}
+
+	qsort(Error, NSample, sizeof(*Error), &compare_errors);
+
+	Percentile[0] = Error[(int) (0.50 * (NSample - 1))];
+	Percentile[1] = Error[(int) (0.90 * (NSample - 1))];
+	Percentile[2] = Error[(int) (0.99 * (NSample - 1))];
+	Percentile[3] = max_error;
+
+	char fname[CHARBUFSIZE] = { "" };
 
-		printf("   %9d  %05.4f %+05.4f   %+09.3f %+09.3f %+09.3f	"
-				"%+09.3f %+09.3f %+09.3f\n",
-				P.ID[ipart], error1, error2, acc_old[0], acc_old[1], 
-				acc_old[2],	xacc_i, yacc_i, zacc_i);
+	sprintf(fname, "%s/forcetest", Param.Log_File_Dir);
 
-		} // omp single
-	} // for ipart
+	FILE *fp = fopen(fname, first_call ? "w" : "a");
 
-	rprintf("done\n");
+	Assert(fp != NULL, "Can't open %s for writing", fname);
 
-	rprintf("\nForce test: NActive %d, max error %g @ %d, mean error %g \n\n",
-			NActive_Particles, Max_Error, Worst_Part,
-			Mean_Error/NTEST);
+	if (first_call)
+		fprintf(fp, "# Time NSample Err_50 Err_90 Err_99 Err_Max ID_Max\n");
 
-	Profile("Gravity_Simple");
+	fprintf(fp, "%g %d %g %g %g %g %"PRIu64"\n", Time.Current, NSample, 
+			Percentile[0], Percentile[1], Percentile[2], Percentile[3],
+			(uint64_t) P.ID[Worst_Part]);
+
+	fclose(fp);
+
+	first_call = false;
 
 	return ;
 }
 
+static int compare_errors(const void *a, const void *b)
+{
+	const double *x = (const double *) a;
+	const double *y = (const double *) b;
+
+	return (*x > *y) - (*x < *y);
+}
+
 #endif // GRAVITY_FORCETEST
@@ -2,14 +2,19 @@
 #define FORCETEST_H
 
 #include "../includes.h"
+#include "../periodic.h"
+#include "periodic.h"
+#include "tree.h"
 
 #if defined(GRAVITY) && defined(GRAVITY_FORCETEST)
+
+#ifndef FORCETEST_NPART
+#define FORCETEST_NPART 10000 // random active particles tested
+#endif
+
 void Gravity_Forcetest();
 #else
 static inline void Gravity_Forcetest() {};
 #endif // GRAVITY_FORCETEST
 
 #endif // GRAVITY_SIMPLE_H
-
-
-
@@ -10,6 +10,26 @@
 #include "../periodic.h"
 #include "periodic.h"
 
+#if defined(HOLD) && !(defined(GRAVITY) && defined(GRAVITY_TREE))
+#error HOLD requires the source selection of GRAVITY_TREE
+#endif
+
+#ifdef ADAPTIVE_SOFTENING
+
+#if !(defined(GRAVITY) && defined(GRAVITY_TREE))
+#error ADAPTIVE_SOFTENING requires the leaves of GRAVITY_TREE
+#endif
+
+#ifndef ADAPTIVE_SOFTENING_ETA
+#define ADAPTIVE_SOFTENING_ETA 0.5 // in units of the local particle separation
+#endif
+
+#ifndef ADAPTIVE_SOFTENING_MIN
+#define ADAPTIVE_SOFTENING_MIN 0.1 // in units of GravSoftening
+#endif
+
+#endif // ADAPTIVE_SOFTENING
+
 #if defined(GRAVITY) && defined(GRAVITY_TREE)
 
 void Setup_Gravity_Tree();
@@ -20,6 +40,19 @@ void Gravity_Tree_Update_Topnode_Kicks();
 void Gravity_Tree_Update_Drift(const double dt);
 void Gravity_Tree_Free();
 
+#ifdef HOLD
+void Gravity_Tree_Update_Timebin(const int ipart, const int old_bin);
+#else
+static inline void Gravity_Tree_Update_Timebin(const int ipart,
+		const int old_bin) {};
+#endif // HOLD
+
+#ifdef TREE_SORT_LEAVES
+void Gravity_Tree_Sort_Leaves();
+#else
+static inline void Gravity_Tree_Sort_Leaves() {};
+#endif // TREE_SORT_LEAVES
+
 extern struct Tree_Node {
 	int DNext;			// Distance to the next node; or particle -DNext-1
 	uint32_t Bitfield; 	// bit 0-5:level, 6-8:key, 9:local, 10:top
@@ -29,6 +62,17 @@ extern struct Tree_Node {
 	Float Mass;			// Total Mass of particles inside node
 	Float CoM[3];		// Center of Mass
 	Float Dp[3];		// Velocity of Center of Mass
+#ifdef HERMITE
+	Float Vel[3];		// Mass weighted velocity at build time, for the jerk
+#endif
+#ifdef HOLD
+	float Bin_Mass[N_TIME_BINS]; // Mass per timebin
+	uint8_t Bin_Min;	// smallest and largest timebin, conservative
+	uint8_t Bin_Max;
+#endif
+#ifdef ADAPTIVE_SOFTENING
+	Float Softening;	// largest softening of the particles inside
+#endif
 } * restrict Tree;
 
 
@@ -43,11 +87,27 @@ struct Walk_Data_Particle { // stores exported particle data
 	Float Pos[3];
 	Float Acc; 				// only magnitude of the last acceleration
 	Float Mass;
+#ifdef HERMITE
+	Float Vel[3];
+#endif
+#ifdef HOLD
+	int Time_Bin;
+#endif
+#ifdef ADAPTIVE_SOFTENING
+	Float Softening;
+#endif
 };
 
 struct Walk_Data_Result { 	// stores exported summation results
 	Float Cost;
 	double Grav_Acc[3];
+#ifdef HERMITE
+	double Grav_Jerk[3];
+#endif
+#ifdef HOLD
+	double Kick_Acc[3];		// weighted with the timestep of the source
+	Float Pair_Acc;			// largest acceleration of the pair partners
+#endif
 #ifdef GRAVITY_POTENTIAL
 	double Grav_Potential;
 #endif
@@ -62,6 +122,49 @@ bool Node_Is(const enum Tree_Bitfield bit, const int node);
 void Node_Set(const enum Tree_Bitfield bit, const int node);
 void Node_Clear(const enum Tree_Bitfield bit, const int node);
 
+#ifdef HOLD
+
+#ifdef HERMITE
+#error HOLD and HERMITE are exclusive
+#endif
+
+/*
+ * With HOLD only particles in active timebins are sources. The force of a
+ * source on a slower timestep acts over the step of the source, so it is
+ * weighted with the ratio of the timesteps (Pelupessy+ 2012).
+ */
+
+static inline Float Hold_Pair_Weight(const int bin_sink, const int bin_src)
+{
+	return (Float) (1ULL << (MAX(bin_sink, bin_src) - bin_sink));
+}
+
+/*
+ * Return the active mass of a node from its timebin histogram and the mass
+ * weighted pair weight in "weight".
+ */
+
+static inline Float Hold_Node_Mass(const float * restrict bin_mass,
+		const int bin_min, const int bin_max, const int bin_sink,
+		Float *weight)
+{
+	const int last = MIN(bin_max, Time.Max_Active_Bin);
+
+	Float mass = 0, mass_kick = 0;
+
+	for (int i = bin_min; i <= last; i++) {
+
+		mass += bin_mass[i];
+		mass_kick += bin_mass[i] * Hold_Pair_Weight(bin_sink, i);
+	}
+
+	*weight = (mass > 0) ? mass_kick / mass : 1;
+
+	return mass;
+}
+
+#endif // HOLD
+
 #else // ! (GRAVITY && GRAVITY_TREE)
 
 static inline void Setup_Gravity_Tree() {}; 
@@ -72,6 +175,9 @@ static inline void Gravity_Tree_Update_Kicks(const int ipart,const double dt){};
 static inline void Gravity_Tree_Update_Topnode_Kicks() {};
 static inline void Gravity_Tree_Update_Drift(const double dt) {};
 static inline void Gravity_Tree_Free() {};
+static inline void Gravity_Tree_Sort_Leaves() {};
+static inline void Gravity_Tree_Update_Timebin(const int ipart,
+		const int old_bin) {};
 
 #endif // GRAVITY && GRAVITY_TREE
 
@@ -7,7 +7,37 @@ static void add_recv_to(const int ipart);
 
 static bool interact_with_topnode(const int);
 static void interact_with_topnode_particles(const int);
-static void interact(const Float, const Float *, const Float);
+static void interact(const Float, const Float *, const Float,
+		const Float [3], const Float);
+
+#ifdef HERMITE // relative velocity of particle jpart or a node for the jerk
+#define DV_PART(jpart) { P.Vel[0][jpart] - Send.Vel[0], \
+						 P.Vel[1][jpart] - Send.Vel[1], \
+						 P.Vel[2][jpart] - Send.Vel[2] }
+#define DV_NODE(vel) { vel[0] - Send.Vel[0], vel[1] - Send.Vel[1], \
+					   vel[2] - Send.Vel[2] }
+#else
+#define DV_PART(jpart) { 0 }
+#define DV_NODE(vel) { 0 }
+#endif // HERMITE
+
+#ifdef ADAPTIVE_SOFTENING // symmetric, larger softening of sink and source
+#define H_PART(jpart) fmax(Send.Softening, P.Softening[jpart])
+#define H_NODE(n) fmax(Send.Softening, (n).Softening)
+#else
+#define H_PART(jpart) Epsilon[1]
+#define H_NODE(n) Epsilon[1]
+#endif // ADAPTIVE_SOFTENING
+
+#ifdef HOLD // active mass of a node/particle, sets the weight of the source
+#define NODE_MASS(n) (Pair_Mass = 0, Hold_Node_Mass((n).Bin_Mass, \
+							(n).Bin_Min, (n).Bin_Max, Send.Time_Bin, &Weight))
+#define IS_SOURCE(jpart) hold_is_source(jpart)
+static inline bool hold_is_source(const int jpart);
+#else
+#define NODE_MASS(n) ((n).Mass)
+#define IS_SOURCE(jpart) true
+#endif // HOLD
 
 static void gravity_tree_walk(const int);
 static void gravity_tree_walk_BH(const int);
@@ -23,12 +53,25 @@ static void check_total_momentum(const bool show_change);
  * the tree and estimate gravitational acceleration using two different
  * opening criteria. Also open all nodes containing ipart to avoid large 
  * maximum errors. Barnes & Hut 1984, Springel 2006, Dehnen & Read 2012.
+ * With HOLD only particles in active timebins are sources. Nodes carry their
+ * mass per timebin, so we interact with the active mass of a node and skip
+ * nodes without active particles. P.Acc receives the acceleration weighted 
+ * with the timesteps of the sources for the kicks, P.Grav_Acc the unweighted 
+ * one for the timestep criterion. A pair of particles shares the smaller of
+ * their timesteps, so we also keep the larger acceleration of the partners in
+ * direct interactions in P.Pair_Acc (symmetric timesteps, Pelupessy+ 2012).
  */
 
 static struct Walk_Data_Particle Send = { 0 };
 static struct Walk_Data_Result Recv = { 0 };
 #pragma omp threadprivate(Send,Recv)
 
+#ifdef HOLD
+static Float Weight = 1; // of the current source
+static Float Pair_Mass = 0; // larger mass of sink and source particle
+#pragma omp threadprivate(Weight,Pair_Mass)
+#endif
+
 void Gravity_Tree_Acceleration()
 {
 	Profile("Grav Tree Accel");
@@ -102,6 +145,20 @@ static struct Walk_Data_Particle copy_send_from(const int ipart)
 	
 	Send.Acc = P.Last_Acc_Mag[ipart];
 
+#ifdef HERMITE
+	Send.Vel[0] = P.Vel[0][ipart];
+	Send.Vel[1] = P.Vel[1][ipart];
+	Send.Vel[2] = P.Vel[2][ipart];
+#endif
+
+#ifdef HOLD
+	Send.Time_Bin = P.Time_Bin[ipart];
+#endif
+
+#ifdef ADAPTIVE_SOFTENING
+	Send.Softening = P.Softening[ipart];
+#endif
+
 	Send.Mass = P.Mass[ipart];
 
 	return Send;
@@ -109,11 +166,25 @@ static struct Walk_Data_Particle copy_send_from(const int ipart)
 
 static void add_recv_to(const int ipart)
 {
+#ifdef HOLD
+	P.Acc[0][ipart] += Recv.Kick_Acc[0];
+	P.Acc[1][ipart] += Recv.Kick_Acc[1];
+	P.Acc[2][ipart] += Recv.Kick_Acc[2];
+
+	P.Pair_Acc[ipart] = Recv.Pair_Acc;
+#else
 	P.Acc[0][ipart] += Recv.Grav_Acc[0];
 	P.Acc[1][ipart] += Recv.Grav_Acc[1];
 	P.Acc[2][ipart] += Recv.Grav_Acc[2];
+#endif
 
-#ifdef OUTPUT_PARTIAL_ACCELERATIONS
+#ifdef HERMITE
+	P.Jerk[0][ipart] += Recv.Grav_Jerk[0];
+	P.Jerk[1][ipart] += Recv.Grav_Jerk[1];
+	P.Jerk[2][ipart] += Recv.Grav_Jerk[2];
+#endif
+
+#if defined(OUTPUT_PARTIAL_ACCELERATIONS) || defined(HOLD) // timestep
 	P.Grav_Acc[0][ipart] = Recv.Grav_Acc[0];
 	P.Grav_Acc[1][ipart] = Recv.Grav_Acc[1];
 	P.Grav_Acc[2][ipart] = Recv.Grav_Acc[2];
@@ -155,7 +226,12 @@ static bool interact_with_topnode(const int j)
 
 	Float r2 = dr[0]*dr[0] + dr[1]*dr[1] + dr[2]*dr[2];
 
-	Float node_mass = D[j].TNode.Mass;
+	Float node_mass = NODE_MASS(D[j].TNode);
+
+#ifdef HOLD
+	if (node_mass <= 0) // no active particles
+		return true;
+#endif
 
 	if (Sig.Use_BH_Criterion) {
 
@@ -170,23 +246,28 @@ static bool interact_with_topnode(const int j)
 			return false;
 	}
 	
-	interact(node_mass, dr, r2);
+	const Float dv[3] = DV_NODE(D[j].TNode.Vel);
+
+	interact(node_mass, dr, r2, dv, H_NODE(D[j].TNode));
 
 	return true;
 }
 
 /*
- * Top nodes with less than 8 particles point not to the tree but to P as 
- * targets
+ * Top nodes with less than VECTOR_SIZE particles have no subtree, we interact
+ * with their particles in P directly.
  */
 
 static void interact_with_topnode_particles(const int j)
 {
-	const int first = D[j].TNode.Target;
+	const int first = D[j].TNode.First_Part;
 	const int last = first + D[j].TNode.Npart;
 
 	for (int jpart = first; jpart < last; jpart++) {
 
+		if (! IS_SOURCE(jpart)) // HOLD
+			continue;
+
 		Float dr[3] = {P.Pos[0][jpart] - Send.Pos[0],
 					   P.Pos[1][jpart] - Send.Pos[1] ,
 			           P.Pos[2][jpart] - Send.Pos[2] };
@@ -195,8 +276,10 @@ static void interact_with_topnode_particles(const int j)
 		
 		Float r2 = p2(dr[0]) + p2(dr[1]) + p2(dr[2]);
 
+		const Float dv[3] = DV_PART(jpart);
+
 		if (r2 != 0)
-			interact(P.Mass[jpart], dr, r2);
+			interact(P.Mass[jpart], dr, r2, dv, H_PART(jpart));
 	}
 
 	return ;
@@ -225,6 +308,9 @@ static void gravity_tree_walk(const int tree_start)
 
 			for (int jpart = first; jpart < last; jpart++ ) {
 
+				if (! IS_SOURCE(jpart)) // HOLD
+					continue;
+
 				Float dr[3] = {P.Pos[0][jpart] - Send.Pos[0],
 								P.Pos[1][jpart] - Send.Pos[1],
 								P.Pos[2][jpart] - Send.Pos[2]};
@@ -232,9 +318,12 @@ static void gravity_tree_walk(const int tree_start)
 				Periodic_Nearest(dr); // PERIODIC
 
 				Float r2 = dr[0]*dr[0] + dr[1]*dr[1] + dr[2]*dr[2];
+
+				const Float dv[3] = DV_PART(jpart);
 				
 				if (r2 != 0) 
-					interact(P.Mass[jpart], dr, r2);
+					interact(P.Mass[jpart], dr, r2, dv, 
+							H_PART(jpart));
 			}
 
 			node++;
@@ -250,7 +339,16 @@ static void gravity_tree_walk(const int tree_start)
 
 		Float r2 = dr[0]*dr[0] + dr[1]*dr[1] + dr[2]*dr[2];
 
-		Float nMass = Tree[node].Mass;
+		Float nMass = NODE_MASS(Tree[node]);
+
+#ifdef HOLD
+		if (nMass <= 0) { // no active particles
+
+			node += Tree[node].DNext;
+
+			continue;
+		}
+#endif
 
 		Float nSize = Node_Size(node); // now check opening criteria
 
@@ -280,7 +378,9 @@ static void gravity_tree_walk(const int tree_start)
 			}
 		}
 
-		interact(nMass, dr, r2); // use node
+		const Float dv[3] = DV_NODE(Tree[node].Vel);
+
+		interact(nMass, dr, r2, dv, H_NODE(Tree[node])); // use node
 
 		node += Tree[node].DNext; // skip branch
 
@@ -307,6 +407,9 @@ static void gravity_tree_walk_BH(const int tree_start)
 
 			for (int jpart = first; jpart < last; jpart++ ) {
 
+				if (! IS_SOURCE(jpart)) // HOLD
+					continue;
+
 				Float dr[3] = { P.Pos[0][jpart] - Send.Pos[0],
 							    P.Pos[1][jpart] - Send.Pos[1],
 					            P.Pos[2][jpart] - Send.Pos[2] };
@@ -315,8 +418,11 @@ static void gravity_tree_walk_BH(const int tree_start)
 
 				Float r2 = p2(dr[0]) + p2(dr[1]) + p2(dr[2]);
 
+				const Float dv[3] = DV_PART(jpart);
+
 				if (r2 != 0)
-					interact(P.Mass[jpart], dr, r2);
+					interact(P.Mass[jpart], dr, r2, dv, 
+							H_PART(jpart));
 			}
 
 			node++;
@@ -332,7 +438,16 @@ static void gravity_tree_walk_BH(const int tree_start)
 
 		Float r2 = p2(dr[0]) + p2(dr[1]) + p2(dr[2]);
 
-		Float nMass = Tree[node].Mass;
+		Float nMass = NODE_MASS(Tree[node]);
+
+#ifdef HOLD
+		if (nMass <= 0) { // no active particles
+
+			node += Tree[node].DNext;
+
+			continue;
+		}
+#endif
 
 		Float nSize = Node_Size(node); // now check opening criteria
 
@@ -343,7 +458,9 @@ static void gravity_tree_walk_BH(const int tree_start)
 			continue;
 		}
 
-		interact(nMass, dr, r2); // use node
+		const Float dv[3] = DV_NODE(Tree[node].Vel);
+
+		interact(nMass, dr, r2, dv, H_NODE(Tree[node])); // use node
 
 		node += Tree[node].DNext;
 
@@ -356,21 +473,31 @@ static void gravity_tree_walk_BH(const int tree_start)
 /*
  * Gravitational force law using Dehnens K1 softening kernel with central 
  * value corresponding to Plummer softening of potential : 
- * h_K1 = -41.0/32.0 * eps_plummer;
+ * h_K1 = 41.0/32.0 * eps_plummer; The scale h is the larger one of sink and
+ * source with ADAPTIVE_SOFTENING.
+ * With HERMITE we add the jerk, the time derivative of the acceleration 
+ * along the relative velocity dv: G m (f(r) dv + 2 f'(r^2) (dr*dv) dr),
+ * where f is the force factor "fac" below.
  */
 
-static void interact(const Float mass, const Float dr[3], const Float r2)
+static void interact(const Float mass, const Float dr[3], const Float r2,
+		const Float dv[3], const Float h)
 {
 	Float fac = Const.Gravity * mass;
 	Float fac_pot = Const.Gravity * mass;
+	Float fac_jerk = Const.Gravity * mass; // 2 df/dr^2
 
-	if (r2 < Epsilon2[1]) { 
+	if (r2 < h*h) { 
 
-		Float u2 = r2 / Epsilon2[1];
+		Float h_inv = 1/h;
+		Float h3_inv = h_inv * h_inv * h_inv;
+		Float u2 = r2 * h_inv * h_inv;
 
-		fac *= (175 - u2 * (294 - u2 * 135)) / (16*Epsilon3[1]) ;
+		fac *= (175 - u2 * (294 - u2 * 135)) * h3_inv / 16;
 
-		fac_pot *= (u2 * (175 - (u2 * 147  - u2 * 45)) - 105)/(32*Epsilon[1]);
+		fac_pot *= (105 - u2 * (175 - u2 * (147 - u2 * 45))) * h_inv/32;
+
+		fac_jerk *= (270 * u2 - 294) * h3_inv * h_inv * h_inv / 8;
 
 	} else {
 
@@ -378,12 +505,30 @@ static void interact(const Float mass, const Float dr[3], const Float r2)
 
 		fac *= r_inv * r_inv * r_inv;
 		fac_pot *= r_inv;
+		fac_jerk *= -3 * r_inv * r_inv * r_inv * r_inv * r_inv;
 	}
 
 	Recv.Grav_Acc[0] += fac * dr[0];
 	Recv.Grav_Acc[1] += fac * dr[1];
 	Recv.Grav_Acc[2] += fac * dr[2];
 
+#ifdef HOLD
+	Recv.Kick_Acc[0] += Weight * fac * dr[0];
+	Recv.Kick_Acc[1] += Weight * fac * dr[1];
+	Recv.Kick_Acc[2] += Weight * fac * dr[2];
+
+	if (Pair_Mass > 0 && mass > 0) // particle pair
+		Recv.Pair_Acc = fmax(Recv.Pair_Acc, fac * Pair_Mass/mass * SQRT(r2));
+#endif
+
+#ifdef HERMITE
+	Float rv = fac_jerk * (dr[0]*dv[0] + dr[1]*dv[1] + dr[2]*dv[2]);
+
+	Recv.Grav_Jerk[0] += fac * dv[0] + rv * dr[0];
+	Recv.Grav_Jerk[1] += fac * dv[1] + rv * dr[1];
+	Recv.Grav_Jerk[2] += fac * dv[2] + rv * dr[2];
+#endif
+
 #ifdef GRAVITY_POTENTIAL
 	Recv.Grav_Potential += fac_pot;
 #endif
@@ -393,6 +538,18 @@ static void interact(const Float mass, const Float dr[3], const Float r2)
 	return ;
 }
 
+#ifdef HOLD
+static inline bool hold_is_source(const int jpart)
+{
+	const int bin = P.Time_Bin[jpart];
+
+	Weight = Hold_Pair_Weight(Send.Time_Bin, bin);
+	Pair_Mass = fmax(Send.Mass, P.Mass[jpart]);
+
+	return bin <= Time.Max_Active_Bin;
+}
+#endif // HOLD
+
 /*
  * Bitfield functions on global Tree
  */
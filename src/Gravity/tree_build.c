@@ -18,6 +18,12 @@ static void collapse_last_branch(const int, const int, const int, int*);
 static inline int key_fragment(const int);
 static inline void node_set(const enum Tree_Bitfield, const int);
 static void print_top_nodes();
+#ifdef ADAPTIVE_SOFTENING
+static void set_adaptive_softening(const int, const int);
+#else
+static inline void set_adaptive_softening(const int tnode_idx, 
+		const int nNodes) {};
+#endif
 static inline void create_node_from_particle(const int, const int,
 											 const peanoKey, const int,
 											 const int);
@@ -32,7 +38,7 @@ static struct Tree_Node * restrict tree = NULL; //  build in *Tree or *tree
 
 /*
  * This builds the tree in parallel, particles are assumed PH ordered. 
- * We build the tree corresponding to a top node either in the openmp buffer, 
+ * We build the tree corresponding to a top node either in the scratch arena,
  * or directly inside the *Tree memory. Every access to  NNodes, 
  * Max_Nodes has to be protected by the openmp Tree_Lock.
  * A subtree is build starting from the top node in target pointer "*tree". 
@@ -51,6 +57,10 @@ void Gravity_Tree_Build()
 	#pragma omp single
 	NNodes = 0;
 
+	const size_t mark = Scratch_Push();
+
+	struct Tree_Node *buf = Scratch_Alloc(buf_threshold * sizeof(*buf));
+
 	for (;;) {
 
 		#pragma omp single
@@ -68,7 +78,7 @@ void Gravity_Tree_Build()
 
 			if (build_in_buffer) {
 
-				tree = Get_Thread_Safe_Buffer(Task.Buffer_Size);
+				tree = buf;
 
 			} else { // build in *Tree directly
 
@@ -108,6 +118,8 @@ void Gravity_Tree_Build()
 
 	} // forever
 
+	Scratch_Pop(mark);
+
 	rprintf("Tree build: %d of %d Nodes (%2.0f%%) used (%g MB)\n",
 			NNodes, Max_Nodes, NNodes*100.0/Max_Nodes, 
 			Max_Nodes*sizeof(*Tree)/1024.0/1024);
@@ -133,7 +145,7 @@ void Setup_Gravity_Tree()
 
 	for (int i = 0; i < NPARTYPE; i++) { // Plummer eqiv. softening
 	
-		Epsilon[i] = -41.0/32.0 * Param.Grav_Softening[i]; // for Dehnen K1
+		Epsilon[i] = 41.0/32.0 * Param.Grav_Softening[i]; // for Dehnen K1
 		Epsilon2[i] = Epsilon[i] * Epsilon[i];
 		Epsilon3[i] = Epsilon[i] * Epsilon[i] * Epsilon[i];
 	}
@@ -263,6 +275,8 @@ static void set_tree_parent_pointers (const int i)
  * Domain.Size/2^42, hence only occurs with double precision positions. The 
  * Tree.Bitfield contains the level of the node and the Peano-Triplet of the 
  * node at that level. See *Tree definition in gravity.h. 
+ * With SHORT_PEANO_KEYS P.Key resolves 21 levels, deeper particles get the
+ * full key recomputed from their position.
  */
 
 static int build_subtree(const int first_part, const int tnode_idx,
@@ -286,7 +300,7 @@ static int build_subtree(const int first_part, const int tnode_idx,
 
 	for (int ipart = first_part+1; ipart < last_part+1; ipart++) {
 
-		peanoKey key = P.Key[ipart];
+		peanoKey key = REVERSED_PART_KEY(ipart, top_level);
 
 		key >>= 3 * top_level;
 
@@ -298,6 +312,9 @@ static int build_subtree(const int first_part, const int tnode_idx,
 
 		while (lvl < N_PEANO_TRIPLETS) {
 
+			if (lvl == N_PART_KEY_TRIPLETS) // SHORT_PEANO_KEYS exhausted
+				key = REVERSED_PART_KEY(ipart, lvl) >> (3 * lvl);
+
 			if (particle_is_inside_node(key, lvl, node)) { // open node	
 
 				if (tree[node].Npart == 1) { // refine
@@ -306,6 +323,10 @@ static int build_subtree(const int first_part, const int tnode_idx,
 
 					int new_node = nNodes; // is a son of "node"
 
+					if (lvl+1 == N_PART_KEY_TRIPLETS) // SHORT_PEANO_KEYS
+						last_key = REVERSED_PART_KEY(ipart-1, lvl+1)
+															>> (3 * (lvl+1));
+
 					create_node_from_particle(ipart-1, node, last_key, lvl+1,
 																	new_node);
 					nNodes++;
@@ -379,7 +400,7 @@ static int build_subtree(const int first_part, const int tnode_idx,
 static peanoKey create_first_node(const int first_part,
 		const int tnode_idx, const int top_level)
 {
-	peanoKey key = P.Key[first_part];
+	peanoKey key = REVERSED_PART_KEY(first_part, top_level);
 
 	key >>= 3 * top_level;
 
@@ -449,12 +470,33 @@ static int finalise_subtree(const int top_level, const int tnode_idx,
 		tree[i].CoM[0] /= tree[i].Mass;
 		tree[i].CoM[1] /= tree[i].Mass;
 		tree[i].CoM[2] /= tree[i].Mass;
+#ifdef HERMITE
+		tree[i].Vel[0] /= tree[i].Mass;
+		tree[i].Vel[1] /= tree[i].Mass;
+		tree[i].Vel[2] /= tree[i].Mass;
+#endif
 	}
 
+	set_adaptive_softening(tnode_idx, nNodes); // ADAPTIVE_SOFTENING
+
 	D[tnode_idx].TNode.Mass = tree[0].Mass; // copy first node to top node
 	D[tnode_idx].TNode.CoM[0] = tree[0].CoM[0];
 	D[tnode_idx].TNode.CoM[1] = tree[0].CoM[1];
 	D[tnode_idx].TNode.CoM[2] = tree[0].CoM[2];
+#ifdef HERMITE
+	D[tnode_idx].TNode.Vel[0] = tree[0].Vel[0];
+	D[tnode_idx].TNode.Vel[1] = tree[0].Vel[1];
+	D[tnode_idx].TNode.Vel[2] = tree[0].Vel[2];
+#endif
+#ifdef HOLD
+	memcpy(D[tnode_idx].TNode.Bin_Mass, tree[0].Bin_Mass,
+			sizeof(tree[0].Bin_Mass));
+	D[tnode_idx].TNode.Bin_Min = tree[0].Bin_Min;
+	D[tnode_idx].TNode.Bin_Max = tree[0].Bin_Max;
+#endif
+#ifdef ADAPTIVE_SOFTENING
+	D[tnode_idx].TNode.Softening = tree[0].Softening;
+#endif
 
 	if (tree[0].Npart <= VECTOR_SIZE) { // save only topnode, return empty
 
@@ -465,6 +507,8 @@ static int finalise_subtree(const int top_level, const int tnode_idx,
 		return 0;
 	}
 
+	memset(&tree[nNodes], 0, sizeof(*tree));
+
 	node_set(TOP, nNodes); // add a zero node at the end to terminate tree walk
 
 	tree[nNodes].Mass = 1;
@@ -505,6 +549,65 @@ static int finalise_subtree(const int top_level, const int tnode_idx,
 }
 
 
+#ifdef ADAPTIVE_SOFTENING
+
+/*
+ * The softening of a particle is ADAPTIVE_SOFTENING_ETA times the mean 
+ * particle separation in its leaf, bound by GravSoftening from above. Small
+ * top nodes are one leaf. Children follow their parents in the subtree, so 
+ * a backward sweep sets the largest softening of every node for the 
+ * symmetric kernel in the walk. 
+ */
+
+static Float leaf_softening(const int first, const int npart, const int lvl)
+{
+	const Float eps_max = 41.0/32.0 * Param.Grav_Softening[1]; // K1 scale
+	const Float eps_min = ADAPTIVE_SOFTENING_MIN * eps_max;
+
+	Float size = Domain.Size / ((Float) (1ULL << lvl));
+
+	Float eps = 41.0/32.0 * ADAPTIVE_SOFTENING_ETA * size / cbrt(npart);
+
+	eps = fmin(eps_max, fmax(eps_min, eps));
+
+	for (int ipart = first; ipart < first + npart; ipart++)
+		P.Softening[ipart] = eps;
+
+	return eps;
+}
+
+static void set_adaptive_softening(const int tnode_idx, const int nNodes)
+{
+	const int first_part = D[tnode_idx].TNode.First_Part;
+	const int npart = D[tnode_idx].TNode.Npart;
+
+	if (npart <= VECTOR_SIZE) { // no subtree
+
+		tree[0].Softening = leaf_softening(first_part, npart,
+				D[tnode_idx].TNode.Level);
+
+		return ;
+	}
+
+	leaf_softening(first_part, npart, N_PEANO_TRIPLETS); // unresolved parts
+
+	for (int i = nNodes - 1; i > 0; i--) {
+
+		if (tree[i].DNext < 0) // particle bundle
+			tree[i].Softening = leaf_softening(-tree[i].DNext - 1, 
+					tree[i].Npart, tree[i].Bitfield & 0x3F);
+
+		int parent = i - tree[i].DUp;
+
+		tree[parent].Softening = fmax(tree[parent].Softening, 
+				tree[i].Softening);
+	}
+
+	return ;
+}
+
+#endif // ADAPTIVE_SOFTENING
+
 /*
  * For particle and node to overlap the peano key triplet at this tree level 
  * has to be equal. Hence the tree cannot be deeper than the PH key
@@ -533,6 +636,8 @@ static inline void create_node_from_particle(const int ipart,const int parent,
 											 const peanoKey key, const int lvl,
 											 const int node)
 {
+	memset(&tree[node], 0, sizeof(*tree)); // the buffer is not cleared
+
 	tree[node].DNext = -ipart - 1;
 
 	int keyfragment = (key & 0x7) << 6;
@@ -564,6 +669,28 @@ static inline void add_particle_to_node(const int ipart, const int node)
 	tree[node].CoM[1] += P.Pos[1][ipart] * P.Mass[ipart];
 	tree[node].CoM[2] += P.Pos[2][ipart] * P.Mass[ipart];
 
+#ifdef HERMITE
+	tree[node].Vel[0] += P.Vel[0][ipart] * P.Mass[ipart];
+	tree[node].Vel[1] += P.Vel[1][ipart] * P.Mass[ipart];
+	tree[node].Vel[2] += P.Vel[2][ipart] * P.Mass[ipart];
+#endif
+
+#ifdef HOLD
+	const int bin = P.Time_Bin[ipart];
+
+	tree[node].Bin_Mass[bin] += P.Mass[ipart];
+
+	if (tree[node].Npart == 0) {
+
+		tree[node].Bin_Min = tree[node].Bin_Max = bin;
+
+	} else {
+
+		tree[node].Bin_Min = MIN(tree[node].Bin_Min, bin);
+		tree[node].Bin_Max = MAX(tree[node].Bin_Max, bin);
+	}
+#endif
+
 	tree[node].Mass += P.Mass[ipart];
 
 	tree[node].Npart++;
@@ -685,4 +812,86 @@ void test_gravity_tree(const int nNodes)
 }
 
 
+#ifdef TREE_SORT_LEAVES
+
+/*
+ * The tree walk uses the particles of a leaf in any order, so after the
+ * build we sort the particles in every leaf by timebin. Particles of a bin
+ * are then contiguous within a leaf, which makes the active particle vectors
+ * longer. The next domain decomposition restores PH order.
+ */
+
+static void sort_leaf_by_timebin(const int, const int);
+
+void Gravity_Tree_Sort_Leaves()
+{
+	Profile("Tree Sort Leaves");
+
+	#pragma omp for
+	for (int node = 0; node < NNodes; node++)
+		if (Tree[node].DNext < 0 && Tree[node].Npart > 1) // particle bundle
+			sort_leaf_by_timebin(-Tree[node].DNext - 1, Tree[node].Npart);
+
+	#pragma omp for
+	for (int i = 0; i < NTop_Nodes; i++)
+		if (D[i].TNode.Npart <= VECTOR_SIZE) // top node without tree
+			sort_leaf_by_timebin(D[i].TNode.First_Part, D[i].TNode.Npart);
+
+	Make_Active_Particle_List();
+
+	Make_Active_Particle_Vectors();
+
+	Profile("Tree Sort Leaves");
+
+	return ;
+}
+
+static void sort_leaf_by_timebin(const int first, const int npart)
+{
+	int idx[npart];
+
+	bool sorted = true;
+
+	for (int i = 0; i < npart; i++) { // stable insertion sort
+
+		int j = i;
+
+		while (j > 0 && P.Time_Bin[first + idx[j-1]] 
+					  > P.Time_Bin[first + i]) {
+
+			idx[j] = idx[j-1];
+
+			j--;
+		}
+
+		idx[j] = i;
+
+		sorted &= (j == i);
+	}
+
+	if (sorted)
+		return ;
+
+	for (int i = 0; i < NP_Fields; i++) {
+
+		const size_t nBytes = P_Fields[i].Bytes;
+
+		char buf[npart * nBytes];
+
+		for (int j = 0; j < P_Fields[i].N; j++) {
+
+			char *p = Select_Particle(i, j, first);
+
+			for (int k = 0; k < npart; k++)
+				memcpy(&buf[k * nBytes], &p[idx[k] * nBytes], nBytes);
+
+			memcpy(p, buf, npart * nBytes);
+		}
+	}
+
+	return ;
+}
+
+#endif // TREE_SORT_LEAVES
+
 #endif // GRAVITY_TREE
@@ -10,6 +10,16 @@ static void gravity_tree_walk_ewald(const int tree_start);
 static void gravity_tree_walk_ewald_BH(const int tree_start);
 static void interact_with_ewald_cube(const Float *, const Float);
 
+#ifdef HOLD // see tree_accel.c
+#define NODE_MASS(n) Hold_Node_Mass((n).Bin_Mass, (n).Bin_Min, (n).Bin_Max, \
+									Send.Time_Bin, &Weight)
+#define IS_SOURCE(jpart) hold_is_source(jpart)
+static inline bool hold_is_source(const int jpart);
+#else
+#define NODE_MASS(n) ((n).Mass)
+#define IS_SOURCE(jpart) true
+#endif // HOLD
+
 /*
  * Compute the correction to the gravitational force due the periodic
  * infinite box using the tree and the Ewald method (Hernquist+ 1992).
@@ -20,6 +30,11 @@ static struct Walk_Data_Particle Send = { 0 };
 static struct Walk_Data_Result Recv = { 0 };
 #pragma omp threadprivate(Send,Recv)
 
+#ifdef HOLD
+static Float Weight = 1; // of the current source
+#pragma omp threadprivate(Weight)
+#endif
+
 void Gravity_Tree_Periodic()
 {
 	Profile("Grav Tree Periodic");
@@ -83,6 +98,10 @@ static struct Walk_Data_Particle copy_send_from(const int ipart)
 	
 	Send.Acc = P.Last_Acc_Mag[ipart];
 
+#ifdef HOLD
+	Send.Time_Bin = P.Time_Bin[ipart];
+#endif
+
 	Send.Mass = P.Mass[ipart];
 
 	return Send;
@@ -90,11 +109,17 @@ static struct Walk_Data_Particle copy_send_from(const int ipart)
 
 static void add_recv_to(const int ipart)
 {
+#ifdef HOLD
+	P.Acc[0][ipart] += Recv.Kick_Acc[0];
+	P.Acc[1][ipart] += Recv.Kick_Acc[1];
+	P.Acc[2][ipart] += Recv.Kick_Acc[2];
+#else
 	P.Acc[0][ipart] += Recv.Grav_Acc[0];
 	P.Acc[1][ipart] += Recv.Grav_Acc[1];
 	P.Acc[2][ipart] += Recv.Grav_Acc[2];
+#endif
 
-#ifdef OUTPUT_PARTIAL_ACCELERATIONS
+#if defined(OUTPUT_PARTIAL_ACCELERATIONS) || defined(HOLD) // timestep
 	P.Grav_Acc[0][ipart] += Recv.Grav_Acc[0];
 	P.Grav_Acc[1][ipart] += Recv.Grav_Acc[1];
 	P.Grav_Acc[2][ipart] += Recv.Grav_Acc[2];
@@ -115,6 +140,13 @@ static bool interact_with_topnode (const int j)
 
 	bool want_open_node = false;
 
+	Float node_mass = NODE_MASS(D[j].TNode);
+
+#ifdef HOLD
+	if (node_mass <= 0) // no active particles
+		return true;
+#endif
+
 	Float dr[3] = { D[j].TNode.CoM[0] - Send.Pos[0],
 					D[j].TNode.CoM[1] - Send.Pos[1],
 				    D[j].TNode.CoM[2] - Send.Pos[2] };
@@ -130,8 +162,6 @@ static bool interact_with_topnode (const int j)
 
 	} else { // relative criterion
 
-		Float node_mass = D[j].TNode.Mass;
-
 		Float fac = Send.Acc/Const.Gravity*TREE_OPEN_PARAM_REL;
 
 		if (node_mass*node_size*node_size > r2*r2 * fac)
@@ -171,25 +201,28 @@ static bool interact_with_topnode (const int j)
 
 	} // if want_open_node
 
-	interact_with_ewald_cube(dr, D[j].TNode.Mass);
+	interact_with_ewald_cube(dr, node_mass);
 
 	return true;
 }
 
 
 /*
- * Top nodes with less than 8 particles point not to the tree but to P as 
- * targets. As we have to open this one and it is local, we directly interact
- * with the particles.
+ * Top nodes with less than VECTOR_SIZE particles have no subtree. As we have
+ * to open this one and it is local, we directly interact with the particles
+ * in P.
  */
 
 static void interact_with_topnode_particles(const int j)
 {
-	const int first = D[j].TNode.Target;
+	const int first = D[j].TNode.First_Part;
 	const int last = first + D[j].TNode.Npart;
 
 	for (int jpart = first; jpart < last; jpart++) {
 
+		if (! IS_SOURCE(jpart)) // HOLD
+			continue;
+
 		Float dr[3] = { P.Pos[0][jpart] - Send.Pos[0],
 					    P.Pos[1][jpart] - Send.Pos[1],
 			            P.Pos[2][jpart] - Send.Pos[2] };
@@ -232,6 +265,9 @@ static void gravity_tree_walk_ewald(const int tree_start)
 
 			for (int jpart = first; jpart < last; jpart++) {
 
+				if (! IS_SOURCE(jpart)) // HOLD
+					continue;
+
 				Float dr[3] = { P.Pos[0][jpart] - Send.Pos[0],
 							    P.Pos[1][jpart] - Send.Pos[1],
 					            P.Pos[2][jpart] - Send.Pos[2] };
@@ -258,7 +294,16 @@ static void gravity_tree_walk_ewald(const int tree_start)
 
 		Float r2 = p2(dr[0]) + p2(dr[1]) + p2(dr[2]);
 
-		Float node_mass = Tree[node].Mass;
+		Float node_mass = NODE_MASS(Tree[node]);
+
+#ifdef HOLD
+		if (node_mass <= 0) { // no active particles
+
+			node += Tree[node].DNext;
+
+			continue;
+		}
+#endif
 
 		Float node_size = Node_Size(node); // now check opening criteria
 
@@ -335,6 +380,9 @@ static void gravity_tree_walk_ewald_BH(const int tree_start)
 
 			for (int jpart = first; jpart < last; jpart++) {
 
+				if (! IS_SOURCE(jpart)) // HOLD
+					continue;
+
 				Float dr[3] = {P.Pos[0][jpart] - Send.Pos[0],
 							    P.Pos[1][jpart] - Send.Pos[1],
 					            P.Pos[2][jpart] - Send.Pos[2]};
@@ -361,7 +409,16 @@ static void gravity_tree_walk_ewald_BH(const int tree_start)
 
 		Float r2 = p2(dr[0]) + p2(dr[1]) + p2(dr[2]);
 
-		Float node_mass = Tree[node].Mass;
+		Float node_mass = NODE_MASS(Tree[node]);
+
+#ifdef HOLD
+		if (node_mass <= 0) { // no active particles
+
+			node += Tree[node].DNext;
+
+			continue;
+		}
+#endif
 
 		Float node_size = Node_Size(node); // now check opening criteria
 
@@ -433,6 +490,12 @@ static void interact_with_ewald_cube (const Float * dr, const Float mass)
 	Recv.Grav_Acc[0] += Const.Gravity * mass * result[0];
 	Recv.Grav_Acc[1] += Const.Gravity * mass * result[1];
 	Recv.Grav_Acc[2] += Const.Gravity * mass * result[2];
+
+#ifdef HOLD
+	Recv.Kick_Acc[0] += Weight * Const.Gravity * mass * result[0];
+	Recv.Kick_Acc[1] += Weight * Const.Gravity * mass * result[1];
+	Recv.Kick_Acc[2] += Weight * Const.Gravity * mass * result[2];
+#endif
 	
 	Recv.Cost++;
 
@@ -449,6 +512,16 @@ static void interact_with_ewald_cube (const Float * dr, const Float mass)
 	return ;
 }
 
+#ifdef HOLD
+static inline bool hold_is_source(const int jpart)
+{
+	const int bin = P.Time_Bin[jpart];
+
+	Weight = Hold_Pair_Weight(Send.Time_Bin, bin);
+
+	return bin <= Time.Max_Active_Bin;
+}
+#endif // HOLD
 
 #undef N_EWALD
 
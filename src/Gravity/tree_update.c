@@ -54,6 +54,77 @@ void Gravity_Tree_Update_Kicks(const int ipart, const double dt)
 	return ;
 }
 
+#ifdef HOLD
+
+static void move_bin_mass(float * restrict bin_mass, uint8_t *bin_min,
+		uint8_t *bin_max, const int old_bin, const int new_bin,
+		const Float mass);
+
+/*
+ * Move the mass of particle ipart in the timebin histograms of its parent
+ * nodes from old_bin to its new timebin, similar to the kicks above.
+ */
+
+void Gravity_Tree_Update_Timebin(const int ipart, const int old_bin)
+{
+	const int new_bin = P.Time_Bin[ipart];
+
+	if (new_bin == old_bin)
+		return ;
+
+	int i = 0;
+	int node = P.Tree_Parent[ipart];
+
+	if (node >= 0) {
+
+		while (! Node_Is(TOP, node)) {
+
+			move_bin_mass(Tree[node].Bin_Mass, &Tree[node].Bin_Min,
+					&Tree[node].Bin_Max, old_bin, new_bin, P.Mass[ipart]);
+
+			node -= Tree[node].DUp;
+		}
+
+		i = Tree[node].DUp;
+
+	} else
+		i = -node - 1;
+
+	move_bin_mass(D[i].TNode.Bin_Mass, &D[i].TNode.Bin_Min,
+			&D[i].TNode.Bin_Max, old_bin, new_bin, P.Mass[ipart]);
+
+	return ;
+}
+
+/*
+ * The timebin range of a node only grows until the next tree build.
+ */
+
+static void move_bin_mass(float * restrict bin_mass, uint8_t *bin_min,
+		uint8_t *bin_max, const int old_bin, const int new_bin,
+		const Float mass)
+{
+	#pragma omp atomic update
+	bin_mass[old_bin] -= mass;
+	#pragma omp atomic update
+	bin_mass[new_bin] += mass;
+
+	if (new_bin < *bin_min || new_bin > *bin_max) {
+
+		#pragma omp critical (tree_bin_range)
+		{
+
+		*bin_min = MIN(*bin_min, new_bin);
+		*bin_max = MAX(*bin_max, new_bin);
+
+		} // omp critical
+	}
+
+	return ;
+}
+
+#endif // HOLD
+
 /*  
  * Advance updated/kicked Treenodes by the system timestep. Then do the same
  * with the top nodes.
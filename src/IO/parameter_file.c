@@ -169,7 +169,7 @@ void sanity_check_input_parameters()
 			Param.Buffer_Size,  Param.Max_Mem_Size);
 
 	Warn((double)Param.Buffer_Size * p2(1024.0)/sizeof_P < 1000.0,
-		"Thread Safe buffer holds less than 1024 particles "
+		"Scratch arenas hold less than 1024 particles initially, "
 		"Task.Buffer_Size > %d MB recommended, have %g"
 		, 10000*sizeof_P/1024/1024 , Param.Buffer_Size/1024.0/1024.0);
 
@@ -196,5 +196,10 @@ void sanity_check_input_parameters()
 
 	/* Add your own ! */
 
+	Assert(Param.Huge_Page_Size >= 0
+			&& (Param.Huge_Page_Size & (Param.Huge_Page_Size - 1)) == 0,
+			"HugePageSize has to be 0 or a power of 2 in MB, have %d",
+			Param.Huge_Page_Size);
+
 	return ;
 }
@@ -53,6 +53,33 @@ static const parameter ParDef[] = {
 	{"MinSizeTimestep", "1e-7", &Param.Min_Timestep, PAR_DOUBLE},
 
 	/* Add yours below */
+
+	{"\n%% Memory %%\n", "", NULL, PAR_COMMENT},
+	{"HugePageSize", "0", &Param.Huge_Page_Size, PAR_INT}, // MB, 2 or 1024
+
+#ifdef FOF
+	{"\n%% Friends-of-Friends %%\n", "", NULL, PAR_COMMENT},
+	{"FoFFileBase", "groups", &Param.FoF_File_Base, PAR_STRING},
+#endif
+
+#ifdef MAP
+	{"\n%% Maps %%\n", "", NULL, PAR_COMMENT},
+	{"MapFileBase", "map", &Param.Map_File_Base, PAR_STRING},
+	{"MapAxes", "z", &Param.Map_Axes, PAR_STRING},
+	{"MapEveryNSteps", "10", &Param.Map_Every_N_Steps, PAR_INT},
+#ifdef MAP_LIGHTCONE
+	{"MapLightconeFoV", "10", &Param.Map_Lightcone_FoV, PAR_DOUBLE},
+#endif
+#endif
+
+#ifdef LIGHTCONE
+	{"\n%% Lightcone %%\n", "", NULL, PAR_COMMENT},
+	{"LightconeFileBase", "lightcone", &Param.Lightcone_File_Base, PAR_STRING},
+	{"LightconeObserver_0", "0", &Param.Lightcone_Observer[0], PAR_DOUBLE},
+	{"LightconeObserver_1", "0", &Param.Lightcone_Observer[1], PAR_DOUBLE},
+	{"LightconeObserver_2", "0", &Param.Lightcone_Observer[2], PAR_DOUBLE},
+	{"LightconeMaxRedshift", "1", &Param.Lightcone_Max_Redshift, PAR_DOUBLE},
+#endif
 };
 
 static const int NTags = ARRAY_SIZE(ParDef);
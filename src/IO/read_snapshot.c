@@ -1,371 +1,503 @@
 #include "io.h"
 
-#define SKIP_FORTRAN_RECORD safe_fread(&Fortran_Record, 4, 1, fp, swap_Endian);
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
-static int32_t Fortran_Record; // holds the 4 byte Fortran data
+/*
+ * Every rank computes a contiguous slice of every particle type and reads it
+ * directly from the files. Blocks are located with find_block(), the slice
+ * is memory mapped and copied/deinterleaved straight into P, swapping the
+ * endianess on the fly. There is no master scatter and no intermediate
+ * buffer. Param.Num_IO_Tasks limits the number of ranks accessing the file
+ * system at the same time.
+ */
 
-static int safe_fread(void * restrict, size_t, size_t, FILE *, bool);
 static int find_files(char *);
-static bool find_endianess(FILE *);
-static int find_block(FILE *, const char label[4], const bool);
-static void read_header_data(FILE *fp, const bool, int);
-static void read_file(char *, const bool, const int, const int, MPI_Comm);
-static void empty_comm_buffer(char * restrict, const int, const int, 
-		const int *, const size_t *);
+static void get_filename(char *, const char *, const int, const int);
+static bool find_endianess(const int);
+static size_t find_block(const int, const char label[4], const bool, off_t *);
+static void read_header(const int, const bool, struct gadget_header *);
+static void set_sim_from_header(const struct gadget_header *, const int);
+static void find_npart_in_files(const char *, const int, const bool,
+		uint64_t *);
+static void read_file_slice(const char *, const bool,
+		const uint32_t nPart[NPARTYPE], const uint64_t file_first[NPARTYPE],
+		const uint64_t first[NPARTYPE], const uint64_t last[NPARTYPE],
+		const int offsets[NPARTYPE]);
+static void copy_block_to_P(const char * restrict, const int, const size_t,
+		const size_t, const bool);
+static void swap_endianess(void * restrict, const size_t, const size_t);
 
 static void generate_masses_from_header();
 static void set_particle_types();
 
 void Read_Snapshot(char *input_name)
 {
-	int nIOTasks = Param.Num_IO_Tasks;
+	Profile("Read Snap");
 
 	int nFiles = 0;
 	bool swap_Endian = false;
-	char filename[CHARBUFSIZE] = "";
-
-	Profile("Read Snap");
 
 	if (Task.Is_Master) {
 
 		nFiles = find_files(input_name);
 
-		rprintf("\nParallel Reading of %d files on %d tasks\n\n",
-				nFiles, nIOTasks);
+		char filename[CHARBUFSIZE] = "";
 
-		strncpy(filename, input_name, CHARBUFSIZE);
+		get_filename(filename, input_name, 0, nFiles);
 
-		if (nFiles > 1)
-			sprintf(filename, "%s.0", input_name);
+		int fd = open(filename, O_RDONLY);
 
-		FILE *fp = fopen(filename, "r");
+		Assert(fd != -1, "Can't open file %s", filename);
 
-		swap_Endian = find_endianess(fp);
+		swap_Endian = find_endianess(fd);
 
-		read_header_data(fp, swap_Endian, nFiles); // fills Sim
+		struct gadget_header head = { { 0 } };
 
-		fclose(fp);
+		read_header(fd, swap_Endian, &head);
+
+		set_sim_from_header(&head, nFiles); // fills Sim
+
+		close(fd);
 	}
-	
+
 	MPI_Bcast(&nFiles, 1, MPI_INT, MASTER, MPI_COMM_WORLD);
 
-	MPI_Bcast(&swap_Endian, sizeof(swap_Endian), MPI_BYTE, MASTER, 
+	MPI_Bcast(&swap_Endian, sizeof(swap_Endian), MPI_BYTE, MASTER,
 			MPI_COMM_WORLD);
 
 	MPI_Bcast(&Sim, sizeof(Sim), MPI_BYTE, MASTER, MPI_COMM_WORLD);
 
+	const int nIOTasks = Param.Num_IO_Tasks;
+	const int nWaves = ceil((double) NRank / nIOTasks);
+
+	rprintf("\nParallel reading of %d files on %d tasks, %d at a time\n\n",
+			nFiles, NRank, nIOTasks);
+
+	size_t nBytes = nFiles * NPARTYPE * sizeof(uint64_t);
+
+	uint64_t *nPart_File = Malloc(nBytes, "nPart_File");
+
+	find_npart_in_files(input_name, nFiles, swap_Endian, nPart_File);
+
 	Allocate_Particle_Structures();
-	
-	int rest_Files = nFiles;
 
-	while (rest_Files > 0) {
+	uint64_t first[NPARTYPE] = { 0 }, last[NPARTYPE] = { 0 };
+	int nPart_Get[NPARTYPE] = { 0 }, offsets[NPARTYPE] = { 0 };
 
-		nIOTasks = fmin(nIOTasks,rest_Files);
-		
-		int groupSize = ceil( (double)NRank / (double)nIOTasks );
-		int groupMaster = round(Task.Rank / groupSize) * groupSize;
-		int groupRank = Task.Rank - groupMaster;
+	for (int type = 0; type < NPARTYPE; type++) { // our slice of each type
 
-		strncpy(filename, input_name, CHARBUFSIZE);
+		first[type] = Sim.Npart[type] * Task.Rank / NRank;
+		last[type] = Sim.Npart[type] * (Task.Rank + 1) / NRank;
 
-		if (rest_Files >= NRank) { // read in nIO blocks, no communication
-		
-			int fileNum = nFiles - 1 - (Task.Rank + (rest_Files - NRank)); 
-			
-			if (nFiles > 1)
-				sprintf(filename, "%s.%i", filename, fileNum);
+		nPart_Get[type] = last[type] - first[type];
 
-			for (int i = 0; i < groupSize; i++) {
+		if (type > 0)
+			offsets[type] = offsets[type-1] + nPart_Get[type-1];
+	}
 
-				if (Task.Rank == groupMaster + i)
-					read_file(filename, swap_Endian, 0, 1, MPI_COMM_SELF);
+	Reallocate_P(nPart_Get, NULL); // P is empty, types are in order
 
-				MPI_Barrier(MPI_COMM_WORLD);
-			}
+	uint64_t file_first[NPARTYPE] = { 0 }; // first particle in file
+
+	for (int i = 0; i < nFiles; i++) {
+
+		uint32_t nPart[NPARTYPE] = { 0 };
+
+		for (int type = 0; type < NPARTYPE; type++)
+			nPart[type] = nPart_File[i*NPARTYPE + type];
+
+		char filename[CHARBUFSIZE] = "";
+
+		get_filename(filename, input_name, i, nFiles);
+
+		for (int wave = 0; wave < nWaves; wave++) {
+
+			if (Task.Rank % nWaves == wave)
+				read_file_slice(filename, swap_Endian, nPart, file_first,
+						first, last, offsets);
+
+			MPI_Barrier(MPI_COMM_WORLD);
+		}
 
-			rest_Files -= NRank;
-
-		} else { // parallel read on groupMasters and distribute to group
-	
-			MPI_Comm mpi_comm_read;
-		
-			MPI_Comm_split(MPI_COMM_WORLD, groupMaster, groupRank, 
-					&mpi_comm_read);
-		
-			int fileNum = nFiles - 1 - (rest_Files - nIOTasks 
-					+ groupMaster / groupSize);
-
-			if (nFiles > 1)
-				sprintf(filename, "%s.%i", filename, fileNum);
-
-			read_file(filename, swap_Endian, groupRank, groupSize, 
-					mpi_comm_read);
-			
-			rest_Files -= nIOTasks; 
-			
-			MPI_Comm_free(&mpi_comm_read);
-		} 
-		
-		MPI_Barrier(MPI_COMM_WORLD);
+		for (int type = 0; type < NPARTYPE; type++)
+			file_first[type] += nPart[type];
 	}
 
+	Free(nPart_File);
+
 	generate_masses_from_header();
 
  	set_particle_types();
 
 	rprintf("\nReading completed\n\n");
 
-	#pragma omp barrier
-
 	Profile("Read Snap");
 
 	return ;
 }
 
-/* 
- * reads file on master and distributes it to an MPI communicator 
- * spanning groupSize with local rank groupRank 
+/*
+ * Copy the overlap of our slice [first, last) with the particles in this file
+ * into P. Every block is found via its label and mapped only where it
+ * overlaps with the slice.
  */
 
-static void read_file (char *filename, const bool swap_Endian, 
-		const int groupRank, const int groupSize, MPI_Comm mpi_comm_read)
+static void read_file_slice(const char *filename, const bool swap_Endian,
+		const uint32_t nPart[NPARTYPE], const uint64_t file_first[NPARTYPE],
+		const uint64_t first[NPARTYPE], const uint64_t last[NPARTYPE],
+		const int offsets[NPARTYPE])
 {
-	const int groupMaster = 0;  
-	
-	int i = 0, j = 0;
-
-	FILE *fp = NULL;
-
-	int nPartFile[NPARTYPE] = { 0 }, nTotRead = 0;
-
-	if (groupRank == groupMaster) { // get nPart for this file
-
-		fp = fopen(filename, "r");
-	 	
-		Assert(fp != NULL, "File not found %s", filename);
-
-		find_block(fp, "HEAD", swap_Endian);
-
-		SKIP_FORTRAN_RECORD;
-		
-		safe_fread(nPartFile, sizeof(*nPartFile), 6, fp, swap_Endian);
-		
-		SKIP_FORTRAN_RECORD;
-		
-		for (i = 0; i < NPARTYPE; i++)
-			nTotRead += nPartFile[i];
-		
-		printf("\nReading file '%s' on Task %i - %i \n"
-       	   	"   Gas   %9i   DM     %9i    \n"
-       		"   Disk  %9i   Bulge  %9i    \n"
-           	"   Star  %9i   Bndry  %9i    \n"
-           	"   Total in File %9i \n\n",
-			filename, Task.Rank, Task.Rank+groupSize-1,
-			nPartFile[0], nPartFile[1], nPartFile[2],
-			nPartFile[3], nPartFile[4], nPartFile[5], 
-       		nTotRead); 
-		fflush(stdout);
-	}
+	uint64_t beg[NPARTYPE] = { 0 }, end[NPARTYPE] = { 0 };
+
+	size_t nOverlap = 0;
+
+	for (int type = 0; type < NPARTYPE; type++) {
 
-	MPI_Bcast(nPartFile, NPARTYPE, MPI_INT, 0, mpi_comm_read);
-	
-	int nPartGet[NPARTYPE] = { 0 }; // find npart per CPU and type
-		
-	for (i = 0; i < NPARTYPE; i++) 
-		for (j = groupRank; j < nPartFile[i]; j += groupSize) 
-			nPartGet[i]++;
-	
-	size_t offsets[NPARTYPE] = { 0 }; 
-	
-	Reallocate_P(nPartGet, offsets); // return offsets, update Task.Npart
-
-	int nPartGetTotal = 0; 
-	
-	for (j = 0; j < NPARTYPE; j++) 
-		nPartGetTotal += nPartGet[j];
-	
-	size_t nBytes = nPartGetTotal * Largest_Block_Member_Nbytes();
-
-	char *RecvBuf = Malloc(nBytes, "RecvBuf");
-
-	char *ReadBuf = NULL;
-
-	if (groupRank == groupMaster) {
-	
-		nBytes = nTotRead * Largest_Block_Member_Nbytes(); 
-		
-		ReadBuf = Malloc(nBytes, "ReadBuf"); 
+		beg[type] = MAX(first[type], file_first[type]);
+		end[type] = MIN(last[type], file_first[type] + nPart[type]);
+
+		if (end[type] > beg[type])
+			nOverlap += end[type] - beg[type];
+		else
+			end[type] = beg[type];
 	}
 
-	for (i = 0; i < NBlocks; i++) { // read blockwise
+	if (nOverlap == 0)
+		return ; // nothing for us here
 
-		uint32_t blocksize = 0;
+	int fd = open(filename, O_RDONLY);
 
-		if (groupRank == groupMaster) { // find blocksize
+	Assert(fd != -1, "Can't open file %s", filename);
 
-			blocksize = find_block(fp, Block[i].Label, swap_Endian);
-		
-			Assert(blocksize != 0 || (Block[i].IC_Required == false), 
-					"Can't find required block '%s'", Block[i].Label);
-			
-			if (blocksize > 0)
-				printf("%18s %8d MB\n", Block[i].Name, blocksize/1024/1024);
+	const size_t page_size = sysconf(_SC_PAGESIZE);
 
-			fflush(stdout);
-		}
-		
-		MPI_Bcast(&blocksize, 1, MPI_INT, 0, mpi_comm_read);
-
-		if (blocksize == 0) 
-			continue ; // block not found
-		
-		if (groupRank == groupMaster) { // read on master
-			
-			nBytes = Npart_In_Block(i, nPartFile) * Block[i].Ncomp 
-					* Block[i].Nbytes;
-			
-			Assert(nBytes == blocksize, 
-				"File and Code blocksize inconsistent '%s', %zu != %d byte", 
-				Block[i].Label, nBytes, blocksize);
-
-			SKIP_FORTRAN_RECORD
-			
-			safe_fread(ReadBuf, nBytes, 1, fp, swap_Endian);
-
-			SKIP_FORTRAN_RECORD
-		
-		} 
-		
-		int nBytesGetBlock = Npart_In_Block(i, nPartGet) 
-										* Block[i].Ncomp * Block[i].Nbytes;
-		
-		int nBytesSend[groupSize];
-		
-		MPI_Allgather(&nBytesGetBlock, 1 , MPI_INT, nBytesSend, 1, MPI_INT, 
-				mpi_comm_read);
-
-		int displs[groupSize]; // displacements
-
-		memset(displs, 0, groupSize*sizeof(*displs));
-
-		for (j = 1; j < groupSize; j++) 
-			displs[j] += nBytesSend[j-1] + displs[j-1];
-
-		MPI_Scatterv(ReadBuf, nBytesSend, displs, MPI_BYTE, // distribute
-					RecvBuf, nBytesSend[groupRank], MPI_BYTE, 
-					groupMaster, mpi_comm_read); 
-
-		empty_comm_buffer(RecvBuf, i, nPartGetTotal, nPartGet, offsets);  
-	}
+	bool is_first_file = true;
+
+	for (int type = 0; type < NPARTYPE; type++)
+		if (file_first[type] != 0)
+			is_first_file = false;
+
+	printf("Task %d reading %zu particles from '%s' \n",
+			Task.Rank, nOverlap, filename);
+
+	for (int i = 0; i < NBlocks; i++) {
+
+		off_t offset = 0;
+
+		size_t blocksize = find_block(fd, Block[i].Label, swap_Endian,
+				&offset);
+
+		Assert(blocksize != 0 || (Block[i].IC_Required == false),
+				"Can't find required block '%s' in %s", Block[i].Label,
+				filename);
+
+		if (blocksize == 0)
+			continue; // block not found
+
+		Assert(Block[i].Target == VAR_P,
+				"Input block target unknown %d", Block[i].Target);
+
+		const size_t nBytes_Part = Block[i].Ncomp * Block[i].Nbytes;
+
+		size_t nBytes = 0; // all types, as in Npart_In_Block()
+
+		for (int type = 0; type < NPARTYPE; type++)
+			nBytes += nPart[type] * nBytes_Part;
+
+		Assert(nBytes == blocksize,
+			"File and Code blocksize inconsistent '%s', %zu != %zu byte",
+			Block[i].Label, nBytes, blocksize);
+
+		if (Task.Is_Master && is_first_file)
+			printf("%18s %8zu MB\n", Block[i].Name, blocksize/1024/1024);
+
+		off_t type_offset = offset; // start of type in block
+
+		for (int type = 0; type < NPARTYPE; type++) {
+
+			size_t npart = end[type] - beg[type];
+
+			if (npart > 0) {
+
+				off_t data_beg = type_offset
+							   + (beg[type] - file_first[type]) * nBytes_Part;
+				off_t map_beg = data_beg - data_beg % page_size;
+				size_t map_size = npart * nBytes_Part + data_beg - map_beg;
+
+				char *map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE,
+						fd, map_beg);
+
+				Assert(map != MAP_FAILED, "Can't map %zu bytes of '%s' "
+						"in %s", map_size, Block[i].Label, filename);
+
+				madvise(map, map_size, MADV_SEQUENTIAL);
+
+				size_t ipart = offsets[type] + beg[type] - first[type];
+
+				copy_block_to_P(map + (data_beg - map_beg), i, ipart, npart,
+						swap_Endian);
+
+				munmap(map, map_size);
+			}
+
+			type_offset += nPart[type] * nBytes_Part;
+		} // for type
+	} // for i
+
+	close(fd);
 
-	if (fp != NULL)
-		fclose(fp);
-	
-	Free(RecvBuf); Free(ReadBuf);
-	
 	return ;
 }
 
-/* 
- * This moves data from the comm buffer to P. Here we should be limited 
- * by the I/O of the drive. We find the destination of the block by counting
- * the number of pointers (nPtr) starting from &P.Type. nPtr is 
- * just the offset in Bytes over the size of a pointer in bytes on this 
- * system.
+/*
+ * This moves data from the mapped file to P, de-interleaving vector blocks.
+ * We find the destination of the block by counting the number of pointers
+ * (nPtr) starting from &P.Type. nPtr is just the offset in Bytes over the
+ * size of a pointer in bytes on this system. The 4 and 8 byte cases are
+ * written out, so the compiler vectorises the byte swap.
  */
 
-static void empty_comm_buffer(char * restrict DataBuf, const int iB, 
-		const int nPartTotal, const int *nPart, const size_t *offsets)
+static void copy_block_to_P(const char * restrict src, const int iB,
+		const size_t ipart, const size_t npart, const bool swap_Endian)
 {
 	const int nComp = Block[iB].Ncomp;
 	const size_t nBytes = Block[iB].Nbytes;
-	const size_t nPtr = Block[iB].Offset/sizeof(void *); 
-			
-	char * restrict src = DataBuf; 
-	char * restrict dest[nComp];
+	const size_t nPtr = Block[iB].Offset/sizeof(void *);
+	const size_t stride = nComp * nBytes;
 
-	switch (Block[iB].Target) { // find the destination pointers
+	for (int j = 0; j < nComp; j++) {
 
-		case VAR_P:
+		char * restrict dest = (char *) *(&P.Type + nPtr + j)
+							 + ipart * nBytes; // points to P.X[j][ipart]
 
-			for (int j = 0; j < nComp; j++) // ptr fun for the whole family
-				dest[j] = (char *) *(&P.Type + nPtr + j); // points to P.X[i]
+		const char * restrict s = src + j * nBytes;
 
-		break;
+		if (nComp == 1) {
+
+			memcpy(dest, s, npart * nBytes);
+
+			if (swap_Endian)
+				swap_endianess(dest, nBytes, npart);
+
+			continue;
+		}
+
+		switch (nBytes) {
+
+		case 4:
+
+			#pragma omp parallel for
+			for (size_t i = 0; i < npart; i++) {
+
+				uint32_t x = 0;
+
+				memcpy(&x, s + i*stride, 4);
+
+				if (swap_Endian)
+					x = __builtin_bswap32(x);
 
-		default: 
+				((uint32_t *) dest)[i] = x;
+			}
+
+			break;
+
+		case 8:
+
+			#pragma omp parallel for
+			for (size_t i = 0; i < npart; i++) {
+
+				uint64_t x = 0;
+
+				memcpy(&x, s + i*stride, 8);
+
+				if (swap_Endian)
+					x = __builtin_bswap64(x);
+
+				((uint64_t *) dest)[i] = x;
+			}
+
+			break;
+
+		default:
+
+			for (size_t i = 0; i < npart; i++)
+				memcpy(dest + i*nBytes, s + i*stride, nBytes);
+
+			if (swap_Endian)
+				swap_endianess(dest, nBytes, npart);
+
+			break;
+		}
+	} // for j
+
+	return ;
+}
+
+/*
+ * Swap the byte order of n elements of size nBytes in place.
+ */
+
+static void swap_endianess(void * restrict data, const size_t nBytes,
+		const size_t n)
+{
+	switch (nBytes) {
 
-			Assert(false, "Input buffer target unknown %d", Block[iB].Target);
+	case 1:
 
 		break;
-	}	
-	
-	for (int i = 0; i < nPartTotal; i++) {
-			
-		for (int j = 0; j < nComp; j++) {
-				
-			memcpy(dest[j], src, nBytes);
-				
-			src += nBytes;
-			dest[j] += nBytes;
+
+	case 2: {
+
+		uint16_t * restrict d = (uint16_t *) data;
+
+		#pragma omp parallel for
+		for (size_t i = 0; i < n; i++)
+			d[i] = __builtin_bswap16(d[i]);
+
+		} break;
+
+	case 4: {
+
+		uint32_t * restrict d = (uint32_t *) data;
+
+		#pragma omp parallel for
+		for (size_t i = 0; i < n; i++)
+			d[i] = __builtin_bswap32(d[i]);
+
+		} break;
+
+	case 8: {
+
+		uint64_t * restrict d = (uint64_t *) data;
+
+		#pragma omp parallel for
+		for (size_t i = 0; i < n; i++)
+			d[i] = __builtin_bswap64(d[i]);
+
+		} break;
+
+	default: {
+
+		char * restrict d = (char *) data;
+
+		for (size_t i = 0; i < n; i++) {
+
+			for (size_t j = 0; j < nBytes/2; j++) {
+
+				char tmp = d[i*nBytes + j];
+
+				d[i*nBytes + j] = d[i*nBytes + nBytes - j - 1];
+				d[i*nBytes + nBytes - j - 1] = tmp;
+			}
 		}
+
+		} break;
 	}
 
 	return ;
 }
 
-static void read_header_data(FILE *fp, const bool swap_Endian, int nFiles) 
-{ 
-	const bool swap = swap_Endian;
-	
-	struct gadget_header head = { { 0 } };
-
-	int32_t blocksize = find_block(fp, "HEAD", swap_Endian);
-
-	Assert(blocksize == 256, "Format 2 Header corrupted");
-
-	SKIP_FORTRAN_RECORD;
-
-	safe_fread(head.Npart, sizeof(*head.Npart), 6, fp, swap);
-	safe_fread(head.Massarr,sizeof(*head.Massarr), 6, fp, swap);
-	safe_fread(&head.Time, sizeof(head.Time), 1, fp, swap);
-	safe_fread(&head.Redshift, sizeof(head.Redshift), 1, fp, swap);
-	safe_fread(&head.Flag_Sfr, sizeof(head.Flag_Sfr), 1, fp, swap);
-	safe_fread(&head.Flag_Feedback, sizeof(head.Flag_Feedback), 1, fp,swap);
-	safe_fread(head.Nall, sizeof(*head.Nall), 6, fp, swap);
-	safe_fread(&head.Flag_Cooling, sizeof(head.Flag_Cooling), 1, fp,swap);
-	safe_fread(&head.Num_Files, sizeof(head.Num_Files), 1, fp, swap);
-	safe_fread(&head.Boxsize, sizeof(head.Boxsize), 1, fp, swap);
-	safe_fread(&head.Omega0, sizeof(head.Omega0), 1, fp, swap);
-	safe_fread(&head.Omega_Lambda, sizeof(head.Omega_Lambda), 1, fp, swap);
-	safe_fread(&head.Hubble_Param, sizeof(head.Hubble_Param), 1, fp, swap);
-	safe_fread(&head.Flag_Age, sizeof(head.Flag_Age), 1, fp, swap);
-	safe_fread(&head.Flag_Metals, sizeof(head.Flag_Metals), 1, fp,swap);
-	safe_fread(head.Nall_High_Word, sizeof(*head.Nall_High_Word), 6, fp,swap);
+/*
+ * Every rank reads a subset of the headers, the sum gives the particle
+ * numbers in all files everywhere.
+ */
+
+static void find_npart_in_files(const char *input_name, const int nFiles,
+		const bool swap_Endian, uint64_t *nPart_File)
+{
+	memset(nPart_File, 0, nFiles * NPARTYPE * sizeof(*nPart_File));
+
+	for (int i = Task.Rank; i < nFiles; i += NRank) {
+
+		char filename[CHARBUFSIZE] = "";
+
+		get_filename(filename, input_name, i, nFiles);
 
+		int fd = open(filename, O_RDONLY);
+
+		Assert(fd != -1, "Can't open file %s", filename);
+
+		struct gadget_header head = { { 0 } };
+
+		read_header(fd, swap_Endian, &head);
+
+		for (int type = 0; type < NPARTYPE; type++)
+			nPart_File[i*NPARTYPE + type] = head.Npart[type];
+
+		close(fd);
+	}
+
+	MPI_Allreduce(MPI_IN_PLACE, nPart_File, nFiles * NPARTYPE, MPI_UINT64_T,
+			MPI_SUM, MPI_COMM_WORLD);
+
+	return ;
+}
+
+static void read_header(const int fd, const bool swap_Endian,
+		struct gadget_header *head)
+{
+	off_t offset = 0;
+
+	size_t blocksize = find_block(fd, "HEAD", swap_Endian, &offset);
+
+	Assert(blocksize == sizeof(*head), "Format 2 Header corrupted");
+
+	ssize_t nRead = pread(fd, head, sizeof(*head), offset);
+
+	Assert(nRead == sizeof(*head), "Couldn't read header");
+
+	if (! swap_Endian)
+		return ;
+
+	swap_endianess(head->Npart, sizeof(*head->Npart), 6);
+	swap_endianess(head->Massarr, sizeof(*head->Massarr), 6);
+	swap_endianess(&head->Time, sizeof(head->Time), 1);
+	swap_endianess(&head->Redshift, sizeof(head->Redshift), 1);
+	swap_endianess(&head->Flag_Sfr, sizeof(head->Flag_Sfr), 1);
+	swap_endianess(&head->Flag_Feedback, sizeof(head->Flag_Feedback), 1);
+	swap_endianess(head->Nall, sizeof(*head->Nall), 6);
+	swap_endianess(&head->Flag_Cooling, sizeof(head->Flag_Cooling), 1);
+	swap_endianess(&head->Num_Files, sizeof(head->Num_Files), 1);
+	swap_endianess(&head->Boxsize, sizeof(head->Boxsize), 1);
+	swap_endianess(&head->Omega0, sizeof(head->Omega0), 1);
+	swap_endianess(&head->Omega_Lambda, sizeof(head->Omega_Lambda), 1);
+	swap_endianess(&head->Hubble_Param, sizeof(head->Hubble_Param), 1);
+	swap_endianess(&head->Flag_Age, sizeof(head->Flag_Age), 1);
+	swap_endianess(&head->Flag_Metals, sizeof(head->Flag_Metals), 1);
+	swap_endianess(head->Nall_High_Word, sizeof(*head->Nall_High_Word), 6);
+
+	return ;
+}
+
+static void set_sim_from_header(const struct gadget_header *head,
+		const int nFiles)
+{
 	Sim.Npart_Total = 0;
 
 	for (int i = 0; i < NPARTYPE; i++) {
 
-		Sim.Mpart[i] = head.Massarr[i];
+		Sim.Mpart[i] = head->Massarr[i];
+
+		Sim.Npart[i] = (uint64_t)head->Nall[i];
+		Sim.Npart[i] += ((uint64_t)head->Nall_High_Word[i]) << 32;
 
-		Sim.Npart[i] = (uint64_t)head.Nall[i];
-		Sim.Npart[i] += ((uint64_t)head.Nall_High_Word[i]) << 32;
-		
 		Sim.Npart_Total += Sim.Npart[i];
 	}
 
-	Assert(head.Boxsize >= 0, "Boxsize in header not > 0, but %g", Sim.Boxsize);
+	Assert(head->Boxsize >= 0, "Boxsize in header not > 0, but %g",
+			head->Boxsize);
 
 #ifdef PERIODIC
 	if (Sim.Boxsize[0] == -1) {
 
-		Sim.Boxsize[0] = Sim.Boxsize[1] = Sim.Boxsize[2] = head.Boxsize;
+		Sim.Boxsize[0] = Sim.Boxsize[1] = Sim.Boxsize[2] = head->Boxsize;
 
 		printf("Setting boxsize from snapshot header: %g \n\n",Sim.Boxsize[0]);
 	}
 
-#endif	
+#endif
 
 	size_t sum = 0;
 
@@ -378,58 +510,57 @@ static void read_header_data(FILE *fp, const bool swap_Endian, int nFiles)
 		"   Gas   %9llu (%5.2g), DM   %9llu (%5.2g), Disk %9llu (%5.2g)\n"
 		"   Bulge %9llu (%5.2g), Star %9llu (%5.2g), Bndy %9llu (%5.2g)\n"
 		"   Sum %10zu \n",
-		head.Num_Files, head.Boxsize, head.Time,
-		(long long unsigned int) Sim.Npart[0], Sim.Mpart[0], 
-		(long long unsigned int) Sim.Npart[1], Sim.Mpart[1], 
-		(long long unsigned int) Sim.Npart[2], Sim.Mpart[2], 
-		(long long unsigned int) Sim.Npart[3], Sim.Mpart[3], 
-		(long long unsigned int) Sim.Npart[4], Sim.Mpart[4], 
+		head->Num_Files, head->Boxsize, head->Time,
+		(long long unsigned int) Sim.Npart[0], Sim.Mpart[0],
+		(long long unsigned int) Sim.Npart[1], Sim.Mpart[1],
+		(long long unsigned int) Sim.Npart[2], Sim.Mpart[2],
+		(long long unsigned int) Sim.Npart[3], Sim.Mpart[3],
+		(long long unsigned int) Sim.Npart[4], Sim.Mpart[4],
 		(long long unsigned int) Sim.Npart[5], Sim.Mpart[5], sum);
 
-	Assert(head.Num_Files == nFiles, "NumFiles in Header (%d) doesnt match "
-			"number of files found (%d) \n\n", head.Num_Files, nFiles);
+	Assert(head->Num_Files == nFiles, "NumFiles in Header (%d) doesnt match "
+			"number of files found (%d) \n\n", head->Num_Files, nFiles);
 
-	Warn(head.Omega0 != Cosmo.Omega_Matter,
+	Warn(head->Omega0 != Cosmo.Omega_Matter,
 			"Omega_0 in snapshot different from code: file %g, code %g",
-			head.Omega0, Cosmo.Omega_Matter);
+			head->Omega0, Cosmo.Omega_Matter);
 
-	Warn(head.Omega_Lambda != Cosmo.Omega_Lambda,
+	Warn(head->Omega_Lambda != Cosmo.Omega_Lambda,
 			"Omega_Lambda in snapshot different from code: file %g, code %g",
-			head.Omega_Lambda, Cosmo.Omega_Lambda);
+			head->Omega_Lambda, Cosmo.Omega_Lambda);
 
-	Warn(head.Hubble_Param != HUBBLE_CONST/100.0,
+	Warn(head->Hubble_Param != HUBBLE_CONST/100.0,
 			"h_0 in snapshot different from code: file %g, code  %g",
-			head.Hubble_Param, HUBBLE_CONST/100.0);
+			head->Hubble_Param, HUBBLE_CONST/100.0);
 
-	Warn(head.Boxsize != Sim.Boxsize[0], "Boxsize inconsistent %g <-> %g,%g,%g",
-			head.Boxsize, Sim.Boxsize[0], Sim.Boxsize[1], Sim.Boxsize[2]);
+	Warn(head->Boxsize != Sim.Boxsize[0],
+			"Boxsize inconsistent %g <-> %g,%g,%g", head->Boxsize,
+			Sim.Boxsize[0], Sim.Boxsize[1], Sim.Boxsize[2]);
 
-	if (Param.Start_Flag == READ_SNAP) 
-		Restart.Time_Continue = head.Time;
+	if (Param.Start_Flag == READ_SNAP)
+		Restart.Time_Continue = head->Time;
 
 	return ;
 }
 
+/*
+ * Types with a mass in the header are not in the mass block.
+ */
+
 static void generate_masses_from_header()
 {
-	bool mass_in_header = false;
-
-	for (int type = 0; type < NPARTYPE; type++)
-		if (Sim.Mpart[type] != 0)
-			mass_in_header = true;
-
-	if (! mass_in_header)
-		return;
-
 	int iMin = 0;
 
 	for (int type = 0; type < NPARTYPE; type++) {
 
 		int iMax = iMin + Task.Npart[type];
-		
-		#pragma  omp parallel for
-		for (int ipart = iMin; ipart < iMax; ipart++)
-			P.Mass[ipart] = Sim.Mpart[type];
+
+		if (Sim.Mpart[type] != 0) {
+
+			#pragma omp parallel for
+			for (int ipart = iMin; ipart < iMax; ipart++)
+				P.Mass[ipart] = Sim.Mpart[type];
+		}
 
 		iMin += Task.Npart[type];
 	}
@@ -438,7 +569,7 @@ static void generate_masses_from_header()
 }
 
 /*
- * We recover the particle types from the IDs which are assumed strictly 
+ * We recover the particle types from the IDs which are assumed strictly
  * ordered in the range [1, Npart]
  */
 
@@ -448,7 +579,7 @@ static void set_particle_types()
 	uint64_t max_ID[NPARTYPE] = { 0 };
 
 	uint64_t run = 0;
-		
+
 	for (int type = 0; type < NPARTYPE; type++) {
 
 		min_ID[type] = max_ID[type] = -1;
@@ -457,7 +588,7 @@ static void set_particle_types()
 			continue;
 
 		min_ID[type] = run;
-		
+
 		run += Sim.Npart[type];
 
 		max_ID[type] = run - 1;
@@ -465,80 +596,94 @@ static void set_particle_types()
 
 	#pragma omp parallel for
 	for (int ipart = 0; ipart < Task.Npart_Total; ipart++) {
-		
+
 		for (int type = 0; type < NPARTYPE; type++) {
-			
+
 			if (P.ID[ipart] <= max_ID[type])
 				if (P.ID[ipart] >= min_ID[type])
 					P.Type[ipart] = type;
 		}
 	}
-	
+
 	return;
 }
 
-static int find_block(FILE *fp, const char label[4], const bool swap_Endian)
+/*
+ * Find a format 2 block by its label. Returns the size of the block in bytes
+ * and sets offset to the first byte of its data, i.e. behind the leading
+ * Fortran record. Returns 0 if the block isn't in the file.
+ */
+
+static size_t find_block(const int fd, const char label[4],
+		const bool swap_Endian, off_t *offset)
 {
-	int32_t blocksize = 8;
+	struct label_record { // 16 bytes in front of every block
+		int32_t Fortran_Begin;
+		char Label[4];
+		int32_t Blocksize;
+		int32_t Fortran_End;
+	} rec = { 0 };
 
-	rewind(fp);
+	off_t pos = 0;
 
 	for (;;) {
 
-		char blocklabel[4] = {"    "};
-		
-		SKIP_FORTRAN_RECORD;
-		
-		safe_fread(blocklabel, 4 * sizeof(char), 1, fp, swap_Endian);
-		safe_fread(&blocksize, 4 * sizeof(char), 1, fp, swap_Endian);
+		ssize_t nRead = pread(fd, &rec, sizeof(rec), pos);
 
-        SKIP_FORTRAN_RECORD;
+		if (nRead != sizeof(rec))
+			return 0; // eof, not found
 
-        if (strncmp(label, blocklabel, 4) == 0) 
-			break; // found it
-		
-		if (!feof(fp)) {
-		
-			fseek(fp, blocksize, SEEK_CUR); // skip to end of block
-		
-		} else {
+		if (swap_Endian)
+			swap_endianess(&rec.Blocksize, sizeof(rec.Blocksize), 1);
 
-			blocksize = 8;
+		pos += sizeof(rec);
 
-			break;
-		}
+		if (strncmp(label, rec.Label, 4) == 0)
+			break; // found it
+
+		pos += rec.Blocksize; // skip to next label
 	}
 
-	return blocksize - 8; // remove 8 bytes from Fortran header
+	*offset = pos + sizeof(int32_t); // skip Fortran record of data
+
+	return rec.Blocksize - 2 * sizeof(int32_t); // remove Fortran records
 }
 
 
-static bool find_endianess(FILE *fp) 
+static bool find_endianess(const int fd)
 {
-	rewind(fp);
-
 	int32_t testRecord = 0;
-	
-	size_t nRead = fread(&testRecord, 4, 1, fp);
 
-	Assert(nRead == 1, "Couldn't read Fortran test record for Endianess");
+	ssize_t nRead = pread(fd, &testRecord, sizeof(testRecord), 0);
+
+	Assert(nRead == sizeof(testRecord),
+			"Couldn't read Fortran test record for Endianess");
 
 	bool swap_Endian = false;
-	
+
 	if (testRecord == 134217728) { // first block is always 8 bytes
 
 		printf("\nEnabling Endian Swapping\n");
 
 		swap_Endian = true;
+
+		swap_endianess(&testRecord, sizeof(testRecord), 1);
 	}
 
-	rewind(fp);
+	Assert(testRecord == 8, "Binary Fortran File Format Broken");
 
-	SKIP_FORTRAN_RECORD
+	return swap_Endian;
+}
 
-	Assert(Fortran_Record == 8, "Binary Fortran File Format Broken");
+static void get_filename(char *filename, const char *input_name,
+		const int i, const int nFiles)
+{
+	if (nFiles > 1)
+		snprintf(filename, CHARBUFSIZE, "%s.%i", input_name, i);
+	else
+		strncpy(filename, input_name, CHARBUFSIZE);
 
-	return swap_Endian;
+	return ;
 }
 
 static int find_files(char *filename)
@@ -549,9 +694,9 @@ static int find_files(char *filename)
 
 	int nFiles = 0;
 
-	if (fp != NULL) { 
+	if (fp != NULL) {
 
-		nFiles = 1; 
+		nFiles = 1;
 
 		fclose(fp);
 
@@ -560,12 +705,12 @@ static int find_files(char *filename)
 		for (;;) {
 
             sprintf(buf, "%s.%i", filename, nFiles);
-			
-            if (!(fp = fopen(buf, "r"))) 
+
+            if (!(fp = fopen(buf, "r")))
 				break;
-			
+
 			fclose(fp);
-			
+
             nFiles++;
 
             Assert(nFiles < 10000, "Found 10000 files, holy cow !");
@@ -576,43 +721,3 @@ static int find_files(char *filename)
 
 	return nFiles;
 }
-
-/* 
- * this fread wrapper checks for eof, corruption and swaps endianess 
- * if swap_Endian == true 
- */
-
-static int safe_fread(void * restrict data, size_t size, size_t nWanted, 
-		FILE *stream, bool swap_Endian)
-{
-	size_t nRead = fread(data, size, nWanted, stream);
-
-	if (feof(stream)) // we catch EOF further up, because of block finding
-		nRead = nWanted = 0;
-	
-	Assert(nRead == nWanted, "Read %zu blocks with %zu bytes, but %zu wanted",
-			nRead, size, nWanted);
-
-	if (swap_Endian && !feof(stream)) { // swap endianess
-
-		char buf[16] = { " " };
-
-		for (int j = 0; j < nWanted; j++) {
-
-			memcpy(buf, &(( (char *)data )[j * size]), size);
-			
-			for (int i = 0; i < size; i++) {
-
-				size_t dest = j*nWanted + i;
-				
-				size_t src = size - i - 1;
-
-				((char*) data)[dest] = buf[src];
-			}
-		}
-	}
-
-	return nRead;
-}
-
-#undef SKIP_FORTRAN_RECORD
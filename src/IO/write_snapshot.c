@@ -1,11 +1,17 @@
 #include "io.h"
 
 #define WRITE_FORTRAN_RECORD(recSize) Fwrite(&recSize, 4, 1, fp);
+#define TILE_NBYTES (64 * 1024) // stays in L2
 
 void write_file(const char *, const int, const int, const MPI_Comm);
 void write_gadget_header(const int *npart, FILE *fp);
 static void write_block_header(const char *, uint32_t, FILE *);
-static void fill_data_buffer(const int, char *);
+static size_t find_block_source(const int, char **);
+static void write_local_block(const int, char *, FILE *);
+static void send_block(const int, char *, const int, const int, 
+		const MPI_Comm);
+static void recv_and_write_block(const int, const size_t, char *, const int,
+		const MPI_Comm, FILE *);
 static void set_filename(char *filename);
 
 static MPI_Comm mpi_comm_write = MPI_COMM_NULL;
@@ -69,11 +75,6 @@ void write_file(const char *filename, const int groupRank, const int groupSize,
 	MPI_Reduce(Task.Npart, nPartFile, NPARTYPE, MPI_INT, MPI_SUM,
 			groupMaster, mpi_comm_write);
 
-	int nPartLargest = 0; // largest part number to transfer
-
-	MPI_Reduce(&Task.Npart_Total, &nPartLargest, 1, MPI_INT, MPI_MAX,
-			groupMaster, mpi_comm_write);
-
 	int nPartTotalFile = 0; // total number of particles in file
 
 	for (int i = 0; i < NPARTYPE; i++)
@@ -99,18 +100,10 @@ void write_file(const char *filename, const int groupRank, const int groupSize,
 		write_gadget_header(nPartFile, fp);
 	}
 
-	size_t dataBufSize = Largest_Block_Member_Nbytes();
-
-	if (groupRank == groupMaster)
-		dataBufSize *= 2*nPartLargest; // master stores comm&write buf 
-	else
-		dataBufSize *= Task.Npart_Total; // slaves buffer local data
-
-	char *dataBuf = Malloc(dataBufSize, "dataBuf");
-
-	for (int i = 0; i < NBlocks; i++) { // write blocks, hiding latency
+	char *tileBuf = Malloc_Uninit(2 * TILE_NBYTES, // comm & write
+			"tileBuf");
 
-		fill_data_buffer(i, dataBuf);
+	for (int i = 0; i < NBlocks; i++) {
 
 		size_t nBytesSend = Block[i].Ncomp * Block[i].Nbytes * 
 							Npart_In_Block(i, Task.Npart);
@@ -121,10 +114,9 @@ void write_file(const char *filename, const int groupRank, const int groupSize,
 					xferSizes,  sizeof(*xferSizes),
 					MPI_BYTE, groupMaster, mpi_comm_write);
 
-		if (groupRank != groupMaster) { // slaves just post a blocking send
+		if (groupRank != groupMaster) { // slaves just stream their tiles
 
-			MPI_Send(dataBuf, nBytesSend, MPI_BYTE, groupMaster,
-					groupRank, mpi_comm_write);
+			send_block(i, tileBuf, groupMaster, groupRank, mpi_comm_write);
 
 		} else {  // master does all the work
 
@@ -137,33 +129,12 @@ void write_file(const char *filename, const int groupRank, const int groupSize,
 			write_block_header(Block[i].Label, blocksize, fp);
 
 			WRITE_FORTRAN_RECORD(blocksize);
-			
-			MPI_Request request;
-			MPI_Status status;
-
-			int swap = 0; // to alternate between mem areas
-			size_t halfBufSize = 0.5 * dataBufSize;
-
-			for (int task = 0; task < groupSize-1; task++) { // recv & write 
-
-				char * restrict writeBuf = dataBuf + swap * halfBufSize;
-				char * restrict commBuf = dataBuf + (1 - swap) * halfBufSize;
 
-				if (groupSize > 1)
-					MPI_Irecv(commBuf, xferSizes[task+1], MPI_BYTE,	task+1, 
-							task+1,	mpi_comm_write, &request);
-				
-				Fwrite(writeBuf, xferSizes[task], 1, fp);
+			write_local_block(i, tileBuf, fp);
 
-				if (groupSize > 1)
-					MPI_Wait(&request, &status);
-
-				swap = 1 - swap; // swap memory areas 
-			}
-
-			/* last one in group */
-
-			Fwrite(dataBuf+swap*halfBufSize, xferSizes[groupSize-1], 1, fp);
+			for (int task = 1; task < groupSize; task++)
+				recv_and_write_block(i, xferSizes[task], tileBuf, task,
+						mpi_comm_write, fp);
 
 			WRITE_FORTRAN_RECORD(blocksize);
 		}
@@ -174,7 +145,7 @@ void write_file(const char *filename, const int groupRank, const int groupSize,
 	if (groupRank == groupMaster)
 		fclose(fp);
 
-	Free(dataBuf);
+	Free(tileBuf);
 
 	MPI_Barrier(mpi_comm_write);
 
@@ -227,18 +198,21 @@ void write_gadget_header(const int *npart, FILE *fp)
 	return ;
 }
 
-static void fill_data_buffer(const int iB, char *dataBuf)
+/*
+ * Blocks are streamed in tiles of TILE_NBYTES, so output needs no buffer 
+ * scaling with particle number. Scalar fields are contiguous in P and are 
+ * written or sent directly from there, only vector fields are interleaved 
+ * into the tile buffer.
+ */
+
+static size_t find_block_source(const int iB, char *src[])
 {
 	const int nComp = Block[iB].Ncomp;
-	const size_t nBytes = Block[iB].Nbytes;
 	const size_t nPtr = Block[iB].Offset/sizeof(void *); 
 
 	size_t nPart = 0;
-			
-	char * restrict dest = dataBuf; 
-	char * restrict src[nComp];
 
-	switch (Block[iB].Target) { // find the destination pointers
+	switch (Block[iB].Target) { // find the source pointers
 
 		case VAR_P:
 
@@ -251,22 +225,134 @@ static void fill_data_buffer(const int iB, char *dataBuf)
 
 		default: 
 
-			Assert(false, "Input buffer target unknown %d", Block[iB].Target);
+			Assert(false, "Output buffer target unknown %d", Block[iB].Target);
 
 		break;
 	}	
-	
-	for (int i = 0; i < nPart; i++) {
-			
+
+	return nPart;
+}
+
+static size_t tile_npart(const int iB)
+{
+	return TILE_NBYTES / (Block[iB].Ncomp * Block[iB].Nbytes);
+}
+
+/*
+ * Return a pointer to the data of particles [first, first+n) in file layout.
+ */
+
+static char *get_tile(const int iB, char **src, const size_t first, 
+		const size_t n, char * restrict tile)
+{
+	const int nComp = Block[iB].Ncomp;
+	const size_t nBytes = Block[iB].Nbytes;
+
+	if (nComp == 1)
+		return src[0] + first * nBytes; // zero copy
+
+	char * restrict dest = tile;
+
+	for (size_t i = first; i < first + n; i++) {
+
 		for (int j = 0; j < nComp; j++) {
-				
-			memcpy(dest, src[j], nBytes); // slow but generic
-				
+
+			memcpy(dest, src[j] + i * nBytes, nBytes);
+
 			dest += nBytes;
-			src[j] += nBytes;
-		} // j
-	} // i
+		}
+	}
+
+	return tile;
+}
+
+static void write_local_block(const int iB, char *tileBuf, FILE *fp)
+{
+	char *src[Block[iB].Ncomp];
+
+	const size_t nPart = find_block_source(iB, src);
+	const size_t nTile = tile_npart(iB);
+	const size_t nBytes = Block[iB].Ncomp * Block[iB].Nbytes;
+
+	if (Block[iB].Ncomp == 1) { // in one go
+
+		Fwrite(src[0], nBytes, nPart, fp);
+
+		return ;
+	}
+
+	for (size_t i = 0; i < nPart; i += nTile) {
+
+		size_t n = MIN(nTile, nPart - i);
+
+		Fwrite(get_tile(iB, src, i, n, tileBuf), nBytes, n, fp);
+	}
+
+	return ;
+}
+
+static void send_block(const int iB, char *tileBuf, const int groupMaster, 
+		const int groupRank, const MPI_Comm comm)
+{
+	char *src[Block[iB].Ncomp];
+
+	const size_t nPart = find_block_source(iB, src);
+	const size_t nTile = tile_npart(iB);
+	const size_t nBytes = Block[iB].Ncomp * Block[iB].Nbytes;
+
+	for (size_t i = 0; i < nPart; i += nTile) {
+
+		size_t n = MIN(nTile, nPart - i);
+
+		MPI_Send(get_tile(iB, src, i, n, tileBuf), n * nBytes, MPI_BYTE,
+				groupMaster, groupRank, comm);
+	}
 
+	return ;
+}
+
+/*
+ * Receive the tiles of rank "task" into alternating halves of the tile 
+ * buffer, writing one while the next is in flight.
+ */
+
+static void recv_and_write_block(const int iB, const size_t xferSize,
+		char *tileBuf, const int task, const MPI_Comm comm, FILE *fp)
+{
+	const size_t nTileBytes = tile_npart(iB) * Block[iB].Ncomp 
+		* Block[iB].Nbytes;
+
+	if (xferSize == 0)
+		return ;
+
+	MPI_Request request;
+	MPI_Status status;
+
+	int swap = 0; // to alternate between mem areas
+
+	size_t nLeft = xferSize;
+	size_t nRecv = MIN(nTileBytes, nLeft);
+
+	MPI_Irecv(tileBuf, nRecv, MPI_BYTE, task, task, comm, &request);
+
+	while (nLeft > 0) {
+
+		MPI_Wait(&request, &status);
+
+		char *writeBuf = tileBuf + swap * TILE_NBYTES;
+		size_t nWrite = nRecv;
+
+		nLeft -= nWrite;
+		nRecv = MIN(nTileBytes, nLeft);
+
+		swap = 1 - swap; // swap memory areas
+
+		if (nRecv > 0)
+			MPI_Irecv(tileBuf + swap * TILE_NBYTES, nRecv, MPI_BYTE, task, 
+					task, comm, &request);
+
+		Fwrite(writeBuf, nWrite, 1, fp);
+	}
 
 	return ;
 }
@@ -0,0 +1,512 @@
+#include "map.h"
+
+#ifdef MAP
+
+/*
+ * In-situ projected density maps, written as FITS images every
+ * MapEveryNSteps steps. Every thread deposits into its own image, which
+ * are then reduced over threads and MPI ranks. Positions of inactive
+ * particles are predicted to the current time on the fly, P is not touched.
+ * Particles are deposited with CIC, or with a projected cubic spline kernel
+ * of 2.8 times the softening length if MAP_KERNEL is set. MapAxes selects
+ * the projections ("xyz" gives all three). With MAP_LIGHTCONE we also
+ * accumulate a flat sky lightcone: an observer at the box origin looks
+ * along +z through the replicated box, particles are added when they fall
+ * into the comoving distance shell covered since the last map.
+ */
+
+#define NPIX2 (MAP_NPIX * MAP_NPIX)
+
+static void find_map_region(const int, double[2], double[2]);
+static void predict_position(const int, double[3]);
+static void deposit(double *, const double, const double, const double,
+		const double);
+static void deposit_cic(double *, const double, const double, const double,
+		const bool);
+#ifdef MAP_KERNEL
+static void deposit_kernel(double *, const double, const double, const double,
+		const double);
+#endif
+static void reduce_images();
+static void write_fits(const char *, const double *, const char *,
+		const double);
+static void add_card(char *, int *, const char *, const char *);
+
+#ifdef MAP_LIGHTCONE
+static void lightcone();
+#endif
+
+static double * restrict Image = NULL; // NThreads images, 1st one is summed
+#ifdef MAP_LIGHTCONE
+static double * restrict Lightcone = NULL; // accumulated over the run
+#endif
+static bool Wrap = false; // periodic images
+
+static int NAxes = 0, Axes[3] = { 0 };
+static int Map_Counter = 0;
+
+void Setup_Map()
+{
+	for (char *c = Param.Map_Axes; *c != '\0'; c++) {
+
+		Assert(*c >= 'x' && *c <= 'z' && NAxes < 3,
+				"MapAxes has to be a combination of x,y,z, not %s",
+				Param.Map_Axes);
+
+		Axes[NAxes++] = *c - 'x';
+	}
+
+	Assert(Param.Map_Every_N_Steps > 0, "MapEveryNSteps has to be > 0");
+
+	Image = Malloc(NThreads * NPIX2 * sizeof(*Image), "Map Image");
+
+#ifdef PERIODIC
+	Wrap = true;
+#endif
+
+#ifdef MAP_LIGHTCONE
+	Lightcone = Malloc(NPIX2 * sizeof(*Lightcone), "Map Lightcone");
+
+	memset(Lightcone, 0, NPIX2 * sizeof(*Lightcone));
+#endif
+
+	rprintf("Map: %d axes, %d^2 pixel, every %d steps, %g MB \n\n",
+			NAxes, MAP_NPIX, Param.Map_Every_N_Steps,
+			NThreads * NPIX2 * sizeof(*Image) / 1024.0 / 1024.0);
+
+	return ;
+}
+
+void Map()
+{
+	if (Time.Step_Counter % Param.Map_Every_N_Steps != 0)
+		return ;
+
+	Profile("Map");
+
+	for (int k = 0; k < NAxes; k++) {
+
+		const int ax = Axes[k];
+		const int u = (ax + 1) % 3, v = (ax + 2) % 3; // image axes
+
+		double origin[2] = { 0 }, size[2] = { 0 };
+
+		find_map_region(ax, origin, size);
+
+		double * restrict img = Image + Task.Thread_ID * NPIX2;
+
+		memset(img, 0, NPIX2 * sizeof(*img));
+
+		#pragma omp for
+		for (int ipart = 0; ipart < Task.Npart_Total; ipart++) {
+
+			double pos[3] = { 0 };
+
+			predict_position(ipart, pos);
+
+			double x = (pos[u] - origin[0]) / size[0] * MAP_NPIX;
+			double y = (pos[v] - origin[1]) / size[1] * MAP_NPIX;
+			double h = 2.8 * Param.Grav_Softening[P.Type[ipart]]
+						/ size[0] * MAP_NPIX;
+
+			deposit(img, x, y, h, P.Mass[ipart]);
+		}
+
+		reduce_images();
+
+		#pragma omp single
+		{
+
+		double area = size[0] * size[1] / NPIX2; // surface density
+
+		for (int i = 0; i < NPIX2; i++)
+			Image[i] /= area;
+
+		if (Task.Is_MPI_Master) {
+
+			char fname[CHARBUFSIZE] = { "" }, axis[2] = { 'x' + ax, '\0' };
+
+			sprintf(fname, "%s_%c_%04d.fits", Param.Map_File_Base, axis[0],
+					Map_Counter);
+
+			write_fits(fname, Image, axis, size[0] / MAP_NPIX);
+		}
+
+		} // omp single
+	}
+
+#ifdef MAP_LIGHTCONE
+	lightcone();
+#endif
+
+	#pragma omp master
+	{
+
+	rprintf("Map: Wrote maps %d at %g \n", Map_Counter, Time.Current);
+
+	Map_Counter++;
+
+	} // omp master
+
+	#pragma omp barrier
+
+	Profile("Map");
+
+	return ;
+}
+
+/*
+ * Periodic boxes are mapped completely, otherwise we use the domain, which
+ * might be slightly outdated. Particles outside are dropped.
+ */
+
+static void find_map_region(const int ax, double origin[2], double size[2])
+{
+	const int u = (ax + 1) % 3, v = (ax + 2) % 3;
+
+#ifdef PERIODIC
+	origin[0] = origin[1] = 0;
+	size[0] = Sim.Boxsize[u];
+	size[1] = Sim.Boxsize[v];
+#else
+	origin[0] = Domain.Origin[u];
+	origin[1] = Domain.Origin[v];
+	size[0] = size[1] = Domain.Size;
+#endif
+
+	return ;
+}
+
+static void predict_position(const int ipart, double pos[3])
+{
+	double dt = Particle_Drift_Step(P.It_Drift_Pos[ipart], Int_Time.Current);
+
+	for (int i = 0; i < 3; i++)
+		pos[i] = P.Pos[i][ipart] + dt * P.Vel[i][ipart];
+
+	return ;
+}
+
+/*
+ * Deposit mass m at image coordinates x,y in units of pixels. h is the
+ * kernel size in pixels.
+ */
+
+static void deposit(double *img, const double x, const double y,
+		const double h, const double m)
+{
+#ifdef MAP_KERNEL
+	if (h > 1) {
+
+		deposit_kernel(img, x, y, h, m);
+
+		return ;
+	}
+#endif // MAP_KERNEL
+
+	deposit_cic(img, x, y, m, Wrap);
+
+	return ;
+}
+
+static void deposit_cic(double *img, const double x, const double y,
+		const double m, const bool wrap)
+{
+	const int i = floor(x - 0.5);
+	const int j = floor(y - 0.5);
+
+	const double dx = x - 0.5 - i;
+	const double dy = y - 0.5 - j;
+
+	const double w[4] = { (1-dx) * (1-dy), dx * (1-dy), (1-dx) * dy, dx * dy };
+
+	for (int n = 0; n < 4; n++) {
+
+		int ii = i + (n & 1);
+		int jj = j + (n >> 1);
+
+		if (wrap) {
+
+			ii = (ii % MAP_NPIX + MAP_NPIX) % MAP_NPIX;
+			jj = (jj % MAP_NPIX + MAP_NPIX) % MAP_NPIX;
+		}
+
+		if (ii < 0 || ii >= MAP_NPIX || jj < 0 || jj >= MAP_NPIX)
+			continue;
+
+		img[ii + jj * MAP_NPIX] += w[n] * m;
+	}
+
+	return ;
+}
+
+#ifdef MAP_KERNEL
+
+/*
+ * Cubic spline evaluated at the projected distance, normalised
+ * numerically so mass is conserved on the pixel grid.
+ */
+
+static void deposit_kernel(double *img, const double x, const double y,
+		const double h, const double m)
+{
+	const int imin = floor(x - h), imax = floor(x + h);
+	const int jmin = floor(y - h), jmax = floor(y + h);
+
+	double wsum = 0;
+
+	for (int pass = 0; pass < 2; pass++) { // find norm, then deposit
+
+		const double norm = (pass == 0) ? 0 : m / wsum;
+
+		for (int i = imin; i <= imax; i++) {
+
+			for (int j = jmin; j <= jmax; j++) {
+
+				double u = sqrt(p2(i + 0.5 - x) + p2(j + 0.5 - y)) / h;
+
+				if (u >= 1)
+					continue;
+
+				double wk = (u < 0.5) ? 1 - 6*u*u + 6*u*u*u : 2 * p3(1 - u);
+
+				if (pass == 0) {
+
+					wsum += wk;
+
+					continue;
+				}
+
+				int ii = i, jj = j;
+
+				if (Wrap) {
+
+					ii = (ii % MAP_NPIX + MAP_NPIX) % MAP_NPIX;
+					jj = (jj % MAP_NPIX + MAP_NPIX) % MAP_NPIX;
+				}
+
+				if (ii < 0 || ii >= MAP_NPIX || jj < 0 || jj >= MAP_NPIX)
+					continue;
+
+				img[ii + jj * MAP_NPIX] += norm * wk;
+			}
+		}
+
+		if (wsum == 0) { // between pixel centers
+
+			deposit_cic(img, x, y, m, Wrap);
+
+			return ;
+		}
+	}
+
+	return ;
+}
+
+#endif // MAP_KERNEL
+
+/*
+ * Sum the thread images into the first one, then over MPI ranks on the
+ * master.
+ */
+
+static void reduce_images()
+{
+	#pragma omp for
+	for (int i = 0; i < NPIX2; i++)
+		for (int j = 1; j < NThreads; j++)
+			Image[i] += Image[i + j * NPIX2];
+
+	#pragma omp single
+	{
+
+	if (Task.Is_MPI_Master)
+		MPI_Reduce(MPI_IN_PLACE, Image, NPIX2, MPI_DOUBLE, MPI_SUM, MASTER,
+				MPI_COMM_WORLD);
+	else
+		MPI_Reduce(Image, NULL, NPIX2, MPI_DOUBLE, MPI_SUM, MASTER,
+				MPI_COMM_WORLD);
+
+	} // omp single
+
+	return ;
+}
+
+#ifdef MAP_LIGHTCONE
+
+static double Chi_Last = -1; // comoving distance of the last map
+
+/*
+ * Flat sky lightcone with field of view MapLightconeFoV in degrees. The
+ * image is cumulative and rewritten every map step in mass per square
+ * radian.
+ */
+
+static void lightcone()
+{
+	const double fov = Param.Map_Lightcone_FoV * Deg2Rad;
+	const double tan_half = tan(0.5 * fov);
+	const double boxsize = Sim.Boxsize[0];
+
+	const double chi = Comoving_Distance(Time.Current);
+
+	if (Chi_Last < 0) // first call, shell has zero width
+		Chi_Last = chi;
+
+	const double zmin = chi / sqrt(1 + 2 * p2(tan_half));
+	const double zmax = Chi_Last;
+
+	const int kmin = floor(zmin / boxsize), kmax = floor(zmax / boxsize);
+	const int nxy = ceil(zmax * tan_half / boxsize);
+
+	double * restrict img = Image + Task.Thread_ID * NPIX2;
+
+	memset(img, 0, NPIX2 * sizeof(*img));
+
+	#pragma omp for
+	for (int ipart = 0; ipart < Task.Npart_Total; ipart++) {
+
+		double pos[3] = { 0 };
+
+		predict_position(ipart, pos);
+
+		for (int k = kmin; k <= kmax; k++) { // box replications
+		for (int j = -nxy - 1; j <= nxy; j++) {
+		for (int i = -nxy - 1; i <= nxy; i++) {
+
+			double x = pos[0] + i * boxsize;
+			double y = pos[1] + j * boxsize;
+			double z = pos[2] + k * boxsize;
+
+			if (z <= 0)
+				continue;
+
+			double r = sqrt(x*x + y*y + z*z);
+
+			if (r < chi || r >= Chi_Last)
+				continue;
+
+			double tx = (atan(x/z) / fov + 0.5) * MAP_NPIX;
+			double ty = (atan(y/z) / fov + 0.5) * MAP_NPIX;
+
+			deposit_cic(img, tx, ty, P.Mass[ipart], false);
+		}
+		}
+		}
+	}
+
+	reduce_images();
+
+	#pragma omp single
+	{
+
+	const double area = p2(fov / MAP_NPIX);
+
+	for (int i = 0; i < NPIX2; i++)
+		Lightcone[i] += Image[i] / area;
+
+	Chi_Last = chi;
+
+	if (Task.Is_MPI_Master) {
+
+		char fname[CHARBUFSIZE] = { "" };
+
+		sprintf(fname, "%s_lightcone.fits", Param.Map_File_Base);
+
+		write_fits(fname, Lightcone, "lightcone", fov / MAP_NPIX);
+	}
+
+	} // omp single
+
+	return ;
+}
+
+#endif // MAP_LIGHTCONE
+
+/*
+ * A minimal FITS (Pence+ 2010) image writer: 2880 byte blocks of 80
+ * character header cards, followed by big endian doubles.
+ */
+
+static void write_fits(const char *fname, const double *img,
+		const char *name, const double pixsize)
+{
+	const int nBlock = 2880;
+
+	char head[nBlock];
+	char val[CHARBUFSIZE] = { "" };
+	int n = 0;
+
+	memset(head, ' ', nBlock);
+
+	add_card(head, &n, "SIMPLE", "T");
+	add_card(head, &n, "BITPIX", "-64");
+	add_card(head, &n, "NAXIS", "2");
+
+	sprintf(val, "%d", MAP_NPIX);
+
+	add_card(head, &n, "NAXIS1", val);
+	add_card(head, &n, "NAXIS2", val);
+
+	sprintf(val, "'%s'", name);
+	add_card(head, &n, "MAP", val);
+
+	sprintf(val, "%.10E", Time.Current);
+	add_card(head, &n, "TIME", val);
+
+	sprintf(val, "%.10E", pixsize);
+	add_card(head, &n, "PIXSIZE", val);
+
+	add_card(head, &n, "END", NULL);
+
+	FILE *fp = fopen(fname, "wb");
+
+	Assert(fp != NULL, "Can't open file %s", fname);
+
+	Fwrite(head, nBlock, 1, fp);
+
+	uint64_t *buf = Malloc(NPIX2 * sizeof(*buf), "FITS Buffer");
+
+	for (int i = 0; i < NPIX2; i++) {
+
+		memcpy(&buf[i], &img[i], sizeof(*buf));
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		buf[i] = __builtin_bswap64(buf[i]);
+#endif
+	}
+
+	Fwrite(buf, sizeof(*buf), NPIX2, fp);
+
+	size_t nPad = (nBlock - (NPIX2 * sizeof(*buf)) % nBlock) % nBlock;
+
+	memset(head, 0, nBlock);
+
+	Fwrite(head, 1, nPad, fp);
+
+	fclose(fp);
+
+	Free(buf);
+
+	return ;
+}
+
+static void add_card(char *head, int *n, const char *key, const char *val)
+{
+	char card[81] = { "" };
+
+	if (val == NULL)
+		snprintf(card, 81, "%-8s", key);
+	else if (val[0] == '\'') // strings are left aligned
+		snprintf(card, 81, "%-8s= %-20s", key, val);
+	else
+		snprintf(card, 81, "%-8s= %20s", key, val);
+
+	memcpy(head + 80 * (*n), card, strlen(card));
+
+	(*n)++;
+
+	return ;
+}
+
+#endif // MAP
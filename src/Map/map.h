@@ -0,0 +1,34 @@
+#ifndef MAP_H
+#define MAP_H
+
+/*
+ * In-situ projected density maps
+ */
+
+#include "../includes.h"
+#include "../cosmology.h"
+#include "../domain.h"
+#include "../drift.h"
+#include "../timestep.h"
+
+#ifdef MAP
+
+#ifndef MAP_NPIX
+#define MAP_NPIX 512 // pixels per image side
+#endif
+
+#if defined(MAP_LIGHTCONE) && !(defined(COMOVING) && defined(PERIODIC))
+#error MAP_LIGHTCONE requires COMOVING and PERIODIC
+#endif
+
+void Setup_Map();
+void Map();
+
+#else // ! MAP
+
+static inline void Setup_Map() {};
+static inline void Map() {};
+
+#endif // MAP
+
+#endif // MAP_H
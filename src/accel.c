@@ -28,15 +28,19 @@ void Compute_Acceleration()
 static void safe_last_accel()
 {
 	#pragma omp for
-	for (int i = 0; i < NActive_Particles; i++) {
+	for (int v = 0; v < NParticle_Vectors; v++) {
 
-		int ipart = Active_Particle_List[i];
+		for (int ipart = V.First[v]; ipart < V.Last[v]; ipart++) {
 	
-		P.Last_Acc_Mag[ipart] = SQRT( p2(P.Acc[0][ipart]) 
-									+ p2(P.Acc[1][ipart]) 
-									+ p2(P.Acc[2][ipart]));
-
-		P.Acc[0][ipart] = P.Acc[1][ipart] = P.Acc[2][ipart] = 0;
+			P.Last_Acc_Mag[ipart] = SQRT( p2(P.Acc[0][ipart]) 
+										+ p2(P.Acc[1][ipart]) 
+										+ p2(P.Acc[2][ipart]));
+
+			P.Acc[0][ipart] = P.Acc[1][ipart] = P.Acc[2][ipart] = 0;
+#ifdef HERMITE
+			P.Jerk[0][ipart] = P.Jerk[1][ipart] = P.Jerk[2][ipart] = 0;
+#endif
+		}
 	}
 
 	return ;
@@ -50,9 +54,13 @@ static void safe_last_accel()
 #if defined(GRAVITY) && defined(GRAVITY_TREE) // pure tree
 static void accel_gravity() 
 {
-	if (Sig.Tree_Update)
+	if (Sig.Tree_Update) {
+
 		Gravity_Tree_Build();
 
+		Gravity_Tree_Sort_Leaves(); // TREE_SORT_LEAVES
+	}
+
 	if (Sig.Prepare_Step) {
 
 		Sig.Use_BH_Criterion = true;
@@ -2,29 +2,16 @@
 
 #ifdef COMOVING
 
-#define TABLESIZE 512
-
 #ifdef GADGET_COMOVING_VEL_UNIT
 static void convert_velocities_to_comoving();
 #else
 static inline void convert_velocities_to_comoving(){};
 #endif
 
-static void setup_kick_drift_factors();
-
-static double Drift_Table[TABLESIZE] = { 0 }, Kick_Table[TABLESIZE] = { 0 },
-			  Exp_Factor_Table[TABLESIZE] = { 0 };
-
-static gsl_spline *Kick_Spline = NULL, *Drift_Spline = NULL;
-static gsl_interp_accel *Acc[4] = { NULL };
-#pragma omp threadprivate(Kick_Spline,Drift_Spline,Acc)
-
 /*
  * These functions get the kick & drift factors of the symplectic integrator
- * in comoving coordinates from a spline interpolation of the integral in
- * Appendix of Quinn+ 1997. This allows us to use a short table resulting in
- * relative errors < 1e-4, which is the same as what the numerical integrator 
- * gives. These functions are thread safe.
+ * in comoving coordinates from the tabulated integrals in Appendix of 
+ * Quinn+ 1997 (cosmology.c). These functions are thread safe.
  */
 
 double Particle_Kick_Step(const intime_t it_curr, const intime_t it_next)
@@ -32,10 +19,7 @@ double Particle_Kick_Step(const intime_t it_curr, const intime_t it_next)
 	double a_curr = Integer_Time2Integration_Time(it_curr);
 	double a_next = Integer_Time2Integration_Time(it_next);
 
-	double kick_factor_beg = gsl_spline_eval(Kick_Spline, a_curr, Acc[0]);
-	double kick_factor_end = gsl_spline_eval(Kick_Spline, a_next, Acc[1]);
-
-	return kick_factor_end - kick_factor_beg;
+	return Kick_Factor(a_next) - Kick_Factor(a_curr);
 }
 
 double Particle_Drift_Step(const intime_t it_curr, const intime_t it_next)
@@ -43,115 +27,17 @@ double Particle_Drift_Step(const intime_t it_curr, const intime_t it_next)
 	double a_curr = Integer_Time2Integration_Time(it_curr);
 	double a_next = Integer_Time2Integration_Time(it_next);
 
-	double drift_factor_beg = gsl_spline_eval(Drift_Spline, a_curr, Acc[2]);
-	double drift_factor_end = gsl_spline_eval(Drift_Spline, a_next, Acc[3]);
-
-	return drift_factor_end - drift_factor_beg;
-}
-
-/*
- * Integrate in s = \int^{t_i}_{t_0} dt/a^2 so we are conserving 
- * canonical momentum m * a^2 * \dot{x}.
- * See Quinn, Katz, Stadel & Lake 1997, Peebles 1980, Bertschinger 1999. 
- * Note that in code units "dt = da" so the integrals from Quinns paper 
- * have to be transformed from dt -> da, which gives the additional factor of 
- * 1/\dot{a} = 1/H(a)/a. Time stepping is done in dln(a) = 1+z.
- */
-
-static double comoving_symplectic_drift_integrant(double a, void *param)
-{
-	return 1.0 / (Hubble_Parameter(a) * a*a*a);
-}
-
-static double comoving_symplectic_kick_integrant(double a, void *param)
-{
-	return 1.0 / (Hubble_Parameter(a) * a*a);
+	return Drift_Factor(a_next) - Drift_Factor(a_curr);
 }
 
 void Setup_Comoving()
 {
 	#pragma omp parallel
-	{
-
 	convert_velocities_to_comoving(); // GADGET_COMOVING_VEL_UNIT
 
-    setup_kick_drift_factors();
-
-	} // omp parallel
-
-	return ;
-}
-
-void Finish_Comoving()
-{
-	#pragma omp parallel
-	{
-
-	gsl_spline_free(Drift_Spline);
-	gsl_spline_free(Kick_Spline);
-
-	gsl_interp_accel_free(Acc[0]);
-	gsl_interp_accel_free(Acc[1]);
-	gsl_interp_accel_free(Acc[2]);
-	gsl_interp_accel_free(Acc[3]);
-
-	} // omp parallel
-
 	return ;
 }
 
-/*
- * This sets up the comoving kick & drift factors using a table and cspline
- * interpolation. For an EdS universe the solution is:
- * drift(a) = -2/H0/sqrt(a) ; kick(a) = 2/H0 * sqrt(a)
- */
-
-static void setup_kick_drift_factors()
-{
-	gsl_function gsl_F = { 0 };
-	gsl_integration_workspace *gsl_workspace = NULL;
-	gsl_workspace = gsl_integration_workspace_alloc(TABLESIZE);
-
-	const double time_beg = 0.95*Time.Begin;
-	const double time_end = 1.05*Time.End;
-	const double da = (log(time_end/time_beg)) / (TABLESIZE-1);
-
-	#pragma omp for
-	for (int i = 1; i < TABLESIZE; i++) {
-
-		double error = 0;
-
-		double time_max = time_beg * exp(da * i );
-
-		Exp_Factor_Table[i] = time_max;
-
-		gsl_F.function = &comoving_symplectic_drift_integrant;
-
-		gsl_integration_qag(&gsl_F, time_beg, time_max, 0, 1e-8, TABLESIZE,
-				GSL_INTEG_GAUSS41, gsl_workspace, &Drift_Table[i], &error);
-
-		gsl_F.function = &comoving_symplectic_kick_integrant;
-
-		gsl_integration_qag(&gsl_F, time_beg, time_max, 0, 1e-8, TABLESIZE,
-				GSL_INTEG_GAUSS41, gsl_workspace, &Kick_Table[i], &error);
-	} // for i
-
-	gsl_integration_workspace_free(gsl_workspace);
-
-	Acc[0] = gsl_interp_accel_alloc();
-	Acc[1] = gsl_interp_accel_alloc();
-	Acc[2] = gsl_interp_accel_alloc();
-	Acc[3] = gsl_interp_accel_alloc();
-
-	Drift_Spline = gsl_spline_alloc(gsl_interp_cspline, TABLESIZE);
-	Kick_Spline = gsl_spline_alloc(gsl_interp_cspline, TABLESIZE);
-
-	gsl_spline_init(Kick_Spline, Exp_Factor_Table, Kick_Table, TABLESIZE);
-	gsl_spline_init(Drift_Spline, Exp_Factor_Table, Drift_Table, TABLESIZE);
-
-	return;
-}
-
 /*
  * This converts the particle velocities from the initial conditions to the 
  * internal velocity variable u = v*a^1.5. This is legacy Gadget-1. We use a 
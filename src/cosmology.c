@@ -16,6 +16,24 @@ struct Current_Cosmology_In_Code_Units Cosmo = {
 
 #ifdef COMOVING
 
+#define TABLE_SIZE 1024 // equidistant in log(a)
+
+static void setup_table();
+
+/*
+ * The kick and drift integrals of the symplectic integrator (comoving.c) are 
+ * tabulated once in log(a) with their derivatives. A cubic Hermite 
+ * interpolation then needs only one log() per lookup and all threads share
+ * the table read only.
+ */
+
+static struct Cosmology_Table {
+	double Kick[2];			// value & derivative in log(a)
+	double Drift[2];
+} Table[TABLE_SIZE] = { { { 0 } } };
+
+static double Log_A_Beg = 0, D_Log_A = 0;
+
 void Init_Cosmology()
 {
 	const double h0_cgs = HUBBLE_CONST * KM2CGS / MPC2CGS;
@@ -30,6 +48,8 @@ void Init_Cosmology()
 			Cosmo.Omega_Matter, Cosmo.Omega_Baryon, Cosmo.Omega_Rad,
 			3.0/8.0/PI/GRAVITATIONAL_CONST*p2(h0_cgs), Cosmo.Hubble_Constant);
 
+	setup_table();
+
 	#pragma omp parallel 
 	Set_Current_Cosmology(Time.Begin);
 
@@ -78,4 +98,120 @@ double Critical_Density(double a) // Mo+ eq. 3.63
 	return 3.0 * p2(Hubble_Parameter(a))/(8.0*Pi*Const.Gravity);
 }
 
+double Comoving_Distance(const double a) // c * int_a^1 da'/(a'^2 H(a'))
+{
+	const double c = SPEED_OF_LIGHT / Unit.Velocity;
+
+	return c * (Kick_Factor(1) - Kick_Factor(a));
+}
+
+/*
+ * Integrate in s = \int^{t_i}_{t_0} dt/a^2 so we are conserving 
+ * canonical momentum m * a^2 * \dot{x}.
+ * See Quinn, Katz, Stadel & Lake 1997, Peebles 1980, Bertschinger 1999. 
+ * Note that in code units "dt = da" so the integrals from Quinns paper 
+ * have to be transformed from dt -> da, which gives the additional factor of 
+ * 1/\dot{a} = 1/H(a)/a. For an EdS universe the solution is:
+ * drift(a) = -2/H0/sqrt(a) ; kick(a) = 2/H0 * sqrt(a)
+ */
+
+static double comoving_symplectic_drift_integrant(double a, void *param)
+{
+	return 1.0 / (Hubble_Parameter(a) * a*a*a);
+}
+
+static double comoving_symplectic_kick_integrant(double a, void *param)
+{
+	return 1.0 / (Hubble_Parameter(a) * a*a);
+}
+
+/*
+ * Integrate from table entry to table entry and sum up. The table covers 
+ * a = 1 for the comoving distance and the highest redshift of the lightcone.
+ */
+
+static void setup_table()
+{
+	double a_min = Time.Begin;
+
+#ifdef LIGHTCONE
+	a_min = fmin(a_min, 1.0 / (1.0 + Param.Lightcone_Max_Redshift));
+#endif
+
+	const double a_beg = 0.95 * a_min;
+	const double a_end = 1.05 * fmax(1, Time.End);
+
+	Log_A_Beg = log(a_beg);
+	D_Log_A = log(a_end/a_beg) / (TABLE_SIZE - 1);
+
+	gsl_function gsl_F = { 0 };
+	gsl_integration_workspace *gsl_workspace = NULL;
+	gsl_workspace = gsl_integration_workspace_alloc(TABLE_SIZE);
+
+	for (int i = 0; i < TABLE_SIZE; i++) {
+
+		double a = exp(Log_A_Beg + i * D_Log_A);
+
+		Table[i].Kick[1] = a * comoving_symplectic_kick_integrant(a, NULL);
+		Table[i].Drift[1] = a * comoving_symplectic_drift_integrant(a, NULL);
+
+		if (i == 0)
+			continue;
+
+		double a_last = exp(Log_A_Beg + (i-1) * D_Log_A);
+		double kick = 0, drift = 0, error = 0;
+
+		gsl_F.function = &comoving_symplectic_kick_integrant;
+
+		gsl_integration_qag(&gsl_F, a_last, a, 0, 1e-10, TABLE_SIZE,
+				GSL_INTEG_GAUSS41, gsl_workspace, &kick, &error);
+
+		gsl_F.function = &comoving_symplectic_drift_integrant;
+
+		gsl_integration_qag(&gsl_F, a_last, a, 0, 1e-10, TABLE_SIZE,
+				GSL_INTEG_GAUSS41, gsl_workspace, &drift, &error);
+
+		Table[i].Kick[0] = Table[i-1].Kick[0] + kick;
+		Table[i].Drift[0] = Table[i-1].Drift[0] + drift;
+	}
+
+	gsl_integration_workspace_free(gsl_workspace);
+
+	return ;
+}
+
+static double interpolate(const double y0[2], const double y1[2], 
+		const double t)
+{
+	const double t2 = t * t;
+	const double t3 = t2 * t;
+
+	return (2*t3 - 3*t2 + 1) * y0[0] + (t3 - 2*t2 + t) * D_Log_A * y0[1]
+		+ (3*t2 - 2*t3) * y1[0] + (t3 - t2) * D_Log_A * y1[1];
+}
+
+double Kick_Factor(const double a) // int_a_beg^a da'/(a'^2 H(a'))
+{
+	const double x = (log(a) - Log_A_Beg) / D_Log_A;
+
+	Assert(x >= 0, "a = %g below cosmology table start %g", a, 
+			exp(Log_A_Beg));
+
+	const int i = imin(floor(x), TABLE_SIZE - 2);
+
+	return interpolate(Table[i].Kick, Table[i+1].Kick, x - i);
+}
+
+double Drift_Factor(const double a) // int_a_beg^a da'/(a'^3 H(a'))
+{
+	const double x = (log(a) - Log_A_Beg) / D_Log_A;
+
+	Assert(x >= 0, "a = %g below cosmology table start %g", a, 
+			exp(Log_A_Beg));
+
+	const int i = imin(floor(x), TABLE_SIZE - 2);
+
+	return interpolate(Table[i].Drift, Table[i+1].Drift, x - i);
+}
+
 #endif // COMOVING
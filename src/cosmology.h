@@ -26,6 +26,9 @@ extern struct Current_Cosmology_In_Code_Units {
 double Hubble_Parameter(const double a); // H(a) = H0 * E_Hubble(a)
 double E_Hubble(const double a);
 double Critical_Density(double);
+double Comoving_Distance(const double a);
+double Kick_Factor(const double a);
+double Drift_Factor(const double a);
 
 #ifdef COMOVING
 void Set_Current_Cosmology(const double a);
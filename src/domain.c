@@ -465,7 +465,7 @@ static int remove_empty_bunches()
 
 /*
  * Update particle distribution over NBunches, starting from first_bunch. 
- * This is performance critical. Every thread works inside its omp buffer, 
+ * This is performance critical. Every thread works inside its scratch arena,
  * which are later reduced. The reduction is overlapped with the filling.
  */
 
@@ -475,12 +475,15 @@ static void fill_new_bunches(const int first_bunch, const int nBunches,
 	const int last_part = first_part + nPart;
 	const int last_bunch = first_bunch + nBunches;
 	
-	struct Bunch_Node *buf = Get_Thread_Safe_Buffer(nBunches * sizeof(*buf));
+	const size_t mark = Scratch_Push();
+
+	struct Bunch_Node *buf = Scratch_Alloc(nBunches * sizeof(*buf));
 
 	int run = first_bunch;
 	
 	for (int i = 0; i < nBunches; i++) { // init omp buffer
 
+		buf[i].Npart = buf[i].Cost = 0;
 		buf[i].First_Part = INT_MAX;
 		buf[i].Key = D[run].Bunch.Key;
 
@@ -499,7 +502,7 @@ static void fill_new_bunches(const int first_bunch, const int nBunches,
 	#pragma omp for nowait 
 	for (int ipart = first_part; ipart < last_part; ipart++) { // sort in
 
-		shortKey pkey = (P.Key[ipart] >> DELTA_PEANO_BITS);
+		shortKey pkey = (P.Key[ipart] >> DELTA_PART_KEY_BITS);
 
 		while (buf[run].Key < pkey) // particles are ordered by key
 			run++;
@@ -527,6 +530,8 @@ static void fill_new_bunches(const int first_bunch, const int nBunches,
 
 	#pragma omp barrier
 
+	Scratch_Pop(mark);
+
 	return ;
 }
 
@@ -774,7 +779,7 @@ static void find_domain_center(double Center_Out[3])
 	Float center[3] = { 0 };
 
 	#pragma omp single
-	buffer = Malloc(Task.Npart_Total * sizeof(*buffer), "buffer");
+	buffer = Malloc_Uninit(Task.Npart_Total * sizeof(*buffer), "buffer");
 	
 	for (int i = 0; i < 3; i++) {
 		
@@ -48,6 +48,17 @@ union Domain_Node_List {
 #ifdef GRAVITY_TREE
 		float CoM[3];		// Center of Mass
 		float Dp[3];		// Velocity of Center of Mass, add above ! 
+#ifdef HERMITE
+		float Vel[3];		// Mass weighted velocity
+#endif
+#ifdef HOLD
+		float Bin_Mass[N_TIME_BINS]; // Mass per timebin
+		uint8_t Bin_Min;	// smallest and largest timebin, conservative
+		uint8_t Bin_Max;
+#endif
+#ifdef ADAPTIVE_SOFTENING
+		float Softening;	// largest softening of its particles
+#endif
 #endif //GRAVITY_TREE
 	} TNode;
 
@@ -1,5 +1,7 @@
 #include "drift.h"
 
+static void advance_time();
+
 /* 
  * This is the drift part of the KDK scheme (Dehnen & Read 2012, Springel 05). 
  * As a snapshot time may not fall onto an sync time, we have to 
@@ -13,36 +15,139 @@ void Drift_To_Sync_Point()
 {
 	Profile("Drift");
 
+	Lightcone_Prepare_Drift(Active_Particle_List, NActive_Particles,
+			Int_Time.Next); // LIGHTCONE
+
 	#pragma omp for
-	for (int i = 0; i < NActive_Particles; i++) {
+	for (int v = 0; v < NParticle_Vectors; v++) { // see timestep.c
 
-		int ipart = Active_Particle_List[i];
+		const int first = V.First[v];
+		const int last = V.Last[v];
 
-		intime_t it_curr = P.It_Drift_Pos[ipart];
-		intime_t it_next = Int_Time.Next; // != it_curr + Tbin2Tstep(Tbin[i])
+		const intime_t it_curr = P.It_Drift_Pos[first];
+		const intime_t it_next = Int_Time.Next; // != it_curr + Tbin2Tstep()
+
+		Assert(it_next <= Int_Time.End, 
+				"overstepped ipart=%d, curr=%u next=%u max=%u"
+				"IT.curr=%u IT.next=%u ", 
+				first, it_curr, it_next, Int_Time.End, Int_Time.Current, 
+				Int_Time.Next);
+
+		const double dt = Cached_Drift_Step(P.Time_Bin[first], it_curr, 
+				it_next);
+
+		for (int ipart = first; ipart < last; ipart++) {
+
+			Lightcone_Check_Crossing(ipart, it_curr, it_next, dt);//LIGHTCONE
+
+			P.Pos[0][ipart] += dt * P.Vel[0][ipart];
+			P.Pos[1][ipart] += dt * P.Vel[1][ipart];
+			P.Pos[2][ipart] += dt * P.Vel[2][ipart];
+
+			Hermite_Predict(ipart, dt); // HERMITE
+
+			Periodic_Constrain_Particle_To_Box(ipart); // PERIODIC
+
+			P.It_Drift_Pos[ipart] = it_next;
+		}
+	}
+
+	advance_time();
+
+	Profile("Drift");
+
+	return;
+}
+
+/*
+ * Kick and drift the active particles in one pass: the deferred second 
+ * halfkick of the last step, the first halfkick and the drift to the sync 
+ * point (kick.c). Every particle is read and written once.
+ */
+
+#ifndef HERMITE
+
+void Kick_Drift_To_Sync_Point()
+{
+	Profile("Kick & Drift");
+
+	Lightcone_Prepare_Drift(Active_Particle_List, NActive_Particles,
+			Int_Time.Next); // LIGHTCONE
+
+	#pragma omp for
+	for (int v = 0; v < NParticle_Vectors; v++) {
+
+		const int first = V.First[v];
+		const int last = V.Last[v];
+
+		intime_t it_kick = 0;
 
-		intime_t it_step = it_next - it_curr;
+		const Float dt_kick = Kick_Halfstep_Factor(first, &it_kick);
+
+		const intime_t it_curr = P.It_Drift_Pos[first];
+		const intime_t it_next = Int_Time.Next;
 
 		Assert(it_next <= Int_Time.End, 
 				"overstepped ipart=%d, curr=%u next=%u max=%u"
 				"IT.curr=%u IT.next=%u ", 
-				ipart, it_curr, it_next, Int_Time.End, Int_Time.Current, 
+				first, it_curr, it_next, Int_Time.End, Int_Time.Current, 
 				Int_Time.Next);
 
-		double dt = Particle_Drift_Step(it_curr, it_next);
+		const double dt = Cached_Drift_Step(P.Time_Bin[first], it_curr, 
+				it_next);
+
+		for (int ipart = first; ipart < last; ipart++) {
+
+			P.Vel[0][ipart] += dt_kick * P.Acc[0][ipart];
+			P.Vel[1][ipart] += dt_kick * P.Acc[1][ipart];
+			P.Vel[2][ipart] += dt_kick * P.Acc[2][ipart];
+
+			Lightcone_Check_Crossing(ipart, it_curr, it_next, dt);//LIGHTCONE
+
+			P.Pos[0][ipart] += dt * P.Vel[0][ipart];
+			P.Pos[1][ipart] += dt * P.Vel[1][ipart];
+			P.Pos[2][ipart] += dt * P.Vel[2][ipart];
 
-		P.Pos[0][ipart] += dt * P.Vel[0][ipart];
-		P.Pos[1][ipart] += dt * P.Vel[1][ipart];
-		P.Pos[2][ipart] += dt * P.Vel[2][ipart];
+			Periodic_Constrain_Particle_To_Box(ipart); // PERIODIC
 
-		P.It_Drift_Pos[ipart] += it_step;
+			P.It_Kick_Pos[ipart] = it_kick;
+			P.It_Drift_Pos[ipart] = it_next;
+		}
+
+		if (!Sig.Domain_Update)
+			for (int ipart = first; ipart < last; ipart++)
+				Gravity_Tree_Update_Kicks(ipart, dt_kick); // GRAVITY_TREE
 	}
 
+	advance_time();
+
+	Profile("Kick & Drift");
+
+	return ;
+}
+
+#else // HERMITE
+
+void Kick_Drift_To_Sync_Point()
+{
+	Kick_First_Halfstep();
+
+	Drift_To_Sync_Point();
+
+	return ;
+}
+
+#endif // HERMITE
+
+/*
+ * Drift the tree and move the system to the next sync point.
+ */
+
+static void advance_time()
+{
 	if (!Sig.Domain_Update)
 		Gravity_Tree_Update_Drift(Time.Step);
 
-	Periodic_Constrain_Particles_To_Box(); // PERIODIC
-
 	#pragma omp single
 	{
 
@@ -58,9 +163,7 @@ void Drift_To_Sync_Point()
 
 	Set_Current_Cosmology(Time.Current); // update immediately
 
-	Profile("Drift");
-
-	return;
+	return ;
 }
 
 /* 
@@ -74,6 +177,8 @@ void Drift_To_Snaptime()
 			Time.Next_Snap);
 
 	const intime_t it_snap = Integration_Time2Integer_Time(Time.Next_Snap);
+
+	Lightcone_Prepare_Drift(NULL, Task.Npart_Total, it_snap); // LIGHTCONE
 	
 	#pragma omp for
 	for (int ipart = 0; ipart < Task.Npart_Total; ipart++) {
@@ -82,15 +187,19 @@ void Drift_To_Snaptime()
 
 		double dt = Particle_Drift_Step(it_curr, it_snap);
 
+		Lightcone_Check_Crossing(ipart, it_curr, it_snap, dt); // LIGHTCONE
+
 		P.Pos[0][ipart] +=	dt * P.Vel[0][ipart];
 		P.Pos[1][ipart] +=	dt * P.Vel[1][ipart];
 		P.Pos[2][ipart] +=	dt * P.Vel[2][ipart];
 
+		Hermite_Predict(ipart, dt); // HERMITE
+
+		Periodic_Constrain_Particle_To_Box(ipart); // PERIODIC
+
 		P.It_Drift_Pos[ipart] = it_snap; // now correct time_bin
 	}
 
-	Periodic_Constrain_Particles_To_Box();
-
 	#pragma omp single
 	{
 	
@@ -8,11 +8,14 @@
 #include "cosmology.h"
 #include "domain.h"
 #include "log.h"
+#include "lightcone.h"
+#include "hermite.h"
+#include "kick.h"
 #include "Gravity/tree.h"
 #include "Gravity/fmm.h"
 
 void Drift_To_Sync_Point();
 void Drift_To_Snaptime();
-extern double Particle_Drift_Step(const intime_t, const intime_t);
+void Kick_Drift_To_Sync_Point();
 
 #endif // DRIFT_H
@@ -2,7 +2,7 @@
 
 void Finish()
 {
-    Finish_Comoving(); // COMOVING
+	Finish_Lightcone(); // LIGHTCONE
 
 	Finish_Domain_Decomposition();
 
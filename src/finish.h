@@ -6,5 +6,6 @@
 #include "cosmology.h"
 #include "log.h"
 #include "domain.h"
+#include "lightcone.h"
 
 #endif // FINISH_H
@@ -32,9 +32,17 @@ typedef uint32_t ID_t;
 
 typedef uint32_t intime_t;		// type of integer time 
 
+#define N_TIME_BINS (sizeof(intime_t) * CHAR_BIT) // one per bit
+
 typedef uint64_t shortKey;		// short peanokey, 64 bit = 21 triplets/levels
 typedef __uint128_t peanoKey; 	// long peanokey, 128 bit = 42 triplets/levels
 
+#ifdef SHORT_PEANO_KEYS
+typedef shortKey particleKey;	// key stored in P
+#else
+typedef peanoKey particleKey;
+#endif // SHORT_PEANO_KEYS
+
 enum Start_Parameters {
 	READ_IC = 0,
 	READ_RESTART = 1,
@@ -99,6 +107,21 @@ extern struct Parameters_From_File {
 	double Part_Alloc_Factor;	// Allowed mem imbalance in Particles
 	double Time_Int_Accuracy;	// 
 	double Grav_Softening[NPARTYPE]; // gravitiational softening
+	int Huge_Page_Size;			// in MB, 0 for normal pages
+#ifdef FOF
+	char FoF_File_Base[CHARBUFSIZE]; // group catalogues
+#endif
+#ifdef MAP
+	char Map_File_Base[CHARBUFSIZE]; // FITS images
+	char Map_Axes[CHARBUFSIZE];	// projection axes, e.g. "xz"
+	int Map_Every_N_Steps;
+	double Map_Lightcone_FoV;	// in degrees
+#endif
+#ifdef LIGHTCONE
+	char Lightcone_File_Base[CHARBUFSIZE];
+	double Lightcone_Observer[3];
+	double Lightcone_Max_Redshift;
+#endif
 } Param;
 
 extern int * restrict Active_Particle_List;
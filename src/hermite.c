@@ -0,0 +1,148 @@
+#include "hermite.h"
+#include "kick.h"
+
+#ifdef HERMITE
+
+/*
+ * The Hermite scheme replaces the kicks of the KDK scheme. The first "kick"
+ * stores acceleration and jerk at the beginning of the step, the drift
+ * predicts position, velocity and acceleration from them (hermite.h). After
+ * the force computation at the predicted positions, the second "kick"
+ * corrects position and velocity using old and new acceleration and jerk
+ * over the full step of the particle (Makino & Aarseth 1992, eq. 6-8).
+ * The kick positions on the integer timeline are advanced as in the KDK
+ * scheme and the tree nodes are kicked with the accelerations at the
+ * beginning and the end of the step.
+ * Inactive particles act on active ones from their last drift position, as
+ * in the KDK scheme, hence the scheme is 4th order only for particles in a
+ * common timebin.
+ */
+
+void Kick_First_Halfstep()
+{
+	Profile("First Kick");
+
+	#pragma omp for
+	for (int v = 0; v < NParticle_Vectors; v++) {
+
+		const int first = V.First[v];
+		const int last = V.Last[v];
+
+		const int bin = P.Time_Bin[first];
+		const intime_t it_half = Timebin2It_Timestep(bin) >> 1;
+
+		const intime_t it_curr = P.It_Kick_Pos[first];
+		const intime_t it_next = it_curr + it_half;
+
+		for (int ipart = first; ipart < last; ipart++) {
+
+			for (int i = 0; i < 3; i++) {
+
+				P.Acc_Old[i][ipart] = P.Acc[i][ipart];
+				P.Jerk_Old[i][ipart] = P.Jerk[i][ipart];
+			}
+
+			P.It_Kick_Pos[ipart] = it_next;
+		}
+
+		const Float dt = Cached_Kick_Step(&First_Kick_Cache, bin, it_curr,
+				it_next);
+
+		if (!Sig.Domain_Update)
+			for (int ipart = first; ipart < last; ipart++)
+				Gravity_Tree_Update_Kicks(ipart, dt); // GRAVITY_TREE
+	}
+
+	Profile("First Kick");
+
+	return ;
+}
+
+void Kick_Second_Halfstep()
+{
+	Profile("Second Kick");
+
+	#pragma omp for
+	for (int v = 0; v < NParticle_Vectors; v++) {
+
+		const int first = V.First[v];
+		const int last = V.Last[v];
+
+		const int bin = P.Time_Bin[first];
+		const intime_t it_step = Timebin2It_Timestep(bin);
+
+		const intime_t it_curr = P.It_Kick_Pos[first];
+		const intime_t it_next = it_curr + (it_step >> 1);
+
+		const double dt = Particle_Kick_Step(it_next - it_step, it_next);
+		const double dt2 = dt * dt;
+
+		for (int ipart = first; ipart < last; ipart++) {
+
+			for (int i = 0; i < 3; i++) {
+
+				const double da = P.Acc[i][ipart] - P.Acc_Old[i][ipart];
+				const double j0 = P.Jerk_Old[i][ipart];
+				const double j1 = P.Jerk[i][ipart];
+
+				P.Pos[i][ipart] += dt2 * (da / 6 - dt * (3*j0 + j1) / 24);
+				P.Vel[i][ipart] += dt * (da / 2 - dt * (5*j0 + j1) / 12);
+			}
+
+			P.It_Kick_Pos[ipart] = it_next;
+		}
+
+		const Float dt_half = Cached_Kick_Step(&Second_Kick_Cache, bin,
+				it_curr, it_next);
+
+		if (!Sig.Domain_Update)
+			for (int ipart = first; ipart < last; ipart++)
+				Gravity_Tree_Update_Kicks(ipart, dt_half); // GRAVITY_TREE
+	}
+
+	Profile("Second Kick");
+
+	return ;
+}
+
+/*
+ * Third order Taylor prediction of position, velocity and acceleration by
+ * dt. Called after the first order drift of the position, so the predicted
+ * state is continued correctly over drifts split at a snapshot time.
+ */
+
+void Hermite_Predict(const int ipart, const double dt)
+{
+	const double dt2 = dt * dt;
+
+	for (int i = 0; i < 3; i++) {
+
+		P.Pos[i][ipart] += dt2 * (P.Acc[i][ipart] * 0.5
+				+ dt * P.Jerk[i][ipart] / 6.0);
+		P.Vel[i][ipart] += dt * (P.Acc[i][ipart]
+				+ dt * P.Jerk[i][ipart] * 0.5);
+		P.Acc[i][ipart] += dt * P.Jerk[i][ipart];
+	}
+
+	return ;
+}
+
+/*
+ * Aarseth's simple criterion, dt = eta * |a| / |da/dt|
+ */
+
+float Hermite_Timestep(const int ipart)
+{
+	const double jerk = sqrt(p2(P.Jerk[0][ipart]) + p2(P.Jerk[1][ipart])
+			+ p2(P.Jerk[2][ipart]));
+
+	if (jerk == 0)
+		return FLT_MAX;
+
+	const double acc = sqrt(p2(P.Acc[0][ipart]) + p2(P.Acc[1][ipart])
+			+ p2(P.Acc[2][ipart]));
+
+	return Param.Time_Int_Accuracy * acc / jerk;
+}
+
+#endif // HERMITE
@@ -0,0 +1,30 @@
+#ifndef HERMITE_H
+#define HERMITE_H
+
+/*
+ * Fourth order Hermite predictor-corrector integrator (Makino & Aarseth 1992)
+ */
+
+#include "includes.h"
+
+#ifdef HERMITE
+
+#if defined(COMOVING) || defined(PERIODIC)
+#error HERMITE is implemented for isolated, non-comoving systems only
+#endif
+
+#ifndef GRAVITY_TREE
+#error HERMITE requires the jerk from GRAVITY_TREE
+#endif
+
+float Hermite_Timestep(const int ipart);
+void Hermite_Predict(const int ipart, const double dt);
+
+#else // ! HERMITE
+
+static inline float Hermite_Timestep(const int ipart) { return FLT_MAX; };
+static inline void Hermite_Predict(const int ipart, const double dt) {};
+
+#endif // HERMITE
+
+#endif // HERMITE_H
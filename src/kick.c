@@ -1,9 +1,18 @@
 #include "kick.h"
 
+#ifndef HERMITE // see hermite.c
+
+static struct Step_Factor_Cache Deferred_Kick_Cache = { { 0 } };
+
 /* 
  * This is the Kick part of the KDK scheme. We update velocities from 
  * accelerations, but kick only for half a timebin. If we use the tree, the
  * nodes are kicked as well.
+ * The second halfkick of a particle is deferred and applied together with 
+ * its next first halfkick, in the fused kick & drift pass in drift.c. Then
+ * velocities, accelerations and positions are streamed only once per step.
+ * Until then the kick position stays in the middle of the last step and
+ * Deferred_Kick_Cache keeps the kick factor of the bin.
  */
 
 void Kick_First_Halfstep()
@@ -11,26 +20,27 @@ void Kick_First_Halfstep()
 	Profile("First Kick");
 
 	#pragma omp for
-	for (int i = 0; i < NActive_Particles; i++) {
+	for (int v = 0; v < NParticle_Vectors; v++) {
 
-		int ipart = Active_Particle_List[i];
+		const int first = V.First[v];
+		const int last = V.Last[v];
 
-		intime_t it_step = Timebin2It_Timestep(P.Time_Bin[ipart]);
+		intime_t it_next = 0;
 
-		intime_t it_curr = P.It_Kick_Pos[ipart];
-		intime_t it_next = it_curr + (it_step >> 1);
+		const Float dt = Kick_Halfstep_Factor(first, &it_next);
 
-		Float dt = Particle_Kick_Step(it_curr, it_next);
+		for (int ipart = first; ipart < last; ipart++) {
 
-		P.Vel[0][ipart] += dt * P.Acc[0][ipart];
-		P.Vel[1][ipart] += dt * P.Acc[1][ipart];
-		P.Vel[2][ipart] += dt * P.Acc[2][ipart];
+			P.Vel[0][ipart] += dt * P.Acc[0][ipart];
+			P.Vel[1][ipart] += dt * P.Acc[1][ipart];
+			P.Vel[2][ipart] += dt * P.Acc[2][ipart];
 
-		P.It_Kick_Pos[ipart] += (it_step >> 1);
+			P.It_Kick_Pos[ipart] = it_next;
+		}
 
 		if (!Sig.Domain_Update)
-			Gravity_Tree_Update_Kicks(ipart, dt); // GRAVITY_TREE
-
+			for (int ipart = first; ipart < last; ipart++)
+				Gravity_Tree_Update_Kicks(ipart, dt); // GRAVITY_TREE
 	}
 
 	Profile("First Kick");
@@ -38,37 +48,105 @@ void Kick_First_Halfstep()
 	return ;
 }
 
+/*
+ * Keep the factors of the bins active in this step, the kick itself is 
+ * deferred.
+ */
+
 void Kick_Second_Halfstep()
 {
-	Profile("Second Kick");
+	const intime_t no_key = ~((intime_t) 0);
+
+	#pragma omp single
+	for (int bin = 0; bin < N_TIME_BINS; bin++) {
+
+		if (Second_Kick_Cache.It_Curr[bin] == no_key) // inactive
+			continue;
+
+		Deferred_Kick_Cache.It_Curr[bin] = Second_Kick_Cache.It_Curr[bin];
+		Deferred_Kick_Cache.Dt[bin] = Second_Kick_Cache.Dt[bin];
+	}
+
+	return ;
+}
+
+/*
+ * Return the kick factor of the active vector starting with particle "first"
+ * to the middle of its step in "it_next". This includes the deferred second
+ * halfkick of its last step, that started its kick position at the middle of 
+ * that step.
+ */
+
+Float Kick_Halfstep_Factor(const int first, intime_t *it_next)
+{
+	const int bin = P.Time_Bin[first];
+	const intime_t it_step = Timebin2It_Timestep(bin);
+	const intime_t it_beg = Int_Time.Next - it_step;
+
+	intime_t it_curr = P.It_Kick_Pos[first];
+
+	double dt = 0;
+
+	if (it_curr < it_beg) { // second halfkick of last step
+
+		int last_bin = __builtin_ctzll(it_beg - it_curr) + 1;
+
+		dt = Cached_Kick_Step(&Deferred_Kick_Cache, last_bin, it_curr, it_beg);
+
+		it_curr = it_beg;
+	}
+
+	*it_next = it_curr + (it_step >> 1);
+
+	dt += Cached_Kick_Step(&First_Kick_Cache, bin, it_curr, *it_next);
+
+	return dt;
+}
+
+/*
+ * Apply all deferred second halfkicks, before all velocities are needed. 
+ * The steps of a bin are aligned on the integer timeline, so a particle 
+ * started its current step at the last multiple of it, that is not in the 
+ * future.
+ */
+
+void Kick_Deferred_Halfsteps()
+{
+	Profile("Deferred Kicks");
 
 	#pragma omp for
-	for (int i = 0; i < NActive_Particles; i++) {
+	for (int ipart = 0; ipart < Task.Npart_Total; ipart++) {
+
+		const intime_t it_step = Timebin2It_Timestep(P.Time_Bin[ipart]);
+		const intime_t it_beg = Int_Time.Current & ~(it_step - 1);
+
+		const intime_t it_curr = P.It_Kick_Pos[ipart];
 
-		int ipart = Active_Particle_List[i];
-		
-		intime_t it_step = Timebin2It_Timestep(P.Time_Bin[ipart]);
+		if (it_curr >= it_beg)
+			continue;
 
-		intime_t it_curr = P.It_Kick_Pos[ipart];
-		intime_t it_next = P.It_Kick_Pos[ipart] + (it_step >> 1);
+		const int last_bin = __builtin_ctzll(it_beg - it_curr) + 1;
 
-		Float dt = Particle_Kick_Step(it_curr, it_next);
+		const Float dt = Cached_Kick_Step(&Deferred_Kick_Cache, last_bin, 
+				it_curr, it_beg);
 
 		P.Vel[0][ipart] += dt * P.Acc[0][ipart];
 		P.Vel[1][ipart] += dt * P.Acc[1][ipart];
 		P.Vel[2][ipart] += dt * P.Acc[2][ipart];
-		
-		if (!Sig.Domain_Update)
-			Gravity_Tree_Update_Kicks(ipart, dt);
 
-		P.It_Kick_Pos[ipart] += (it_step >> 1);
+		P.It_Kick_Pos[ipart] = it_beg;
+
+		if (!Sig.Domain_Update)
+			Gravity_Tree_Update_Kicks(ipart, dt); // GRAVITY_TREE
 	}
 
-	Profile("Second Kick");
+	Profile("Deferred Kicks");
 
 	return ;
 }
 
+#endif // ! HERMITE
+
 /*
  * Return the amount of real time between two points on the integer timeline.
  */
@@ -7,6 +7,12 @@
 
 void Kick_First_Halfstep();
 void Kick_Second_Halfstep();
-extern double Particle_Kick_Step(const intime_t, const intime_t);
+
+#ifdef HERMITE
+static inline void Kick_Deferred_Halfsteps() {};
+#else
+void Kick_Deferred_Halfsteps();
+Float Kick_Halfstep_Factor(const int first, intime_t *it_next);
+#endif // ! HERMITE
 
 #endif // KICK_H
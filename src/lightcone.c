@@ -0,0 +1,454 @@
+#include "lightcone.h"
+
+#ifdef LIGHTCONE
+
+/*
+ * Particles crossing the past lightcone of an observer at LightconeObserver
+ * are found during the drift: at the beginning of the drift the particle is
+ * inside the sphere of radius chi(a), at the end outside. We interpolate
+ * position, velocity and expansion factor of the crossing linearly. With
+ * PERIODIC we consider all box replications intersecting the shell covered
+ * by the drift, the list is updated before every drift. The box is split
+ * into cells, every cell keeps the replicas that put its image into the
+ * shell, so a particle tests only the replicas of its cell. Every thread fills
+ * its own buffer, full buffers are appended as chunks to one file per rank:
+ * a uint32_t particle count followed by struct Lightcone_Particle. Particles
+ * are only written below LightconeMaxRedshift.
+ */
+
+#define BUFFER_SIZE 16384 // particles per thread
+#define BOX_MARGIN 0.1 // particles are wrapped only after the drift
+#define KICK_MARGIN 1.1 // velocities may change in the kick before the drift
+#define NCELL 8 // per dimension
+#define NCELL_TOTAL (NCELL * NCELL * NCELL)
+#define CELL_TESTS_MAX (1UL << 24) // limits cost and memory of cell lists
+
+struct Lightcone_Particle {
+	float Pos[3];			// relative to the observer
+	float Vel[3];
+	float Time;				// expansion factor at crossing
+	ID_t ID;
+};
+
+static void find_replications(const double, const double);
+static void find_cell_replicas(const bool, const double, const double);
+static int cell_of(const int);
+static void flush_buffer(const int);
+
+static double A_Min = 0; // highest redshift
+
+static double (*Replica)[3] = NULL; // box shifts to consider in this drift
+static int NReplica = 0;
+
+static bool Use_Cells = false;
+static int Cell_First[NCELL_TOTAL + 2] = { 0 }; // last cell: all replicas
+static int *Cell_Replica = NULL; // replicas of cell c from Cell_First[c]
+static int NCell_Replica_Max = 0;
+static double Drift_Max = 0; // max displacement assumed for cell lists
+
+static struct Slab_Extent { // squared distances of the cell slabs of a replica
+	double Min[3][NCELL];
+	double Max[3][NCELL];
+} *Extent = NULL;
+static int NExtent_Max = 0;
+
+static struct Lightcone_Particle *Buffer = NULL; // BUFFER_SIZE per thread
+static int *NBuffer = NULL;
+
+static FILE *Lightcone_File = NULL;
+static uint64_t NWritten = 0;
+
+static intime_t It_First = 0;
+static double V2_Max = 0;
+
+void Setup_Lightcone()
+{
+	A_Min = 1.0 / (1.0 + Param.Lightcone_Max_Redshift);
+
+	Buffer = Malloc(NThreads * BUFFER_SIZE * sizeof(*Buffer),
+			"Lightcone Buffer");
+	NBuffer = Malloc(NThreads * sizeof(*NBuffer), "Lightcone NBuffer");
+
+	char fname[CHARBUFSIZE] = { "" };
+
+	sprintf(fname, "%s.%04d", Param.Lightcone_File_Base, Task.Rank);
+
+	const char *mode = (Param.Start_Flag == READ_RESTART) ? "a" : "w";
+
+	Lightcone_File = fopen(fname, mode);
+
+	Assert(Lightcone_File != NULL, "Can't open file %s", fname);
+
+	rprintf("Lightcone: observer at %g %g %g, z < %g, chi(z) = %g \n\n",
+			Param.Lightcone_Observer[0], Param.Lightcone_Observer[1],
+			Param.Lightcone_Observer[2], Param.Lightcone_Max_Redshift,
+			Comoving_Distance(A_Min));
+
+	return ;
+}
+
+void Finish_Lightcone()
+{
+	for (int i = 0; i < NThreads; i++)
+		flush_buffer(i);
+
+	fclose(Lightcone_File);
+
+	rprintf("Lightcone: wrote %"PRIu64" particles on master \n", NWritten);
+
+	Free(NBuffer); Free(Buffer); Free(Replica); Free(Cell_Replica);
+	Free(Extent);
+
+	return ;
+}
+
+/*
+ * Find the box replications intersecting the shell swept by this drift.
+ * The earliest drift time of the particles in list sets its outer radius,
+ * list == NULL means all particles. The fastest particle sets the drift
+ * margin of the cell lists. Small lists and too many replicas skip them.
+ */
+
+void Lightcone_Prepare_Drift(const int *list, const int nList,
+		const intime_t it_last)
+{
+	#pragma omp single
+	{
+
+	It_First = it_last;
+	V2_Max = 0;
+
+	} // omp single
+
+	#pragma omp for reduction(min:It_First) reduction(max:V2_Max)
+	for (int i = 0; i < nList; i++) {
+
+		int ipart = (list == NULL) ? i : list[i];
+
+		It_First = MIN(It_First, P.It_Drift_Pos[ipart]);
+
+		V2_Max = fmax(V2_Max, p2(P.Vel[0][ipart]) + p2(P.Vel[1][ipart])
+				+ p2(P.Vel[2][ipart]));
+	}
+
+	const double a_first = Integer_Time2Integration_Time(It_First);
+	const double a_last = Integer_Time2Integration_Time(it_last);
+
+	#pragma omp single
+	{
+
+	if (a_last < A_Min) {
+
+		NReplica = 0;
+
+	} else {
+
+		find_replications(Comoving_Distance(a_last),
+				Comoving_Distance(fmax(a_first, A_Min)));
+
+		Drift_Max = KICK_MARGIN * sqrt(V2_Max)
+			* Particle_Drift_Step(It_First, it_last);
+	}
+
+	Use_Cells = false;
+
+#ifdef PERIODIC
+	Use_Cells = (nList > NCELL_TOTAL)
+		&& ((size_t) NCELL_TOTAL * NReplica <= CELL_TESTS_MAX);
+#endif
+
+	} // omp single
+
+	if (NReplica > 0)
+		find_cell_replicas(Use_Cells, Comoving_Distance(a_last) - Drift_Max,
+				Comoving_Distance(a_first));
+
+	return ;
+}
+
+static void find_replications(const double r_min, const double r_max)
+{
+#ifdef PERIODIC
+	const double *L = Sim.Boxsize;
+	const double *obs = Param.Lightcone_Observer;
+
+	const int n = ceil(r_max / fmin(L[0], fmin(L[1], L[2]))) + 1;
+
+	NReplica = 0;
+
+	for (int i = -n; i <= n; i++)
+	for (int j = -n; j <= n; j++)
+	for (int k = -n; k <= n; k++) {
+
+		const double shift[3] = { i * L[0], j * L[1], k * L[2] };
+
+		double d2_min = 0, d2_max = 0; // distance of the box to observer
+
+		for (int m = 0; m < 3; m++) {
+
+			double lo = shift[m] - BOX_MARGIN * L[m] - obs[m];
+			double hi = shift[m] + (1 + BOX_MARGIN) * L[m] - obs[m];
+
+			if (lo > 0)
+				d2_min += lo * lo;
+			else if (hi < 0)
+				d2_min += hi * hi;
+
+			d2_max += fmax(lo * lo, hi * hi);
+		}
+
+		if (d2_min > p2(r_max) || d2_max < p2(r_min))
+			continue;
+
+		if (NReplica % 1024 == 0)
+			Replica = Realloc(Replica, (NReplica + 1024) * sizeof(*Replica),
+					"Lightcone Replica");
+
+		Replica[NReplica][0] = shift[0];
+		Replica[NReplica][1] = shift[1];
+		Replica[NReplica][2] = shift[2];
+
+		NReplica++;
+	}
+#else // ! PERIODIC
+	if (Replica == NULL)
+		Replica = Malloc(sizeof(*Replica), "Lightcone Replica");
+
+	Replica[0][0] = Replica[0][1] = Replica[0][2] = 0;
+
+	NReplica = 1;
+#endif // ! PERIODIC
+
+	return ;
+}
+
+/*
+ * A particle starting in cell c can only cross in replicas that put the
+ * image of the cell into [r_min, r_max], r_min already includes the drift.
+ * The squared distance range of a cell image is the sum of those of its
+ * three slabs, which we tabulate per replica. Then count, allocate and fill,
+ * the last cell always holds all replicas.
+ */
+
+static void find_slab_extents(const int n)
+{
+	for (int m = 0; m < 3; m++) {
+
+		const double size = Sim.Boxsize[m] / NCELL;
+
+		for (int i = 0; i < NCELL; i++) {
+
+			double lo = i * size + Replica[n][m] - Param.Lightcone_Observer[m];
+			double hi = lo + size;
+
+			double d_min = 0;
+
+			if (lo > 0)
+				d_min = lo;
+			else if (hi < 0)
+				d_min = hi;
+
+			Extent[n].Min[m][i] = d_min * d_min;
+			Extent[n].Max[m][i] = fmax(lo * lo, hi * hi);
+		}
+	}
+
+	return ;
+}
+
+static bool replica_in_shell(const int c, const int n, const double r2_min,
+		const double r2_max)
+{
+	const int i = c / (NCELL * NCELL), j = (c / NCELL) % NCELL, k = c % NCELL;
+
+	const struct Slab_Extent *e = &Extent[n];
+
+	return (e->Min[0][i] + e->Min[1][j] + e->Min[2][k] <= r2_max)
+		&& (e->Max[0][i] + e->Max[1][j] + e->Max[2][k] >= r2_min);
+}
+
+static void find_cell_replicas(const bool use_cells, const double r_min,
+		const double r_max)
+{
+	const double r2_min = p2(fmax(0, r_min));
+	const double r2_max = p2(r_max);
+
+	#pragma omp single
+	if (use_cells && NReplica > NExtent_Max) {
+
+		NExtent_Max = NReplica;
+
+		Extent = Realloc(Extent, NExtent_Max * sizeof(*Extent),
+				"Lightcone Extent");
+	}
+
+	#pragma omp for
+	for (int n = 0; n < NReplica; n++)
+		if (use_cells)
+			find_slab_extents(n);
+
+	#pragma omp for
+	for (int c = 0; c < NCELL_TOTAL; c++) {
+
+		Cell_First[c + 1] = 0;
+
+		for (int n = 0; n < NReplica && use_cells; n++)
+			Cell_First[c + 1] += replica_in_shell(c, n, r2_min, r2_max);
+	}
+
+	#pragma omp single
+	{
+
+	Cell_First[0] = 0;
+
+	for (int c = 0; c < NCELL_TOTAL; c++)
+		Cell_First[c + 1] += Cell_First[c];
+
+	Cell_First[NCELL_TOTAL + 1] = Cell_First[NCELL_TOTAL] + NReplica;
+
+	if (Cell_First[NCELL_TOTAL + 1] > NCell_Replica_Max) {
+
+		NCell_Replica_Max = Cell_First[NCELL_TOTAL + 1];
+
+		Cell_Replica = Realloc(Cell_Replica,
+				NCell_Replica_Max * sizeof(*Cell_Replica),
+				"Lightcone Cell Replica");
+	}
+
+	for (int n = 0; n < NReplica; n++)
+		Cell_Replica[Cell_First[NCELL_TOTAL] + n] = n;
+
+	} // omp single
+
+	#pragma omp for
+	for (int c = 0; c < NCELL_TOTAL; c++) {
+
+		int j = Cell_First[c];
+
+		for (int n = 0; n < NReplica && use_cells; n++)
+			if (replica_in_shell(c, n, r2_min, r2_max))
+				Cell_Replica[j++] = n;
+	}
+
+	return ;
+}
+
+static int cell_of(const int ipart)
+{
+	int c = 0;
+
+	for (int i = 0; i < 3; i++) {
+
+		int idx = floor(P.Pos[i][ipart] / Sim.Boxsize[i] * NCELL);
+
+		c = c * NCELL + imin(imax(idx, 0), NCELL - 1); // wrapped after drift
+	}
+
+	return c;
+}
+
+/*
+ * Called in the drift before particle ipart moves by dt * Vel from it_curr
+ * to it_next.
+ */
+
+void Lightcone_Check_Crossing(const int ipart, const intime_t it_curr,
+		const intime_t it_next, const double dt)
+{
+	if (NReplica == 0)
+		return ;
+
+	const double a_next = Integer_Time2Integration_Time(it_next);
+
+	if (a_next < A_Min)
+		return ;
+
+	const double a_curr = Integer_Time2Integration_Time(it_curr);
+
+	const double chi_curr = Comoving_Distance(a_curr);
+	const double chi_next = Comoving_Distance(a_next);
+
+	double x0[3], dx[3];
+
+	for (int i = 0; i < 3; i++) {
+
+		x0[i] = P.Pos[i][ipart] - Param.Lightcone_Observer[i];
+		dx[i] = dt * P.Vel[i][ipart];
+	}
+
+	int c = NCELL_TOTAL; // all replicas
+
+	if (Use_Cells && (p2(dx[0]) + p2(dx[1]) + p2(dx[2]) <= p2(Drift_Max)))
+		c = cell_of(ipart); // else kicked beyond the margin
+
+	for (int k = Cell_First[c]; k < Cell_First[c + 1]; k++) {
+
+		const int n = Cell_Replica[k];
+
+		double p0[3] = { x0[0] + Replica[n][0], x0[1] + Replica[n][1],
+						 x0[2] + Replica[n][2] };
+
+		double f0 = sqrt(p2(p0[0]) + p2(p0[1]) + p2(p0[2])) - chi_curr;
+
+		if (f0 >= 0) // already outside
+			continue;
+
+		double f1 = sqrt(p2(p0[0] + dx[0]) + p2(p0[1] + dx[1])
+				+ p2(p0[2] + dx[2])) - chi_next;
+
+		if (f1 < 0) // still inside
+			continue;
+
+		const double frac = f0 / (f0 - f1);
+		const double a_cross = a_curr + frac * (a_next - a_curr);
+
+		if (a_cross < A_Min)
+			continue;
+
+		const int thread = Task.Thread_ID;
+
+		struct Lightcone_Particle *lp =
+			&Buffer[thread * BUFFER_SIZE + NBuffer[thread]];
+
+		for (int i = 0; i < 3; i++) {
+
+			lp->Pos[i] = p0[i] + frac * dx[i];
+			lp->Vel[i] = P.Vel[i][ipart];
+		}
+
+		lp->Time = a_cross;
+		lp->ID = P.ID[ipart];
+
+		if (++NBuffer[thread] == BUFFER_SIZE) {
+
+			#pragma omp critical
+			flush_buffer(thread);
+		}
+	}
+
+	return ;
+}
+
+/*
+ * Append the buffer of a thread to the file as one chunk. Not thread safe.
+ */
+
+static void flush_buffer(const int thread)
+{
+	uint32_t n = NBuffer[thread];
+
+	if (n == 0)
+		return ;
+
+	Fwrite(&n, sizeof(n), 1, Lightcone_File);
+	Fwrite(&Buffer[thread * BUFFER_SIZE], sizeof(*Buffer), n, Lightcone_File);
+
+	fflush(Lightcone_File);
+
+	NWritten += n;
+	NBuffer[thread] = 0;
+
+	return ;
+}
+
+#endif // LIGHTCONE
@@ -0,0 +1,36 @@
+#ifndef LIGHTCONE_H
+#define LIGHTCONE_H
+
+/*
+ * Particle lightcone output, streamed during the drift
+ */
+
+#include "includes.h"
+#include "cosmology.h"
+#include "timestep.h"
+
+#ifdef LIGHTCONE
+
+#ifndef COMOVING
+#error LIGHTCONE requires COMOVING
+#endif
+
+void Setup_Lightcone();
+void Finish_Lightcone();
+void Lightcone_Prepare_Drift(const int *list, const int nList,
+		const intime_t it_last);
+void Lightcone_Check_Crossing(const int ipart, const intime_t it_curr,
+		const intime_t it_next, const double dt);
+
+#else // ! LIGHTCONE
+
+static inline void Setup_Lightcone() {};
+static inline void Finish_Lightcone() {};
+static inline void Lightcone_Prepare_Drift(const int *list, const int nList,
+		const intime_t it_last) {};
+static inline void Lightcone_Check_Crossing(const int ipart,
+		const intime_t it_curr, const intime_t it_next, const double dt) {};
+
+#endif // LIGHTCONE
+
+#endif // LIGHTCONE_H
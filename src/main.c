@@ -14,7 +14,12 @@ static void preamble(int argc, char *argv[]);
 
 /* 
  * This exposes the time integration of the code. 
- * We use the HOLD integrator from Pelupessy+ 2012. 
+ * We use a KDK leapfrog with block timesteps. The second halfkick is 
+ * deferred and fused with the next first halfkick and the drift (drift.c), 
+ * except before snapshots. With HOLD, only active 
+ * particles are sources in the force computation and the forces of slower
+ * particles are kicked on their timestep, as in the HOLD integrator of 
+ * Pelupessy+ 2012 (see Gravity/tree_accel.c).
  */
 
 extern double arr[10];
@@ -52,21 +57,27 @@ int main(int argc, char *argv[])
 
 		Set_New_Timesteps();
 		
-		Kick_First_Halfstep();
-
 		if (Time_For_Snapshot()) {
 
+			Kick_Deferred_Halfsteps();
+
+			Kick_First_Halfstep();
+
 			Drift_To_Snaptime();
 
+			Update(BEFORE_SNAPSHOT);
+
 			Write_Snapshot();
-		}
 
-		Drift_To_Sync_Point();
+			Drift_To_Sync_Point();
+
+		} else 
+			Kick_Drift_To_Sync_Point();
 		
 		Update(AFTER_DRIFT);
 
 		if (Runtime_Limit_Reached()) 
-			break;
+			goto Stop_Run; // restart continues with the forces
 
 		Restart_Continue:
 
@@ -84,8 +95,16 @@ int main(int argc, char *argv[])
 		Update(AFTER_STEP);
 	}
 
-	if (Time_For_Snapshot())
+	Kick_Deferred_Halfsteps(); // complete the last step
+
+	Stop_Run:
+
+	if (Time_For_Snapshot()) {
+
+		Update(BEFORE_SNAPSHOT);
+
 		Write_Snapshot();
+	}
 
 	if (Sig.Restart_Write_File)
 		Write_Restart_File();
@@ -134,6 +153,8 @@ static void preamble(int argc, char *argv[])
 
 	} // omp single
 
+	MPI_Comm_rank(MPI_COMM_WORLD, &Task.Rank); // Task is threadprivate
+
 	Task.Thread_ID = omp_get_thread_num();
 
 	if (Task.Rank == MASTER && Task.Thread_ID == MASTER)
@@ -1,12 +1,50 @@
+#define _DEFAULT_SOURCE // mmap() flags and madvise() with -std=c99
+
 #include "memory.h"
 
-#define MAXMEMOBJECTS 1000L
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define NBINS 64 // free blocks by floor(log2(size))
+#define LAZY_ZERO_MIN_BYTES (8L*1024*1024) // fresh pages instead of memset
+#define MEMORY_POISON 0xFF // DEBUG_MEMORY, NaN in floats, -1 in ints
+#define SCRATCH_ALIGN 64 // bytes, a cache line
+#define SCRATCH_CHUNKS_MAX 32 // every chunk at least doubles the arena
+#define P_ARRAYS_MAX 128 // in reserved address space
+
+#ifdef MEMORY_NUMA
+#include <sys/syscall.h>
+
+#define NUMA_NODES_MAX 64 // in the placement report
+#define NUMA_PAGES_SAMPLED 512 // per memory block
+#endif // MEMORY_NUMA
 
-int posix_memalign(void **memptr, size_t alignment, size_t size);
 static void merge_free_memory_blocks(int);
 static int find_memory_block_from_ptr(void *);
 static int reserve_free_block_from_size(const size_t);
+static int reserve_block(const char*, const char*, const int, size_t,
+		const char*);
+static int new_block_entry();
+static void delete_block_entry(const int);
+static void link_block(const int, const int);
+static void unlink_block(const int);
+static void add_to_free_bin(const int);
+static void remove_from_free_bin(const int);
+static void split_block(const int, const size_t);
+static size_t find_pointer_hash_slot(const void *);
+static void insert_pointer_hash(void *, const int);
+static void delete_pointer_hash(size_t);
+static size_t find_name_slot(const char *);
+static const char *intern_name(const char *);
 static size_t get_system_memory_size();
+static void print_numa_placement(const void *, const size_t);
+static void *map_memory(const size_t, size_t *, bool *);
+static void zero_memory(void *, const size_t);
+static void poison_memory(void *, const size_t);
+static void grow_scratch_arena(const int, const size_t);
+static void print_scratch_usage();
+static void commit_particle_array(const int);
+static void print_particle_arrays();
 
 static void *Memory = NULL;
 
@@ -17,26 +55,224 @@ static int NMem_Blocks = 0; // all blocks, also empty ones
 static struct memory_block_infos {
 	void * Start;
 	size_t Size;
-	char Name[CHARBUFSIZE];
-	char File[CHARBUFSIZE];
-	char Func[CHARBUFSIZE];
+	size_t Used;				// as requested, for Realloc()
+	const char *Name;			// interned
+	const char *File;			// __FILE__ and __func__ are static
+	const char *Func;
 	int Line;
 	bool In_Use;
-} Mem_Block[MAXMEMOBJECTS];
+	int Prev, Next;				// neighbours in memory, -1 at the ends
+	int Prev_Free, Next_Free;	// in the free list of its size bin
+} *Mem_Block = NULL;			// grows, entries are recycled
+
+static int NMem_Entries = 0; // allocated in Mem_Block
+static int Unused_Entry = -1; // recycled entries, linked via .Next
+static int First_Block = -1, Last_Block = -1; // in memory order
+
+static int Free_Bin[NBINS] = { 0 }; // heads of the free lists
+static uint64_t Free_Bin_Mask = 0; // bit set if bin not empty
+
+static struct pointer_hash_entry {
+	void *Ptr;
+	int Block;
+} *Ptr_Hash = NULL; // blocks in use, open addressing
+
+static int Ptr_Hash_Bits = 0;
+static size_t NPtr_Hash = 0;
+
+static char **Names = NULL; // interned block names, open addressing
+static int Names_Bits = 0;
+static size_t NNames = 0;
+
+static size_t Mem_Mapped = 0; // size of the mmap()ed arena
+static bool Lazy_Zero = false; // madvise(MADV_DONTNEED) gives zero pages
+
+static struct scratch_arena {
+	char *Chunk[SCRATCH_CHUNKS_MAX];
+	size_t Size[SCRATCH_CHUNKS_MAX];	// usable bytes
+	size_t Mapped[SCRATCH_CHUNKS_MAX];	// for munmap()
+	size_t Base[SCRATCH_CHUNKS_MAX];	// offset of the chunk in the arena
+	int NChunks;
+	int Current;						// chunk containing Top
+	size_t Top;							// offset of the first free byte
+	size_t High_Water;					// largest Top so far
+	int NGrown;
+} *Scratch = NULL;						// one per thread, large enough to
+										// avoid false sharing of Top
+
+static struct particle_array_infos {
+	char *Start;
+	size_t Elem_Size;			// per particle
+	size_t Reserved;			// bytes of address space
+	size_t Committed;			// bytes readable and writable
+	const char *Name;			// interned
+	const char *File;
+	const char *Func;
+	int Line;
+} P_Array[P_ARRAYS_MAX];
+
+static int NP_Arrays = 0;
 
-static void *buffer; // Multi-purpose thread-safe buffer: BUFFER_SIZE
-#pragma omp threadprivate(buffer)
+static char Huge_Page_Info[CHARBUFSIZE] = { "none" };
 
 void *Malloc_info(const char* file, const char* func, const int line,
 		size_t size, const char *name)
 {
+	const int i = reserve_block(file, func, line, size, name);
+
+	zero_memory(Mem_Block[i].Start, Mem_Block[i].Size);
+
+	return Mem_Block[i].Start;
+}
+
+/*
+ * For buffers that are overwritten anyway. Costs only the book-keeping.
+ */
+
+void *Malloc_Uninit_info(const char* file, const char* func, const int line,
+		size_t size, const char *name)
+{
+	const int i = reserve_block(file, func, line, size, name);
+
+	poison_memory(Mem_Block[i].Start, Mem_Block[i].Size); // DEBUG_MEMORY
+
+	return Mem_Block[i].Start;
+}
+
+/*
+ * Arrays indexed by particle live outside the arena, in their own range of
+ * address space. We reserve room for all particles of the simulation, but
+ * make only Task.Npart_Total_Max particles accessible. When that grows,
+ * Commit_Particle_Arrays() extends all arrays in place, no copies. The
+ * kernel backs only pages that are touched, so a tight PartAllocFactor
+ * costs no copy when a rank ends up with more particles. Fresh pages are
+ * zero. With MEMORY_NUMA all threads zero their part of the array, so the
+ * OS places these pages on the NUMA node of the thread that uses them in a
+ * static omp schedule. Outside of parallel regions.
+ */
+
+void *Reserve_Particle_Array_info(const char *file, const char *func,
+		const int line, const size_t elem_size, const char *name)
+{
+	Assert(NP_Arrays < P_ARRAYS_MAX, "Too many particle arrays, increase "
+			"P_ARRAYS_MAX");
+
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+
+	const size_t nMax = MAX(Sim.Npart_Total, Task.Npart_Total_Max);
+
+	const size_t nBytes = (nMax * elem_size + page_size - 1)
+			/ page_size * page_size;
+
+	void *ptr = mmap(NULL, nBytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS
+			| MAP_NORESERVE, -1, 0);
+
+	Assert(ptr != MAP_FAILED, "Couldn't reserve %zu bytes for %s", nBytes,
+			name);
+
+#ifdef MADV_HUGEPAGE
+	if (Param.Huge_Page_Size > 0)
+		madvise(ptr, nBytes, MADV_HUGEPAGE);
+#endif
+
+	const int i = NP_Arrays++;
+
+	P_Array[i].Start = ptr;
+	P_Array[i].Elem_Size = elem_size;
+	P_Array[i].Reserved = nBytes;
+	P_Array[i].Committed = 0;
+	P_Array[i].Name = intern_name(name);
+	P_Array[i].File = file;
+	P_Array[i].Func = func;
+	P_Array[i].Line = line;
+
+	commit_particle_array(i);
+
+#ifdef MEMORY_NUMA
+	First_Touch(ptr, P_Array[i].Committed, elem_size,
+			Sim.Npart_Total / NRank);
+#endif
+
+	return ptr;
+}
+
+void Commit_Particle_Arrays()
+{
+	for (int i = 0; i < NP_Arrays; i++)
+		commit_particle_array(i);
+
+	return ;
+}
+
+static void commit_particle_array(const int i)
+{
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+
+	const size_t nBytes = (Task.Npart_Total_Max * P_Array[i].Elem_Size
+			+ page_size - 1) / page_size * page_size;
+
+	if (nBytes <= P_Array[i].Committed)
+		return ;
+
+	Assert(nBytes <= P_Array[i].Reserved, "%s can't hold %zu particles, "
+			"reserved %zu bytes", P_Array[i].Name, Task.Npart_Total_Max,
+			P_Array[i].Reserved);
+
+	char *beg = P_Array[i].Start + P_Array[i].Committed;
+
+	int fail = mprotect(beg, nBytes - P_Array[i].Committed,
+			PROT_READ | PROT_WRITE);
+
+	Assert(!fail, "Couldn't commit %zu bytes of %s", nBytes, P_Array[i].Name);
+
+	P_Array[i].Committed = nBytes;
+
+	return ;
+}
+
+/*
+ * Zero "nBytes" at "ptr" with all threads. Thread i gets the elements of its
+ * chunk in "omp for schedule(static)" over "nLoop" elements, the last thread
+ * also the rest of the array.
+ */
+
+void *First_Touch(void *ptr, const size_t nBytes, const size_t elem_size,
+		const size_t nLoop)
+{
+	Assert(!omp_in_parallel(), "First touch needs all threads");
+
+	#pragma omp parallel
+	{
+
+	const size_t i = Task.Thread_ID;
+
+	const size_t nChunk = nLoop / NThreads;
+	const size_t nRest = nLoop % NThreads;
+
+	size_t beg = i * nChunk + MIN(i, nRest);
+	size_t end = beg + nChunk + (i < nRest);
+
+	beg = MIN(nBytes, beg * elem_size);
+	end = MIN(nBytes, end * elem_size);
+
+	if (i == NThreads - 1)
+		end = nBytes;
+
+	memset((char *) ptr + beg, 0, end - beg);
+
+	} // omp parallel
+
+	return ptr;
+}
+
+static int reserve_block(const char* file, const char* func, const int line,
+		size_t size, const char *name)
+{
+	const size_t nUsed = size;
+
 	Assert_Info(file, func, line, size > 0, // check input
 			"Can't allocate an array of size 0 !");
 
-	Assert_Info(file, func, line, NBytes_Left >= size,
-			"Can't allocate Memory, Bytes: %zu > %zu, %zu total",
-			size, NBytes_Left, Mem_Size);
-
 	size = MAX(MEM_ALIGNMENT, size); // don't break alignment
 
 	if ( (size % MEM_ALIGNMENT) > 0) // make sure we stay aligned
@@ -44,27 +280,32 @@ void *Malloc_info(const char* file, const char* func, const int line,
 
 	int i = reserve_free_block_from_size(size);
 
-	Mem_Block[i].In_Use = true;
+	if (i < 0) { // couldn't find a free gap, add new at the end
 
-	strncpy(Mem_Block[i].Name, name, CHARBUFSIZE);
-	strncpy(Mem_Block[i].File, file, CHARBUFSIZE);
-	strncpy(Mem_Block[i].Func, func, CHARBUFSIZE);
-	Mem_Block[i].Line = line;
+		Assert_Info(file, func, line, NBytes_Left >= size,
+				"Can't allocate Memory, Bytes: %zu > %zu, %zu total",
+				size, NBytes_Left, Mem_Size);
 
-	if (i == NMem_Blocks) { // couldn't find a free gap, add new at the end
+		i = new_block_entry();
 
 		Mem_Block[i].Start = Memory + Mem_Size - NBytes_Left;
-
 		Mem_Block[i].Size = size;
 
-		NMem_Blocks++;
+		link_block(i, Last_Block);
 
 		NBytes_Left -= size;
 	}
 
-	memset(Mem_Block[i].Start, 0, Mem_Block[i].Size);
+	Mem_Block[i].In_Use = true;
+	Mem_Block[i].Used = nUsed;
+	Mem_Block[i].Name = intern_name(name);
+	Mem_Block[i].File = file;
+	Mem_Block[i].Func = func;
+	Mem_Block[i].Line = line;
 
-	return Mem_Block[i].Start;
+	insert_pointer_hash(Mem_Block[i].Start, i);
+
+	return i;
 }
 
 void *Realloc_info(const char* file, const char* func, const int line,
@@ -85,19 +326,21 @@ void *Realloc_info(const char* file, const char* func, const int line,
 		return ptr;
 	}
 
+	const size_t nUsed = new_size; // as requested
+
 	if ( (new_size % MEM_ALIGNMENT) > 0)
 		new_size = (new_size / MEM_ALIGNMENT + 1) * MEM_ALIGNMENT;
 
-	const int i = find_memory_block_from_ptr(ptr);
+	int i = find_memory_block_from_ptr(ptr);
 
-	int i_return = i;
+	const size_t old_used = Mem_Block[i].Used;
 
-	if (i == NMem_Blocks-1) { // enlarge last block
+	if (i == Last_Block) { // enlarge last block
 
-		const int delta = abs(new_size - Mem_Block[i].Size);
+		const int64_t delta = new_size - Mem_Block[i].Size; // may shrink
 		
-		Assert_Info(file, func,line, delta < NBytes_Left,
-				"Not enough memory to Realloc %zu MB, have %d."
+		Assert_Info(file, func,line, delta < (int64_t) NBytes_Left,
+				"Not enough memory to Realloc %"PRId64" MB, have %zu."
 				" Increase MaxMem_Size ?", 
 				delta/1024/1024, NBytes_Left/1024/1024);
 
@@ -107,22 +350,29 @@ void *Realloc_info(const char* file, const char* func, const int line,
 
 	} else if (new_size > Mem_Block[i].Size) { // move old to new and free
 
-		void *dest = Malloc_info(file, func, line, new_size, name);
+		void *dest = Malloc_Uninit_info(file, func, line, new_size, name);
+
+		memcpy(dest, ptr, old_used);
 
-		void *src = Mem_Block[i].Start;
+		Free(ptr);
 
-		size_t nBytes = Mem_Block[i].Size;
+		const int j = find_memory_block_from_ptr(dest); // might be in a gap
 
-		memcpy(dest, src, nBytes);
+		printf("Moving Memory Block %d -> %d \n", i, j);
 
-		Free(Mem_Block[i].Start);
+		i = j;
 
-		i_return = NMem_Blocks - 1;
+	} else { // shrink, return the rest
 
-		printf("Moving Memory Block %d -> %d \n",i, i_return);
+		split_block(i, new_size);
 	}
 
-	return Mem_Block[i_return].Start;
+	if (nUsed > old_used) // zero the new part as Malloc()
+		zero_memory((char *) Mem_Block[i].Start + old_used, nUsed - old_used);
+
+	Mem_Block[i].Used = nUsed;
+
+	return Mem_Block[i].Start;
 }
 
 void Free_info(const char* file, const char* func, const int line, void *ptr) 
@@ -135,14 +385,16 @@ void Free_info(const char* file, const char* func, const int line, void *ptr)
 	if (ptr == NULL)
 		return;
 
-	const int i = find_memory_block_from_ptr(ptr);
+	const size_t slot = find_pointer_hash_slot(ptr);
+
+	const int i = Ptr_Hash[slot].Block;
 
-	memset(Mem_Block[i].Start, 0, Mem_Block[i].Size);
+	delete_pointer_hash(slot);
+
+	poison_memory(Mem_Block[i].Start, Mem_Block[i].Size); // DEBUG_MEMORY
 
 	Mem_Block[i].In_Use = false;
-	strncpy(Mem_Block[i].Name, "", CHARBUFSIZE);
-	strncpy(Mem_Block[i].File, "", CHARBUFSIZE);
-	strncpy(Mem_Block[i].Func, "", CHARBUFSIZE);
+	Mem_Block[i].Name = Mem_Block[i].File = Mem_Block[i].Func = "";
 	Mem_Block[i].Line = 0;
 
 	merge_free_memory_blocks(i);
@@ -152,37 +404,178 @@ void Free_info(const char* file, const char* func, const int line, void *ptr)
 	return ;
 }
 
-void *Get_Thread_Safe_Buffer (size_t nBytes)
+/*
+ * Every thread has a stack of scratch memory, starting with Param.Buffer_Size
+ * MB split over the threads. Scratch_Push() returns a mark, Scratch_Alloc()
+ * returns uninitialised memory on top of the stack, Scratch_Pop() releases
+ * everything allocated after the mark. If a request doesn't fit into the
+ * current chunk, we continue in the next one, which is mapped on demand.
+ * Chunks are kept until the end, so the arena grows to its high-water mark
+ * and stays there. Only for thread-local, short-lived buffers.
+ */
+
+size_t Scratch_Push()
 {
-	Assert(nBytes <= Task.Buffer_Size, 
-			"Requested too much Buffer space %d > %d"
-			"Increase BUFFER_SIZE. ",
-			nBytes, Task.Buffer_Size);
-	
-	memset(buffer, 0, nBytes);
+	return Scratch[Task.Thread_ID].Top;
+}
+
+void *Scratch_Alloc(const size_t nBytes)
+{
+	struct scratch_arena *s = &Scratch[Task.Thread_ID];
+
+	int c = s->Current;
+
+	size_t start = (s->Top - s->Base[c] + SCRATCH_ALIGN - 1)
+			/ SCRATCH_ALIGN * SCRATCH_ALIGN;
+
+	if (start + nBytes > s->Size[c]) { // skip the rest of this chunk
+
+		c = ++s->Current;
+
+		if (c == s->NChunks || s->Size[c] < nBytes)
+			grow_scratch_arena(c, nBytes);
 
-	return buffer;
+		start = 0;
+	}
+
+	s->Top = s->Base[c] + start + nBytes;
+	s->High_Water = MAX(s->High_Water, s->Top);
+
+	poison_memory(s->Chunk[c] + start, nBytes); // DEBUG_MEMORY
+
+	return s->Chunk[c] + start;
+}
+
+void Scratch_Pop(const size_t mark)
+{
+	struct scratch_arena *s = &Scratch[Task.Thread_ID];
+
+	Assert(mark <= s->Top, "Scratch mark %zu above top %zu, popped twice ?",
+			mark, s->Top);
+
+	while (mark < s->Base[s->Current])
+		s->Current--;
+
+	s->Top = mark;
+
+	return ;
 }
 
 /*
- * Grab a huge chunk of memory and reserve a small chunk for every thread so
- * we a space to define thread-safe variable larger than the stack. The total
- * size is controlled by BUFFER_SIZE. Because we use the buffer for the
- * particle ordering it should at least hold Npart_Total_Max * sizeof(size_t).
+ * Replace chunk "c" and everything above it by a chunk of at least "nBytes",
+ * and twice the size of the arena below it. Nothing above Top is in use.
+ */
+
+static void grow_scratch_arena(const int c, const size_t nBytes)
+{
+	struct scratch_arena *s = &Scratch[Task.Thread_ID];
+
+	Assert(c < SCRATCH_CHUNKS_MAX, "Scratch arena has too many chunks, "
+			"increase SCRATCH_CHUNKS_MAX");
+
+	for (int i = c; i < s->NChunks; i++)
+		munmap(s->Chunk[i], s->Mapped[i]);
+
+	s->Base[c] = s->Base[c-1] + s->Size[c-1];
+
+	size_t size = MAX(nBytes, 2 * s->Base[c]);
+
+	bool hugetlbfs = false;
+
+	#pragma omp critical (scratch)
+	s->Chunk[c] = map_memory(size, &s->Mapped[c], &hugetlbfs);
+
+	Assert(s->Chunk[c] != NULL, "Couldn't grow scratch arena by %g MB",
+			size/1024.0/1024);
+
+	s->Size[c] = s->Mapped[c];
+	s->NChunks = c + 1;
+	s->NGrown++;
+
+	printf("(%d:%d) Growing Scratch Arena to %g MB \n", Task.Rank,
+			Task.Thread_ID, (s->Base[c] + s->Size[c])/1024.0/1024);
+
+	return ;
+}
+
+static void print_particle_arrays()
+{
+	printf("\nParticle Arrays:      Committed (MB)   Reserved (MB)"
+			"               Variable       File:Line\n");
+
+	size_t committed = 0;
+
+	for (int i = 0; i < NP_Arrays; i++) {
+
+		committed += P_Array[i].Committed;
+
+		printf("                     %14.3f  %14.3f   %20s  %s:%d",
+				P_Array[i].Committed/1024.0/1024,
+				P_Array[i].Reserved/1024.0/1024, P_Array[i].Name,
+				P_Array[i].File, P_Array[i].Line);
+
+		print_numa_placement(P_Array[i].Start,
+				P_Array[i].Committed); // MEMORY_NUMA
+
+		printf("\n");
+	}
+
+	printf("                     %14.3f MB for %llu particles\n",
+			committed/1024.0/1024, (unsigned long long) Task.Npart_Total_Max);
+
+	return ;
+}
+
+static void print_scratch_usage()
+{
+	if (Scratch == NULL) // Assert before Init_Memory_Management()
+		return ;
+
+	printf("\nScratch Arenas:  Thread  Size (MB)  High-Water (MB)  Grown\n");
+
+	for (int i = 0; i < NThreads; i++) {
+
+		const int c = Scratch[i].NChunks - 1;
+
+		printf("                 %6d  %9.3f  %15.3f  %5d\n", i,
+				(Scratch[i].Base[c] + Scratch[i].Size[c])/1024.0/1024,
+				Scratch[i].High_Water/1024.0/1024, Scratch[i].NGrown);
+	}
+
+	return ;
+}
+
+/*
+ * Grab a huge chunk of memory and map the first chunk of the scratch arena
+ * of every thread, so we have thread-safe space larger than the stack. The
+ * initial size is controlled by BUFFER_SIZE. Because we use the arena for
+ * the particle ordering it should hold Npart_Total_Max * sizeof(size_t), 
+ * otherwise it grows at the first sort.
  */
 
 void Init_Memory_Management()
 {
+	Scratch = calloc(NThreads, sizeof(*Scratch));
 
 	#pragma omp parallel
 	{
 
 	Task.Buffer_Size = Param.Buffer_Size * 1024L * 1024L / NThreads;
 
-	#pragma omp critical
-	buffer = malloc(Task.Buffer_Size); // let the system take a local chunk
+	struct scratch_arena *s = &Scratch[Task.Thread_ID];
+
+	bool hugetlbfs = false;
+
+	#pragma omp critical // let the system take a local chunk
+	s->Chunk[0] = map_memory(Task.Buffer_Size, &s->Mapped[0], &hugetlbfs);
 	
-	memset(buffer, 0, Task.Buffer_Size);
+	Assert(s->Chunk[0] != NULL, "Couldn't map %zu bytes of scratch arena",
+			Task.Buffer_Size);
+
+	memset(s->Chunk[0], 0, Task.Buffer_Size); // first touch
+
+	s->Size[0] = s->Mapped[0];
+	s->NChunks = 1;
 
 	} // omp parallel
 
@@ -202,14 +595,20 @@ void Init_Memory_Management()
 	rprintf("Init Memory Manager\n"
 			"   Max Usable Memory per task %zu bytes = %zu MB\n"
 			"   Min Usable Memory per task %zu bytes = %zu MB\n"
-			"   Requested  Memory per task %zu bytes = %zu MB\n\n",
+			"   Requested  Memory per task %zu bytes = %zu MB\n",
 			maxNbytes, maxNbytes/1024/1024, minNbytes,
 			minNbytes/1024/1024, Mem_Size, Mem_Size/1024/1024);
 
-	int fail = posix_memalign(&Memory, MEM_ALIGNMENT, Mem_Size);
+	bool hugetlbfs = false;
 
-	Assert(!fail, "Couldn't allocate Memory. MaxMemSize %d too large ?",
-			Param.Max_Mem_Size);
+	Memory = map_memory(Mem_Size, &Mem_Mapped, &hugetlbfs);
+
+	Assert(Memory != NULL, "Couldn't allocate Memory. MaxMemSize %d too "
+			"large ?", Param.Max_Mem_Size);
+
+	Lazy_Zero = !hugetlbfs; // hugetlbfs releases only whole huge pages
+
+	rprintf("   Huge pages %s\n\n", Huge_Page_Info);
 
 	NBytes_Left = Mem_Size;
 
@@ -252,23 +651,29 @@ void Print_Memory_Usage()
 
 	size_t mem_Cumulative = 0;
 
-	for (int i = 0; i < NMem_Blocks; i++) {
+	int n = 0;
+
+	for (int i = First_Block; i >= 0; i = Mem_Block[i].Next, n++) {
 
 		mem_Cumulative += Mem_Block[i].Size;
 
-		printf("  %03d   %d    %11p     %7.3f      %8.3f   %20s  %s:%d\n",
-			i,Mem_Block[i].In_Use, Mem_Block[i].Start,
+		printf("  %03d   %d    %11p     %7.3f      %8.3f   %20s  %s:%d",
+			n, Mem_Block[i].In_Use, Mem_Block[i].Start,
 			(double) Mem_Block[i].Size/1024/1024,
 			(double) mem_Cumulative/1024/1024,
 			Mem_Block[i].Name, Mem_Block[i].File,
 			Mem_Block[i].Line);
+
+		if (Mem_Block[i].In_Use)
+			print_numa_placement(Mem_Block[i].Start,
+					Mem_Block[i].Size); // MEMORY_NUMA
+
+		printf("\n");
 	}
 
-	printf("\nExternal Thread-Safe Buffer: %d x %g = %g MB, "
-			"Minimum required: %g MB\n\n",
-			NThreads, Task.Buffer_Size/1024.0/1024,
-			(float) Param.Buffer_Size, 
-			Task.Npart_Total_Max * NThreads * sizeof(uint64_t)/1024.0/1024);
+	print_particle_arrays();
+
+	print_scratch_usage();
 
 	printf("\n");
 
@@ -287,7 +692,7 @@ void Get_Free_Memory(size_t *total, size_t *largest, size_t *smallest)
 {
 	*total = *largest = *smallest = 0;
 
-	for (int i = 0; i < NMem_Blocks; i++) {
+	for (int i = First_Block; i >= 0; i = Mem_Block[i].Next) {
 
 		if (Mem_Block[i].In_Use)
 			continue;
@@ -305,88 +710,604 @@ void Get_Free_Memory(size_t *total, size_t *largest, size_t *smallest)
 
 void Finish_Memory_Management()
 {
+	if (Task.Is_Master && Scratch != NULL)
+		print_scratch_usage();
+
 	rprintf("\nMemory Manager: Freeing %d MB of Memory, "
-			"%d MB of Omp buffer \n", Param.Max_Mem_Size, Param.Buffer_Size);
+			"%d MB of Scratch Arenas \n", Param.Max_Mem_Size,
+			Param.Buffer_Size);
 
 	if (Memory != NULL)
-		free(Memory);
+		munmap(Memory, Mem_Mapped);
 
-	#pragma omp parallel
-	if (buffer != NULL)
-		free(buffer);
+	for (int i = 0; Scratch != NULL && i < NThreads; i++)
+		for (int c = 0; c < Scratch[i].NChunks; c++)
+			munmap(Scratch[i].Chunk[c], Scratch[i].Mapped[c]);
+
+	free(Scratch);
+
+	for (int i = 0; i < NP_Arrays; i++)
+		munmap(P_Array[i].Start, P_Array[i].Reserved);
+
+	for (size_t i = 0; Names != NULL && i < (1UL << Names_Bits); i++)
+		free(Names[i]);
+
+	free(Names); free(Ptr_Hash); free(Mem_Block);
 
 	return ;
 }
 
-static int find_memory_block_from_ptr(void *ptr)
+/*
+ * Get "nBytes" of fresh, zeroed pages from the kernel. With
+ * Param.Huge_Page_Size > 0 we back them with huge pages of that many MB, to
+ * reduce TLB misses in the random access of tree walks and reordering. We
+ * try hugetlbfs first, which needs pages reserved in
+ * /proc/sys/vm/nr_hugepages. Otherwise we align to the huge page size and
+ * ask for transparent huge pages, which the kernel provides in 2 MB only.
+ * "mapped" returns the size to munmap().
+ */
+
+static void *map_memory(const size_t nBytes, size_t *mapped, bool *hugetlbfs)
 {
-	int i = 0;
+	const size_t page_size = MAX(sysconf(_SC_PAGESIZE),
+			Param.Huge_Page_Size * 1024L * 1024L);
 
-	for (i = 0; i < NMem_Blocks; i++)
-		if (ptr == Mem_Block[i].Start)
-			break;
+	const size_t size = (nBytes + page_size - 1) / page_size * page_size;
 
-	Assert(i < NMem_Blocks,
-		"Could not find memory block belonging to %p", ptr);
+	const int prot = PROT_READ | PROT_WRITE;
 
-	return i;
+	*mapped = 0;
+	*hugetlbfs = false;
+
+#ifdef MAP_HUGETLB
+	if (Param.Huge_Page_Size > 0) {
+
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+
+#ifdef MAP_HUGE_SHIFT
+		flags |= ((int) log2(page_size)) << MAP_HUGE_SHIFT;
+#endif
+
+		void *ptr = mmap(NULL, size, prot, flags, -1, 0);
+
+		if (ptr != MAP_FAILED) {
+
+			*mapped = size;
+			*hugetlbfs = true;
+
+			sprintf(Huge_Page_Info, "%d MB from hugetlbfs",
+					Param.Huge_Page_Size);
+
+			return ptr;
+		}
+	}
+#endif // MAP_HUGETLB
+
+	char *map = mmap(NULL, size + page_size, prot,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (map == MAP_FAILED)
+		return NULL;
+
+	char *ptr = (char *) (((uintptr_t) map + page_size - 1)
+			/ page_size * page_size);
+
+	if (ptr > map) // trim to alignment
+		munmap(map, ptr - map);
+
+	if (map + page_size > ptr)
+		munmap(ptr + size, map + page_size - ptr);
+
+	*mapped = size;
+
+#ifdef MADV_HUGEPAGE
+	if (Param.Huge_Page_Size > 0) {
+
+		int fail = madvise(ptr, size, MADV_HUGEPAGE);
+
+		sprintf(Huge_Page_Info, "%s", fail ? "none, madvise() failed"
+				: "transparent, via madvise()");
+	}
+#endif
+
+	return ptr;
+}
+
+/*
+ * Large blocks are zeroed by handing their pages back to the kernel, which
+ * maps fresh zero pages on first touch. That costs no bandwidth now and
+ * places the pages where they are used, see MEMORY_NUMA.
+ */
+
+static void zero_memory(void *ptr, const size_t nBytes)
+{
+#ifdef MADV_DONTNEED
+	if (Lazy_Zero && nBytes >= LAZY_ZERO_MIN_BYTES) {
+
+		const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+
+		char *beg = ptr, *end = beg + nBytes;
+
+		char *page_beg = (char *) (((uintptr_t) beg + page_size - 1)
+				/ page_size * page_size);
+		char *page_end = (char *) ((uintptr_t) end / page_size * page_size);
+
+		if (madvise(page_beg, page_end - page_beg, MADV_DONTNEED) == 0) {
+
+			memset(beg, 0, page_beg - beg);
+			memset(page_end, 0, end - page_end);
+
+			return ;
+		}
+	}
+#endif // MADV_DONTNEED
+
+	memset(ptr, 0, nBytes);
+
+	return ;
+}
+
+#ifdef DEBUG_MEMORY
+static void poison_memory(void *ptr, const size_t nBytes)
+{
+	memset(ptr, MEMORY_POISON, nBytes);
+
+	return ;
 }
+#else
+static inline void poison_memory(void *ptr, const size_t nBytes) {};
+#endif // DEBUG_MEMORY
+
+static int find_memory_block_from_ptr(void *ptr)
+{
+	return Ptr_Hash[find_pointer_hash_slot(ptr)].Block;
+}
+
+/*
+ * Free blocks sit in lists by floor(log2(size)). We take the first fit in
+ * the bin of "size", otherwise any block of the next larger non-empty bin.
+ * Returns -1 if there is none, then the block goes to the end.
+ */
 
 static int reserve_free_block_from_size(const size_t size)
 {
-	int i = 0;
+	const int bin = 63 - __builtin_clzll(size);
+
+	int i = -1;
+
+	if (Free_Bin_Mask & (1ULL << bin))
+		for (i = Free_Bin[bin]; i >= 0; i = Mem_Block[i].Next_Free)
+			if (Mem_Block[i].Size >= size)
+				break;
+
+	if (i < 0) {
+
+		const uint64_t larger = (bin < NBINS - 1) ?
+			Free_Bin_Mask & (~0ULL << (bin + 1)) : 0;
+
+		if (larger == 0)
+			return -1;
+
+		i = Free_Bin[__builtin_ctzll(larger)];
+	}
 
-	for (i = 0; i < NMem_Blocks; i++)
-		if ( !Mem_Block[i].In_Use && (Mem_Block[i].Size >= size))
-			break;
+	remove_from_free_bin(i);
 
 	Mem_Block[i].In_Use = true;
 
+	split_block(i, size);
+
 	return i;
 }
 
+/*
+ * Return the rest of block i in use beyond "size" to the free memory
+ */
+
+static void split_block(const int i, const size_t size)
+{
+	if (Mem_Block[i].Size - size < MEM_ALIGNMENT)
+		return ;
+
+	const int j = new_block_entry();
+
+	Mem_Block[j].Start = (char *) Mem_Block[i].Start + size;
+	Mem_Block[j].Size = Mem_Block[i].Size - size;
+
+	Mem_Block[i].Size = size;
+
+	link_block(j, i);
+
+	merge_free_memory_blocks(j);
+
+	return ;
+}
+
 /* merge memory blocks to minimize fragmentation */
 static void merge_free_memory_blocks(int i)
 {
-	if (i == NMem_Blocks-1) { // Last, merge right into free
+	const int next = Mem_Block[i].Next;
+
+	if (next >= 0 && !Mem_Block[next].In_Use) { // merge right
+
+		remove_from_free_bin(next);
+
+		Mem_Block[i].Size += Mem_Block[next].Size;
+
+		unlink_block(next);
+		delete_block_entry(next);
+	}
+
+	const int prev = Mem_Block[i].Prev;
+
+	if (prev >= 0 && !Mem_Block[prev].In_Use) { // merge left
+
+		remove_from_free_bin(prev);
+
+		Mem_Block[prev].Size += Mem_Block[i].Size;
+
+		unlink_block(i);
+		delete_block_entry(i);
+
+		i = prev;
+	}
+
+	if (i == Last_Block) { // Last, merge right into free
 
-		NMem_Blocks--;
 		NBytes_Left += Mem_Block[i].Size;
 
-		Mem_Block[i].Start = NULL;
-		Mem_Block[i].Size = 0;
+		unlink_block(i);
+		delete_block_entry(i);
+
+	} else {
+
+		add_to_free_bin(i);
+	}
+
+	return ;
+}
+
+static int new_block_entry()
+{
+	if (Unused_Entry < 0) { // grow, indices stay valid
+
+		const int n = MAX(1024, 2 * NMem_Entries);
+
+		Mem_Block = realloc(Mem_Block, n * sizeof(*Mem_Block));
 
-		if (i != 0 && !Mem_Block[i-1].In_Use)
-			merge_free_memory_blocks(i-1); // merge left into free
+		Assert(Mem_Block != NULL, "Can't grow memory block table to %d", n);
 
-	} else if (!Mem_Block[i+1].In_Use) { // merge right
+		for (int i = n - 1; i >= NMem_Entries; i--) {
+
+			Mem_Block[i].Next = Unused_Entry;
+			Unused_Entry = i;
+		}
+
+		NMem_Entries = n;
+	}
 
-		Mem_Block[i].Size += Mem_Block[i+1].Size;
+	const int i = Unused_Entry;
 
-		void *src = &Mem_Block[i+2].Start;
-		void *dest = &Mem_Block[i+1].Start;
-		size_t nBytes = (NMem_Blocks - (i+1)) * sizeof(*Mem_Block);
+	Unused_Entry = Mem_Block[i].Next;
 
-		memmove(dest, src, nBytes);
+	Mem_Block[i] = (struct memory_block_infos) { .Name = "", .File = "",
+		.Func = "", .Prev = -1, .Next = -1, .Prev_Free = -1,
+		.Next_Free = -1 };
 
-		NMem_Blocks--;
+	NMem_Blocks++;
 
-	} else if (i != 0 && ! Mem_Block[i-1].In_Use) { // merge left
+	return i;
+}
+
+static void delete_block_entry(const int i)
+{
+	Mem_Block[i].Next = Unused_Entry;
+	Unused_Entry = i;
+
+	NMem_Blocks--;
+
+	return ;
+}
+
+/*
+ * Blocks form a doubly linked list in memory order, insert i after "prev"
+ */
+
+static void link_block(const int i, const int prev)
+{
+	const int next = (prev < 0) ? First_Block : Mem_Block[prev].Next;
 
-		Mem_Block[i-1].Size += Mem_Block[i].Size;
+	Mem_Block[i].Prev = prev;
+	Mem_Block[i].Next = next;
 
-		void *src = &Mem_Block[i+1].Start;
-		void *dest = &Mem_Block[i].Start;
-		size_t nBytes = (NMem_Blocks - (i+1)) * sizeof(*Mem_Block);
+	if (prev < 0)
+		First_Block = i;
+	else
+		Mem_Block[prev].Next = i;
 
-		memmove(dest, src, nBytes);
+	if (next < 0)
+		Last_Block = i;
+	else
+		Mem_Block[next].Prev = i;
 
-		NMem_Blocks--;
+	return ;
+}
+
+static void unlink_block(const int i)
+{
+	const int prev = Mem_Block[i].Prev;
+	const int next = Mem_Block[i].Next;
+
+	if (prev < 0)
+		First_Block = next;
+	else
+		Mem_Block[prev].Next = next;
+
+	if (next < 0)
+		Last_Block = prev;
+	else
+		Mem_Block[next].Prev = prev;
+
+	return ;
+}
+
+static void add_to_free_bin(const int i)
+{
+	const int bin = 63 - __builtin_clzll(Mem_Block[i].Size);
+
+	const int next = (Free_Bin_Mask & (1ULL << bin)) ? Free_Bin[bin] : -1;
+
+	Mem_Block[i].Prev_Free = -1;
+	Mem_Block[i].Next_Free = next;
+
+	if (next >= 0)
+		Mem_Block[next].Prev_Free = i;
+
+	Free_Bin[bin] = i;
+	Free_Bin_Mask |= 1ULL << bin;
+
+	return ;
+}
+
+static void remove_from_free_bin(const int i)
+{
+	const int bin = 63 - __builtin_clzll(Mem_Block[i].Size);
+
+	const int prev = Mem_Block[i].Prev_Free;
+	const int next = Mem_Block[i].Next_Free;
+
+	if (prev < 0)
+		Free_Bin[bin] = next;
+	else
+		Mem_Block[prev].Next_Free = next;
+
+	if (next >= 0)
+		Mem_Block[next].Prev_Free = prev;
+
+	if (Free_Bin[bin] < 0)
+		Free_Bin_Mask &= ~(1ULL << bin);
+
+	return ;
+}
+
+/*
+ * Blocks in use by address, linear probing with a multiplicative hash.
+ * Deletion shifts the following entries back, so there are no tombstones.
+ */
+
+static size_t hash_pointer(const void *ptr)
+{
+	return ((uintptr_t) ptr * 0x9E3779B97F4A7C15ULL) >> (64 - Ptr_Hash_Bits);
+}
+
+static size_t find_pointer_hash_slot(const void *ptr)
+{
+	const size_t mask = (1UL << Ptr_Hash_Bits) - 1;
+
+	size_t j = (Ptr_Hash_Bits > 0) ? hash_pointer(ptr) : 0;
+
+	while (Ptr_Hash != NULL && Ptr_Hash[j].Ptr != NULL) {
+
+		if (Ptr_Hash[j].Ptr == ptr)
+			return j;
+
+		j = (j + 1) & mask;
+	}
+
+	Assert(false, "Could not find memory block belonging to %p", ptr);
+
+	return 0;
+}
+
+static void insert_pointer_hash(void *ptr, const int block)
+{
+	if (2 * (NPtr_Hash + 1) > (1UL << Ptr_Hash_Bits)) { // grow & rehash
+
+		struct pointer_hash_entry *old = Ptr_Hash;
+
+		const size_t nOld = (old == NULL) ? 0 : 1UL << Ptr_Hash_Bits;
+
+		Ptr_Hash_Bits = MAX(10, Ptr_Hash_Bits + 1);
+
+		Ptr_Hash = calloc(1UL << Ptr_Hash_Bits, sizeof(*Ptr_Hash));
+
+		Assert(Ptr_Hash != NULL, "Can't grow pointer hash to 2^%d",
+				Ptr_Hash_Bits);
+
+		NPtr_Hash = 0;
+
+		for (size_t i = 0; i < nOld; i++)
+			if (old[i].Ptr != NULL)
+				insert_pointer_hash(old[i].Ptr, old[i].Block);
+
+		free(old);
+	}
+
+	const size_t mask = (1UL << Ptr_Hash_Bits) - 1;
+
+	size_t j = hash_pointer(ptr);
+
+	while (Ptr_Hash[j].Ptr != NULL)
+		j = (j + 1) & mask;
+
+	Ptr_Hash[j].Ptr = ptr;
+	Ptr_Hash[j].Block = block;
+
+	NPtr_Hash++;
+
+	return ;
+}
+
+static void delete_pointer_hash(size_t i)
+{
+	const size_t mask = (1UL << Ptr_Hash_Bits) - 1;
+
+	Ptr_Hash[i].Ptr = NULL;
+
+	for (size_t j = (i + 1) & mask; Ptr_Hash[j].Ptr != NULL;
+			j = (j + 1) & mask) {
+
+		const size_t k = hash_pointer(Ptr_Hash[j].Ptr);
+
+		bool stays = (i < j) ? (i < k && k <= j) : (i < k || k <= j);
+
+		if (stays) // home slot k is still reachable from j
+			continue;
+
+		Ptr_Hash[i] = Ptr_Hash[j];
+		Ptr_Hash[j].Ptr = NULL;
+
+		i = j;
+	}
+
+	NPtr_Hash--;
+
+	return ;
+}
+
+/*
+ * Block names are kept once, many blocks share the same name.
+ */
+
+static size_t find_name_slot(const char *name)
+{
+	uint64_t hash = 14695981039346656037ULL; // FNV-1a
+
+	for (const char *c = name; *c != '\0'; c++)
+		hash = (hash ^ (unsigned char) *c) * 1099511628211ULL;
+
+	const size_t mask = (1UL << Names_Bits) - 1;
+
+	size_t j = hash & mask;
+
+	while (Names[j] != NULL && strcmp(Names[j], name) != 0)
+		j = (j + 1) & mask;
+
+	return j;
+}
+
+static const char *intern_name(const char *name)
+{
+	if (2 * (NNames + 1) > (1UL << Names_Bits)) { // grow & rehash
+
+		char **old = Names;
+
+		const size_t nOld = (old == NULL) ? 0 : 1UL << Names_Bits;
+
+		Names_Bits = MAX(8, Names_Bits + 1);
+
+		Names = calloc(1UL << Names_Bits, sizeof(*Names));
+
+		Assert(Names != NULL, "Can't grow name table to 2^%d", Names_Bits);
+
+		for (size_t i = 0; i < nOld; i++)
+			if (old[i] != NULL)
+				Names[find_name_slot(old[i])] = old[i];
+
+		free(old);
 	}
 
+	const size_t j = find_name_slot(name);
+
+	if (Names[j] == NULL) {
+
+		const size_t len = strlen(name) + 1;
+
+		Names[j] = malloc(len);
+
+		Assert(Names[j] != NULL, "Can't intern block name %s", name);
+
+		memcpy(Names[j], name, len);
+
+		NNames++;
+	}
+
+	return Names[j];
+}
+
+/*
+ * Print the share of the pages of block i on each NUMA node, from a sample
+ * of its pages. move_pages() without target nodes only reports where the
+ * pages are, pages that have not been touched yet count as "none".
+ */
+
+#ifdef MEMORY_NUMA
+
+static void print_numa_placement(const void *ptr, const size_t size)
+{
+#ifdef SYS_move_pages
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+
+	const size_t nPages = MIN(NUMA_PAGES_SAMPLED,
+			(size + page_size - 1) / page_size);
+
+	void *pages[NUMA_PAGES_SAMPLED] = { NULL };
+	int status[NUMA_PAGES_SAMPLED] = { 0 };
+
+	for (int j = 0; j < nPages; j++) {
+
+		uintptr_t addr = (uintptr_t) ptr + j * (size / nPages);
+
+		pages[j] = (void *) (addr - addr % page_size);
+	}
+
+	long fail = syscall(SYS_move_pages, 0, nPages, pages, NULL, status, 0);
+
+	if (fail) {
+
+		printf("   NUMA n/a");
+
+		return ;
+	}
+
+	int count[NUMA_NODES_MAX + 1] = { 0 }; // last is untouched
+
+	for (int j = 0; j < nPages; j++)
+		if (status[j] >= 0 && status[j] < NUMA_NODES_MAX)
+			count[status[j]]++;
+		else
+			count[NUMA_NODES_MAX]++;
+
+	printf("   NUMA");
+
+	for (int node = 0; node < NUMA_NODES_MAX; node++)
+		if (count[node] > 0)
+			printf(" %d:%.0f%%", node, 100.0 * count[node] / nPages);
+
+	if (count[NUMA_NODES_MAX] > 0)
+		printf(" none:%.0f%%", 100.0 * count[NUMA_NODES_MAX] / nPages);
+#endif // SYS_move_pages
+
 	return ;
 }
 
+#else
+
+static inline void print_numa_placement(const void *ptr,
+		const size_t size) {};
+
+#endif // MEMORY_NUMA
+
 /* Get system memory size in a rather portable way
  * This represents the hard upper bound, maybe leave 10% for the OS ?
  *
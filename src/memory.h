@@ -3,25 +3,53 @@
 
 #include "includes.h"
 
+/*
+ * Malloc() and Calloc() return zeroed memory, Malloc_Uninit() does not.
+ * Realloc() zeroes the new part. Free() doesn't clear the block, with
+ * DEBUG_MEMORY uninitialised and freed memory is filled with 0xFF instead.
+ * Scratch_Alloc() returns uninitialised, thread-local memory, released with
+ * Scratch_Pop() to the mark from Scratch_Push(). Reserve_Particle_Array()
+ * returns a zeroed array of Task.Npart_Total_Max elements, that grows in
+ * place with Commit_Particle_Arrays().
+ */
+
 #ifdef MEMORY_MANAGER 
 #define Malloc(x,y) Malloc_info(__FILE__, __func__,  __LINE__, x, y)
+#define Malloc_Uninit(x,y) \
+		Malloc_Uninit_info(__FILE__, __func__,  __LINE__, x, y)
+#define Calloc(n,x,y) Malloc_info(__FILE__, __func__,  __LINE__, (n)*(x), y)
 #define Realloc(x,y,z) Realloc_info(__FILE__, __func__,  __LINE__, x, y, z)
 #define Free(x) Free_info( __FILE__, __func__, __LINE__, x)
 #else
 #define Malloc(x,y) malloc(x)
+#define Malloc_Uninit(x,y) malloc(x)
+#define Calloc(n,x,y) calloc(n,x)
 #define Realloc(x,y,z) realloc(x,y)
 #define Free(x) free(x)
 #endif // MEMORY_MANAGER
 
+#define Reserve_Particle_Array(x,y) \
+		Reserve_Particle_Array_info(__FILE__, __func__, __LINE__, x, y)
+
 void *Malloc_info(const char*,const char*,const int, size_t, const char*);
+void *Malloc_Uninit_info(const char*, const char*, const int, size_t,
+		const char*);
 void *Realloc_info(const char*, const char*, const int, void *, size_t,
 		const char*);
 void Free_info(const char* file, const char* func, const int line, void*);
+void *Reserve_Particle_Array_info(const char*, const char*, const int,
+		const size_t, const char*);
+void Commit_Particle_Arrays();
+void *First_Touch(void *ptr, const size_t nBytes, const size_t elem_size,
+		const size_t nLoop);
 
 void Init_Memory_Management();
 void Print_Memory_Usage();
 void Finish_Memory_Management();
 void Get_Free_Memory(size_t *total, size_t *largest, size_t *smallest);
-void *Get_Thread_Safe_Buffer (size_t nBytes);
+
+size_t Scratch_Push();
+void *Scratch_Alloc(const size_t nBytes);
+void Scratch_Pop(const size_t mark);
 
 #endif // MEMORY_H
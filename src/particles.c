@@ -16,13 +16,16 @@ size_t sizeof_P = 0;
 const int NP_Fields = ARRAY_SIZE(P_Fields);
 
 static void find_particle_sizes();
+static void grow_particle_structures(const int*, const int);
 
 static omp_lock_t Particle_Lock; // the big bad particle lock
 
 /*
  * We loop through the particle structures with two running pointers. One 
  * points through the structure (pointers to adresses are all the same 
- * size: 64 bit), the other points through the memory allocated.
+ * size: 64 bit), the other points through the memory allocated. Every 
+ * field is a particle array in reserved address space, see memory.c, so
+ * *P grows in place in Reallocate_P().
  */
 
 void Allocate_Particle_Structures()
@@ -42,8 +45,6 @@ void Allocate_Particle_Structures()
 
 	find_particle_sizes(); 
 
-	size_t nBytes = Task.Npart_Total_Max * sizeof_P;
-
 	rprintf("\nReserving space for %llu particles per task in *P,"
 			" factor %g\n", Task.Npart_Total_Max, Param.Part_Alloc_Factor);
 
@@ -57,15 +58,13 @@ void Allocate_Particle_Structures()
 			
 		int nComp = P_Fields[i].N;
 
-		nBytes = Task.Npart_Total_Max * P_Fields[i].Bytes;
-		
 		for (int j = 0; j < nComp;  j++) {
 
 			char name[CHARBUFSIZE] = { "" }; 
 
 			sprintf(name, "P.%s[%d]", P_Fields[i].Name, j);
 
-			*run_P = Malloc(nBytes, name); // memory block
+			*run_P = Reserve_Particle_Array(P_Fields[i].Bytes, name);
 
 			run_P++; // next field in P is 8 bytes or one pointer away
 		}
@@ -116,12 +115,7 @@ void Reallocate_P_Info(const char *func, const char *file, int line,
 {
 	
 	#pragma omp single
-	for (int i = 0; i < NPARTYPE; i++)
-		Assert(Task.Npart[i] + dNpart[i] <= Task.Npart_Max[i],
-			"Too many particles type %d on this task. \n"
-			"Have %d, want %d, max %d \nCurrent Part alloc factor = %g",
-			i, Task.Npart[i], dNpart[i], Task.Npart_Max[i], 
-			Param.Part_Alloc_Factor);
+	grow_particle_structures(dNpart, Task.Npart_Total); // if needed
 
 	int offset[NPARTYPE] = { 0 }, new_npart_total = 0;
 	int new_npart[NPARTYPE] = { 0 };
@@ -213,6 +207,62 @@ void Reallocate_P_Info(const char *func, const char *file, int line,
 	return ;
 }
 
+/*
+ * Make room for dNpart more particles, if they don't fit into *P. We keep 
+ * Param.Part_Alloc_Factor as headroom above the new particle numbers. The
+ * arrays grow in place, pointers into *P stay valid. 
+ */
+
+static void grow_particle_structures(const int *dNpart,
+		const int npart_total)
+{
+	const double factor = fmax(1, Param.Part_Alloc_Factor);
+
+	uint64_t npart_max[NPARTYPE] = { 0 };
+	uint64_t new_npart_total = 0;
+
+	bool grow = false;
+
+	for (int i = 0; i < NPARTYPE; i++) {
+
+		uint64_t new_npart = MAX(0, Task.Npart[i] + dNpart[i]);
+
+		new_npart_total += new_npart;
+
+		npart_max[i] = MAX(Task.Npart_Max[i], 
+				ceil(new_npart * factor));
+
+		grow |= (new_npart > Task.Npart_Max[i]);
+	}
+
+	grow |= (new_npart_total > Task.Npart_Total_Max);
+
+	if (!grow)
+		return ;
+
+	uint64_t npart_total_max = MAX(Task.Npart_Total_Max,
+			ceil(new_npart_total * factor));
+
+	printf("(%d:%d) Growing *P from %llu to %llu particles, have %d\n", 
+			Task.Rank, Task.Thread_ID, 
+			(unsigned long long) Task.Npart_Total_Max,
+			(unsigned long long) npart_total_max, npart_total);
+
+	#pragma omp parallel // Task is threadprivate
+	{
+
+	Task.Npart_Total_Max = npart_total_max;
+
+	for (int i = 0; i < NPARTYPE; i++)
+		Task.Npart_Max[i] = npart_max[i];
+
+	} // omp parallel
+
+	Commit_Particle_Arrays();
+
+	return ;
+}
+
 /*
  * Returns a pointer to particle "ipart", field "field", component "comp".
  * This lets us move particles in an automated way.
@@ -19,7 +19,7 @@ extern struct Particle_Data {
 	int * restrict Time_Bin;
 	intime_t * restrict It_Drift_Pos;	// drift position on integer timeline
 	intime_t * restrict It_Kick_Pos;	// kick position on integer timeline
-	peanoKey * restrict Key;			// Reversed peano key
+	particleKey * restrict Key;			// Reversed peano key
 	ID_t * restrict ID; 					 
 	Float * restrict Cost;				// computational weight of particle
 	Float * restrict Pos[3];
@@ -34,6 +34,17 @@ extern struct Particle_Data {
 #ifdef GRAVITY_TREE
 	int * restrict Tree_Parent;			// Tree node leave, negative-1 if
 #endif									// top node only
+#ifdef HERMITE
+	Float * restrict Jerk[3];			// time derivative of Acc
+	Float * restrict Acc_Old[3];		// Acc & Jerk at beginning of step
+	Float * restrict Jerk_Old[3];
+#endif
+#ifdef HOLD
+	Float * restrict Pair_Acc;			// largest acc. of pair partners
+#endif
+#ifdef ADAPTIVE_SOFTENING
+	Float * restrict Softening;			// K1 scale from leaf density
+#endif
 } P;
 
 
@@ -63,7 +74,7 @@ const static struct Field_Def P_Fields[] = {
 	,{"Time_Bin", 		sizeof(int),		1}
 	,{"It_Drift_Pos",	sizeof(intime_t),	1}
 	,{"It_Kick_Pos",	sizeof(intime_t),	1}
-	,{"Key",			sizeof(peanoKey),	1} 
+	,{"Key",			sizeof(particleKey),	1} 
 	,{"ID", 		 	sizeof(ID_t),		1}
 	,{"Cost",			sizeof(Float),		1}
 	,{"Pos", 			sizeof(Float),		3}
@@ -77,6 +88,17 @@ const static struct Field_Def P_Fields[] = {
 #ifdef GRAVITY_TREE
 	,{"Tree_Parent",	sizeof(Float),		1}
 	,{"Last_Acc_Mag",	sizeof(Float),		1}
+#endif
+#ifdef HERMITE
+	,{"Jerk",			sizeof(Float),		3}
+	,{"Acc_Old",		sizeof(Float),		3}
+	,{"Jerk_Old",		sizeof(Float),		3}
+#endif
+#ifdef HOLD
+	,{"Pair_Acc",		sizeof(Float),		1}
+#endif
+#ifdef ADAPTIVE_SOFTENING
+	,{"Softening",		sizeof(Float),		1}
 #endif
 	// Add yours here !
 };
@@ -1,46 +1,114 @@
 #include "peano.h"
 
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
 static void reorder_collisionless_particles(const size_t *idx_in);
+static void find_displaced_particles();
+static void fix_chunk_borders(const int nChunks);
+static void merge_displaced_particles();
 
+#define MAX_DISPLACED 0.05 // fraction of particles, else full sort
+#define MAX_DISPLACED_RUN 16 // longest run of particles to take off the stack
+
+/*
+ * With SHORT_PEANO_KEYS particles closer than 21 levels share a key. Their
+ * order on the curve comes from the full key, computed only for these ties.
+ */
 
 int cmp_peanoKeys(const void * a, const void *b)
 {
-	const peanoKey *x = (const peanoKey *) a;
-	const peanoKey *y = (const peanoKey *) b;
+	const particleKey *x = (const particleKey *) a;
+	const particleKey *y = (const particleKey *) b;
+
+#ifdef SHORT_PEANO_KEYS
+	if ((*x == *y) && (x != y)) { // pivot compares to itself
+
+		const int i = x - P.Key;
+		const int j = y - P.Key;
+
+		peanoKey key_i = Peano_Key(P.Pos[0][i], P.Pos[1][i], P.Pos[2][i]);
+		peanoKey key_j = Peano_Key(P.Pos[0][j], P.Pos[1][j], P.Pos[2][j]);
+
+		return (int) (key_i > key_j) - (key_i < key_j);
+	}
+#endif // SHORT_PEANO_KEYS
 
 	return (int) (*x > *y) - (*x < *y);
 }
 
+static inline int cmp_keys(const size_t i, const size_t j)
+{
+	return cmp_peanoKeys(&P.Key[i], &P.Key[j]);
+}
+
+static int cmp_key_index(const void *a, const void *b)
+{
+	return cmp_keys(*((const size_t *) a), *((const size_t *) b));
+}
+
 /* 
- * Here we compute peano Keys and reorder particles
+ * Here we compute peano Keys and reorder particles. Between decompositions
+ * particles move little along the curve, so we usually take the few 
+ * displaced particles out of the ordered bulk, sort them and merge them back
+ * in O(N). Only if more than MAX_DISPLACED are displaced, e.g. after the 
+ * domain changed, we sort everything. 
  */
 
 static size_t *idx = NULL;
+static size_t *Buf = NULL; // per chunk: bulk from the front, displaced back
+static size_t *Out = NULL; // displaced particles
+static size_t NOut = 0;
+static int *NBulk = NULL, *NSkip = NULL; // of Buf, per chunk
+static size_t *Bulk_Offset = NULL, *Out_Offset = NULL;
+
+static inline size_t chunk_begin(const int i, const int nChunks)
+{
+	return ((size_t) Task.Npart_Total * i) / nChunks;
+}
 
 void Sort_Particles_By_Peano_Key()
 {
 	Profile("Peano-Hilbert order");
 	
 	#pragma omp single
-	idx = Malloc(Task.Npart_Total_Max * sizeof(*idx), "Sort Idx");
+	idx = Malloc_Uninit(Task.Npart_Total_Max * sizeof(*idx), "Sort Idx");
 
 	#pragma omp for
-	for (int ipart = 0; ipart < Task.Npart_Total; ipart++) 
-		P.Key[ipart] = Peano_Key(P.Pos[0][ipart], P.Pos[1][ipart], 
-								 P.Pos[2][ipart]);
+	for (int ipart = 0; ipart < Task.Npart_Total; ipart += KEY_BLOCK) 
+		Peano_Keys(ipart, imin(KEY_BLOCK, Task.Npart_Total - ipart), 
+				   &P.Key[ipart]);
+
+	find_displaced_particles();
 
-	Qsort_Index(idx, P.Key, Task.Npart_Total, sizeof(*P.Key),
-				&cmp_peanoKeys);
+	if (NOut > MAX_DISPLACED * Task.Npart_Total) {
 
-	reorder_collisionless_particles(idx);
+		Qsort_Index(idx, P.Key, Task.Npart_Total, sizeof(*P.Key),
+					&cmp_peanoKeys);
+
+		reorder_collisionless_particles(idx);
+
+	} else if (NOut > 0) {
+
+		merge_displaced_particles();
+
+		reorder_collisionless_particles(idx);
+	}
 
 	//reorder_gas_particles(idx);
 
 	#pragma omp single
- 	Free(idx);
+	{
+
+	Free(Out_Offset); Free(Bulk_Offset); Free(NSkip); Free(NBulk);
+	Free(Buf); Free(idx);
+
+	} // omp single
 	
 	Make_Active_Particle_List();
-	//Make_Active_Particle_Vectors();
+	
+	Make_Active_Particle_Vectors();
 
 	Profile("Peano-Hilbert order");
 
@@ -49,15 +117,11 @@ void Sort_Particles_By_Peano_Key()
 
 static void reorder_collisionless_particles(const size_t *idx_in)
 {	
-	size_t *idx = NULL;
-	size_t nBytes = Task.Npart_Total * sizeof(*idx);
+	size_t nBytes = Task.Npart_Total * sizeof(size_t);
 
-	#pragma omp single
-	Assert(Task.Buffer_Size > nBytes, 
-			"BufferSize >= %g MB for %d ranks and %d threads", 
-			NThreads * nBytes/1024.0/1024.0, NThreads);
+	const size_t mark = Scratch_Push();
 
-	idx = Get_Thread_Safe_Buffer(nBytes);
+	size_t *idx = Scratch_Alloc(nBytes);
 
 	#pragma omp for 
 	for (int i = 0; i < NP_Fields; i++) { // burn the memory bus
@@ -78,26 +142,568 @@ static void reorder_collisionless_particles(const size_t *idx_in)
 		} // for j
 	} // for i
 
+	Scratch_Pop(mark);
+
+	return ;
+}
+
+/*
+ * Every thread walks its chunk and keeps the ordered bulk on a stack in Buf.
+ * A particle smaller than the top of the stack is displaced. If the next 
+ * particle is also smaller than the top, the top run was displaced instead, 
+ * e.g. a clump that moved forward on the curve. 
+ */
+
+static void find_displaced_particles()
+{
+	const int nChunks = omp_get_num_threads();
+
+	#pragma omp single
+	{
+
+	Buf = Malloc_Uninit(Task.Npart_Total_Max * sizeof(*Buf), "Sort Buf");
+	NBulk = Malloc(nChunks * sizeof(*NBulk), "Sort NBulk");
+	NSkip = Malloc(nChunks * sizeof(*NSkip), "Sort NSkip");
+	Bulk_Offset = Malloc(nChunks * sizeof(*Bulk_Offset), "Sort Bulk_Offset");
+	Out_Offset = Malloc(nChunks * sizeof(*Out_Offset), "Sort Out_Offset");
+
+	} // omp single
+
+	const int chunk = omp_get_thread_num();
+
+	const size_t beg = chunk_begin(chunk, nChunks);
+	const size_t end = chunk_begin(chunk + 1, nChunks);
+
+	size_t * restrict bulk = &Buf[beg];
+	size_t * restrict out = &Buf[end]; // grows down
+
+	int nBulk = 0, nOut = 0;
+
+	for (size_t i = beg; i < end; i++) {
+
+		if (nBulk == 0 || cmp_keys(i, bulk[nBulk-1]) >= 0) { // in order
+
+			bulk[nBulk++] = i;
+
+			continue;
+		}
+
+		int n = 1; // run on the stack larger than i
+
+		while (n < nBulk && n <= MAX_DISPLACED_RUN 
+				&& cmp_keys(i, bulk[nBulk-1-n]) < 0)
+			n++;
+
+		if (n <= MAX_DISPLACED_RUN && i+1 < end 
+				&& cmp_keys(i+1, bulk[nBulk-1]) < 0) { // run displaced
+
+			for (int j = 0; j < n; j++)
+				out[-(++nOut)] = bulk[--nBulk];
+
+			bulk[nBulk++] = i;
+
+		} else { // i displaced
+
+			out[-(++nOut)] = i;
+		}
+	}
+
+	NBulk[chunk] = nBulk;
+	NSkip[chunk] = 0;
+
+	#pragma omp barrier
+
+	#pragma omp single
+	fix_chunk_borders(nChunks);
+
+	return ;
+}
+
+/*
+ * The bulk of a chunk has to start above the bulk of the chunks before. 
+ * Either we take off its first particles or the top run of the last chunk,
+ * as above. Then we get the offsets for the merge.
+ */
+
+static void fix_chunk_borders(const int nChunks)
+{
+	int last = -1; // chunk with the largest bulk particle so far
+
+	for (int i = 0; i < nChunks; i++) {
+
+		const size_t beg = chunk_begin(i, nChunks);
+
+		while (last >= 0 && NSkip[i] < NBulk[i]) {
+
+			const size_t first = Buf[beg + NSkip[i]];
+
+			const size_t *bulk = &Buf[chunk_begin(last, nChunks)];
+			const int nBulk = NBulk[last] - NSkip[last];
+			const size_t top = bulk[NBulk[last] - 1];
+
+			if (cmp_keys(first, top) >= 0)
+				break;
+
+			int n = 1;
+
+			while (n < nBulk && n <= MAX_DISPLACED_RUN
+					&& cmp_keys(first, bulk[NBulk[last]-1-n]) < 0)
+				n++;
+
+			if (n <= MAX_DISPLACED_RUN && n < nBulk 
+					&& NSkip[i] + 1 < NBulk[i] 
+					&& cmp_keys(Buf[beg + NSkip[i] + 1], top) < 0)
+				NBulk[last] -= n; // top run displaced
+			else
+				NSkip[i]++; // first displaced
+		}
+
+		if (NSkip[i] < NBulk[i])
+			last = i;
+	}
+
+	size_t nBulk = 0;
+
+	NOut = 0;
+
+	for (int i = 0; i < nChunks; i++) {
+
+		const size_t len = chunk_begin(i+1, nChunks) - chunk_begin(i, nChunks);
+
+		Bulk_Offset[i] = nBulk;
+		Out_Offset[i] = NOut;
+
+		nBulk += NBulk[i] - NSkip[i];
+		NOut += len - (NBulk[i] - NSkip[i]);
+	}
+
+	return ;
+}
+
+/*
+ * Sort the displaced particles and merge them into the bulk. Every thread 
+ * merges its bulk with the displaced particles between its first bulk 
+ * particle and the first bulk particle of the next chunk.
+ */
+
+static size_t lower_bound(const size_t *a, const size_t n, const size_t ipart)
+{
+	size_t lo = 0, hi = n;
+
+	while (lo < hi) {
+
+		size_t mid = lo + (hi - lo)/2;
+
+		if (cmp_keys(a[mid], ipart) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void merge_displaced_particles()
+{
+	const int nChunks = omp_get_num_threads();
+	const int chunk = omp_get_thread_num();
+
+	#pragma omp single
+	Out = Malloc_Uninit(NOut * sizeof(*Out), "Sort Out");
+
+	const size_t beg = chunk_begin(chunk, nChunks);
+	const size_t end = chunk_begin(chunk + 1, nChunks);
+
+	size_t nSkip = NSkip[chunk], nBulk = NBulk[chunk];
+
+	memcpy(&Out[Out_Offset[chunk]], &Buf[beg], nSkip * sizeof(*Out));
+	memcpy(&Out[Out_Offset[chunk] + nSkip], &Buf[beg + nBulk], 
+			(end - beg - nBulk) * sizeof(*Out));
+
+	#pragma omp barrier
+
+	Qsort(Out, NOut, sizeof(*Out), &cmp_key_index);
+
+	if (nSkip < nBulk) {
+
+		const size_t *bulk = &Buf[beg + nSkip];
+		const size_t nB = nBulk - nSkip;
+
+		int next = chunk + 1; // next chunk with bulk
+
+		while (next < nChunks && NSkip[next] == NBulk[next])
+			next++;
+
+		size_t o = 0, o_end = NOut;
+
+		if (Bulk_Offset[chunk] > 0)
+			o = lower_bound(Out, NOut, bulk[0]);
+
+		if (next < nChunks)
+			o_end = lower_bound(Out, NOut, 
+					Buf[chunk_begin(next, nChunks) + NSkip[next]]);
+
+		size_t dest = Bulk_Offset[chunk] + o;
+
+		for (size_t b = 0; b < nB; ) {
+
+			if (o < o_end && cmp_keys(Out[o], bulk[b]) < 0)
+				idx[dest++] = Out[o++];
+			else
+				idx[dest++] = bulk[b++];
+		}
+
+		while (o < o_end)
+			idx[dest++] = Out[o++];
+	}
+
+	#pragma omp barrier
+
+	#pragma omp single
+	Free(Out);
+
 	return ;
 }
 
 void Reverse_Peano_Keys()
 {
 	#pragma omp for
-	for (int ipart = 0; ipart < Task.Npart_Total; ipart++) {
+	for (int ipart = 0; ipart < Task.Npart_Total; ipart += KEY_BLOCK) 
+		Reversed_Peano_Keys(ipart, imin(KEY_BLOCK, Task.Npart_Total - ipart),
+							&P.Key[ipart]);
+
+	return;
+}
+
+/*
+ * Fast key engine. The inverse undo of the Skilling transform below acts on
+ * all lower bits with an inversion or exchange of the axes, depending on the
+ * bits of the current level. The Gray code adds the parity of the levels
+ * above. Hence the Peano-Hilbert curve is a state machine on the octants of
+ * the levels, with a signed permutation of the axes and a parity as state.
+ * We tabulate it for KEY_LEVELS levels per lookup from the transform itself,
+ * and feed it the Morton order of the integer coordinates, interleaved with
+ * PDEP where the CPU has BMI2. Test_Peanokey() checks the result against
+ * the transform.
+ */
+
+#define KEY_LEVELS 3 // per table lookup
+#define KEY_GROUP_BITS (3*KEY_LEVELS)
+#define N_KEY_GROUPS (N_PEANO_TRIPLETS/KEY_LEVELS)
+#define N_MORTON_LEVELS 21 // per 64 bit word
+#define MAX_KEY_STATES 96 // 48 signed permutations times parity
+
+struct Key_State {
+	int Perm[3];	// axis of the input bit
+	int Inv[3];		// inversion of the input bit
+	int Parity;		// of the Gray code above
+};
+
+static uint32_t Key_Table[MAX_KEY_STATES][1 << KEY_GROUP_BITS];
+static int NKey_States = 0;
+
+static void key_level(struct Key_State *s, const int octant, int *digit)
+{
+	int r[3] = { (octant >> 2) & 0x1, (octant >> 1) & 0x1, octant & 0x1 };
+	int v[3] = { 0 };
+
+	for (int i = 0; i < 3; i++)
+		v[i] = r[s->Perm[i]] ^ s->Inv[i];
+
+	if (v[0])
+		s->Inv[0] ^= 1; // invert
+
+	for (int i = 1; i < 3; i++) {
 
-		Float px = P.Pos[0][ipart];
-		Float py = P.Pos[1][ipart];
-		Float pz = P.Pos[2][ipart];
-		
-		P.Key[ipart] = Reversed_Peano_Key(px, py, pz); 
+		if (v[i]) {
+
+			s->Inv[0] ^= 1; // invert
+
+		} else {
+
+			int t = s->Perm[0]; s->Perm[0] = s->Perm[i]; s->Perm[i] = t;
+			t = s->Inv[0]; s->Inv[0] = s->Inv[i]; s->Inv[i] = t;
+
+		} // exchange
 	}
 
-	return;
+	const int g0 = v[0];	// Gray encode
+	const int g1 = v[0] ^ v[1];
+	const int g2 = g1 ^ v[2];
+
+	*digit = ((g0 ^ s->Parity) << 2) | ((g1 ^ s->Parity) << 1) 
+			| (g2 ^ s->Parity);
+
+	s->Parity ^= g2;
+
+	return ;
 }
 
+static int find_key_state(struct Key_State *state, const struct Key_State s)
+{
+	for (int i = 0; i < NKey_States; i++)
+		if (memcmp(&state[i], &s, sizeof(s)) == 0)
+			return i;
+
+	Assert(NKey_States < MAX_KEY_STATES, "Too many Peano states %d", 
+			NKey_States);
+
+	state[NKey_States] = s;
+
+	return NKey_States++;
+}
+
+/*
+ * A table entry holds the standard and reversed digits of KEY_LEVELS levels
+ * and the next state. State 0 follows level 0, which is always octant 0.
+ */
+
+void Setup_Peano_Keys()
+{
+	struct Key_State state[MAX_KEY_STATES] = { 0 };
+
+	state[0] = (struct Key_State) { {0, 1, 2}, {0, 0, 0}, 0 };
+
+	int digit = 0;
+
+	key_level(&state[0], 0, &digit);
+
+	NKey_States = 1;
+
+	for (int i = 0; i < NKey_States; i++) { // breadth first
+
+		for (int in = 0; in < (1 << KEY_GROUP_BITS); in++) {
+
+			struct Key_State s = state[i];
+
+			uint32_t std = 0, rev = 0;
+
+			for (int lvl = 0; lvl < KEY_LEVELS; lvl++) {
+
+				int octant = (in >> (3 * (KEY_LEVELS - 1 - lvl))) & 0x7;
+
+				key_level(&s, octant, &digit);
+
+				std = (std << 3) | digit;
+				rev |= digit << (3 * lvl);
+			}
+
+			uint32_t next = find_key_state(state, s);
+
+			Key_Table[i][in] = std | (rev << KEY_GROUP_BITS) 
+								   | (next << (2*KEY_GROUP_BITS));
+		}
+	}
+
+	return ;
+}
+
+static inline void key_coordinates(const Float px, const Float py, 
+		const Float pz, uint64_t X[3])
+{
+	const double fac = (((uint64_t) 1) << 63) / Domain.Size;
+
+	X[0] = (px - Domain.Origin[0]) * fac;
+	X[1] = (py - Domain.Origin[1]) * fac;
+	X[2] = (pz - Domain.Origin[2]) * fac;
+
+	return ;
+}
+
+#ifndef __BMI2__
+static inline uint64_t split_by_3(uint64_t x)
+{
+	x = (x | x << 32) & 0x001F00000000FFFF;
+	x = (x | x << 16) & 0x001F0000FF0000FF;
+	x = (x | x << 8)  & 0x100F00F00F00F00F;
+	x = (x | x << 4)  & 0x10C30C30C30C30C3;
+	x = (x | x << 2)  & 0x1249249249249249;
+
+	return x;
+}
+#endif // ! __BMI2__
+
+/*
+ * Morton triplets of the 21 levels below bit 'shift' + 21, x is the most 
+ * significant bit of a triplet.
+ */
+
+static inline uint64_t morton_key(const uint64_t X[3], const int shift)
+{
+	const uint64_t mask = (((uint64_t) 1) << N_MORTON_LEVELS) - 1;
+
+#ifdef __BMI2__
+	return _pdep_u64((X[0] >> shift) & mask, 0x4924924924924924)
+		 | _pdep_u64((X[1] >> shift) & mask, 0x2492492492492492)
+		 | _pdep_u64((X[2] >> shift) & mask, 0x1249249249249249);
+#else
+	return (split_by_3((X[0] >> shift) & mask) << 2)
+		 | (split_by_3((X[1] >> shift) & mask) << 1)
+		 |  split_by_3((X[2] >> shift) & mask);
+#endif
+}
+
+/*
+ * Digits of the levels 1 to KEY_LEVELS*nGroups. The standard key has level 
+ * 1 most significant, the reversed key has level l at bit 3*l.
+ */
+
+static inline peanoKey hilbert_key(const uint64_t X[3], const int nGroups,
+		const bool reversed)
+{
+	const int nPerWord = N_MORTON_LEVELS / KEY_LEVELS;
+
+	const uint64_t morton[2] = { morton_key(X, 63 - N_MORTON_LEVELS),
+		nGroups > nPerWord ? morton_key(X, 63 - 2*N_MORTON_LEVELS) : 0 };
+
+	const uint32_t mask = (1 << KEY_GROUP_BITS) - 1;
+
+	peanoKey key = 0;
+
+	int state = 0;
+
+	for (int i = 0; i < nGroups; i++) {
+
+		int shift = KEY_GROUP_BITS * (nPerWord - 1 - i % nPerWord);
+		int in = (morton[i / nPerWord] >> shift) & mask;
+
+		uint32_t entry = Key_Table[state][in];
+
+		if (reversed)
+			key |= ((peanoKey) ((entry >> KEY_GROUP_BITS) & mask))
+					<< (KEY_GROUP_BITS * i + 3);
+		else
+			key = (key << KEY_GROUP_BITS) | (entry & mask);
+
+		state = entry >> (2*KEY_GROUP_BITS);
+	}
+
+	return key;
+}
 
 /* 
+ * Construct a 128 bit Peano-Hilbert distance in 3D, input coordinates 
+ * have to be normalized as 0 <= x < 1. Bits 0 & 1 are unused, the most 
+ * significant bit is 127. To be consistent without loss of accuracy all std 
+ * keys start with the first triplet at level 1. The reversed keys carry the
+ * zero triplet explicitely, to ease tree construction, the most significant
+ * bits are undefined. The order in the triplets is the same.
+ */
+
+peanoKey Peano_Key(const Float px, const Float py, const Float pz)
+{
+	uint64_t X[3] = { 0 };
+
+	key_coordinates(px, py, pz, X);
+
+	return hilbert_key(X, N_KEY_GROUPS, false) << 2;
+}
+
+peanoKey Reversed_Peano_Key(const Float px, const Float py, const Float pz)
+{
+	uint64_t X[3] = { 0 };
+
+	key_coordinates(px, py, pz, X);
+
+	return hilbert_key(X, N_KEY_GROUPS, true);
+}
+
+/* 
+ * Keys of 64 bit length (21 triplets), standard and reversed. The standard
+ * key takes the top bit of level 22, the reversed key holds levels 0 to 20.
+ */
+
+shortKey Short_Peano_Key(const Float px, const Float py, const Float pz)
+{
+	uint64_t X[3] = { 0 };
+
+	key_coordinates(px, py, pz, X);
+
+	const int nGroups = N_SHORT_TRIPLETS/KEY_LEVELS + 1; 
+
+	return hilbert_key(X, nGroups, false) 
+				>> (KEY_GROUP_BITS*nGroups - N_SHORT_BITS);
+}
+
+shortKey Reversed_Short_Peano_Key(const Float px, const Float py, 
+		const Float pz)
+{
+	uint64_t X[3] = { 0 };
+
+	key_coordinates(px, py, pz, X);
+
+	return hilbert_key(X, N_SHORT_TRIPLETS/KEY_LEVELS, true) 
+				& 0x7FFFFFFFFFFFFFFF;
+}
+
+/*
+ * Batch API, keys of the particles first to first+n as stored in P.Key. The 
+ * conversion to integer coordinates runs as simd loop over blocks.
+ */
+
+static void particle_keys(const int first, const int n, const bool reversed,
+		particleKey * restrict key)
+{
+	const double fac = (((uint64_t) 1) << 63) / Domain.Size;
+
+	uint64_t X[3][KEY_BLOCK];
+
+	for (int i = 0; i < n; i += KEY_BLOCK) {
+
+		const int nBlock = imin(KEY_BLOCK, n - i);
+
+		for (int j = 0; j < 3; j++) {
+
+			const Float * restrict pos = &P.Pos[j][first + i];
+			const double origin = Domain.Origin[j];
+
+			#pragma omp simd
+			for (int k = 0; k < nBlock; k++)
+				X[j][k] = (pos[k] - origin) * fac;
+		}
+
+		for (int k = 0; k < nBlock; k++) {
+
+			const uint64_t x[3] = { X[0][k], X[1][k], X[2][k] };
+
+#ifdef SHORT_PEANO_KEYS
+			const int nGroups = N_SHORT_TRIPLETS/KEY_LEVELS + 1;
+
+			if (reversed)
+				key[i+k] = hilbert_key(x, nGroups - 1, true) 
+							& 0x7FFFFFFFFFFFFFFF;
+			else
+				key[i+k] = hilbert_key(x, nGroups, false) 
+							>> (KEY_GROUP_BITS*nGroups - N_SHORT_BITS);
+#else
+			if (reversed)
+				key[i+k] = hilbert_key(x, N_KEY_GROUPS, true);
+			else
+				key[i+k] = hilbert_key(x, N_KEY_GROUPS, false) << 2;
+#endif // ! SHORT_PEANO_KEYS
+		}
+	}
+
+	return ;
+}
+
+void Peano_Keys(const int first, const int n, particleKey * restrict key)
+{
+	particle_keys(first, n, false, key);
+
+	return ;
+}
+
+void Reversed_Peano_Keys(const int first, const int n, 
+		particleKey * restrict key)
+{
+	particle_keys(first, n, true, key);
+
+	return ;
+}
+
+/* 
+ * Reference implementation of the keys, used in Test_Peanokey() only.
  * Construct a 128 bit Peano-Hilbert distance in 3D, input coordinates 
  * have to be normalized as 0 <= x < 1. Unfortunately it's not clear if 
  * a 128bit type would be portable, though all modern CPUs have 128 bit 
@@ -119,7 +725,8 @@ void Reverse_Peano_Keys()
  * Campbell+03 'Dynamic Octree Load Balancing Using Space-Filling Curves' 
  */
 
-peanoKey Peano_Key(const Float px, const Float py, const Float pz)
+static peanoKey peano_key_skilling(const Float px, const Float py, 
+		const Float pz)
 {
 	const uint64_t m = ((uint64_t) 1) << 63;
 
@@ -200,7 +807,8 @@ peanoKey Peano_Key(const Float px, const Float py, const Float pz)
  * to ease tree construction. The most significant (left) bits are undefined.
  */
 
-peanoKey Reversed_Peano_Key(const Float px, const Float py, const Float pz)
+static peanoKey reversed_peano_key_skilling(const Float px, const Float py,
+		const Float pz)
 {
 	const uint64_t m = ((uint64_t) 1) << 63;
 
@@ -295,23 +903,11 @@ peanoKey Reverse_Peano_Key(peanoKey pkey) // buggy
 	return key;
 }
 
-/* 
- * Keys of 64 bit length (21 triplets), standard and reversed
+/*
+ * Print keys on a grid in the unit domain, then compare the engine with the 
+ * Skilling transform at random positions.
  */
 
-shortKey Short_Peano_Key(const Float px, const Float py, const Float pz)
-{
-	return (shortKey) (Peano_Key(px, py, pz) >> DELTA_PEANO_BITS);
-}
-
-
-shortKey Reversed_Short_Peano_Key(const Float px, const Float py, 
-		const Float pz)
-{													    
-	return (shortKey) (Reversed_Peano_Key(px, py, pz) & 0x00000000FFFFFFFF);
-
-}
-
 void Test_Peanokey()
 {
 	const double box[3]  = { 1, 1, 1};
@@ -320,6 +916,11 @@ void Test_Peanokey()
 	double delta = 1/pow(2.0, order);
 	int n = roundf(1/delta);
 
+	Domain.Size = 1;
+	Domain.Origin[0] = Domain.Origin[1] = Domain.Origin[2] = 0;
+
+	Setup_Peano_Keys();
+
 	a[0] = 0.9999999999; // test one value first
 	a[1] = 0.9999999999;
 	a[2] = 0.9999999999;
@@ -361,6 +962,32 @@ void Test_Peanokey()
 		printf("\n");
 	}
 
+	unsigned short seed[3] = { 1, 2, 3 };
+
+	const int nBits = (sizeof(Float) == 4) ? 24 : 53; // mantissa
+
+	for (int i = 0; i < 1000000; i++) {
+
+		for (int j = 0; j < 3; j++) // exact in Float
+			a[j] = ldexp(floor(ldexp(erand48(seed), nBits)), -nBits);
+
+		peanoKey stdkey = peano_key_skilling(a[0], a[1], a[2]);
+		peanoKey revkey = reversed_peano_key_skilling(a[0], a[1], a[2]);
+
+		Assert(Peano_Key(a[0], a[1], a[2]) == stdkey, 
+				"Std key wrong at %g %g %g", a[0], a[1], a[2]);
+		Assert(Reversed_Peano_Key(a[0], a[1], a[2]) == revkey, 
+				"Reversed key wrong at %g %g %g", a[0], a[1], a[2]);
+		Assert(Short_Peano_Key(a[0], a[1], a[2]) 
+				== (shortKey) (stdkey >> DELTA_PEANO_BITS),
+				"Short key wrong at %g %g %g", a[0], a[1], a[2]);
+		Assert(Reversed_Short_Peano_Key(a[0], a[1], a[2]) 
+				== (shortKey) (revkey & 0x7FFFFFFFFFFFFFFF),
+				"Reversed short key wrong at %g %g %g", a[0], a[1], a[2]);
+	}
+
+	printf("Peano keys agree with the Skilling transform \n");
+
 	exit(0);
 
 	return ;
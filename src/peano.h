@@ -11,9 +11,20 @@
 
 #define DELTA_PEANO_BITS (N_PEANO_BITS - N_SHORT_BITS) 
 
+#define N_PART_KEY_BITS (sizeof(particleKey)*CHAR_BIT)
+#define N_PART_KEY_TRIPLETS (N_PART_KEY_BITS/3) // levels resolved by P.Key
+#define DELTA_PART_KEY_BITS (N_PART_KEY_BITS - N_SHORT_BITS)
+
+#define KEY_BLOCK 256 // particles per batch of keys
+
+void Setup_Peano_Keys();
 void Sort_Particles_By_Peano_Key();
 void Reverse_Peano_Keys();
 
+void Peano_Keys(const int first, const int n, particleKey * restrict key);
+void Reversed_Peano_Keys(const int first, const int n, 
+		particleKey * restrict key);
+
 peanoKey Peano_Key(const Float px, const Float py,const Float pz);
 peanoKey Reversed_Peano_Key(const Float px, const Float py,const Float pz);
 peanoKey Reverse_Peano_Key(const peanoKey pkey);
@@ -26,4 +37,18 @@ shortKey Peano2Short_Key(const peanoKey pkey);
 
 void Test_Peanokey();
 
+/*
+ * The reversed key of particle ipart resolving level lvl. With 
+ * SHORT_PEANO_KEYS P.Key holds 21 levels, deeper ones are recomputed. A macro,
+ * because P is not declared yet in all includes of this file.
+ */
+
+#ifdef SHORT_PEANO_KEYS
+#define REVERSED_PART_KEY(ipart, lvl) ((lvl) < N_PART_KEY_TRIPLETS ? \
+		(peanoKey) P.Key[ipart] : \
+		Reversed_Peano_Key(P.Pos[0][ipart], P.Pos[1][ipart], P.Pos[2][ipart]))
+#else
+#define REVERSED_PART_KEY(ipart, lvl) ((peanoKey) P.Key[ipart])
+#endif // SHORT_PEANO_KEYS
+
 #endif // PEANO_H
@@ -30,26 +30,8 @@ void Init_Periodic()
 void Periodic_Constrain_Particles_To_Box()
 {
 	#pragma omp for 
-	for (int ipart = 0; ipart < Task.Npart_Total; ipart++) {
-
-		while (P.Pos[0][ipart] < 0)
-			P.Pos[0][ipart] += Sim.Boxsize[0];
-
-		while (P.Pos[0][ipart] >= Sim.Boxsize[0])
-			P.Pos[0][ipart] -= Sim.Boxsize[0];
-
-		while (P.Pos[1][ipart] < 0)
-			P.Pos[1][ipart] += Sim.Boxsize[1];
-
-		while (P.Pos[1][ipart] >= Sim.Boxsize[1])
-			P.Pos[1][ipart] -= Sim.Boxsize[1];
-
-		while (P.Pos[2][ipart] < 0)
-			P.Pos[2][ipart] += Sim.Boxsize[2];
-
-		while (P.Pos[2][ipart] >= Sim.Boxsize[2])
-			P.Pos[2][ipart] -= Sim.Boxsize[2];
-	} // for i
+	for (int ipart = 0; ipart < Task.Npart_Total; ipart++)
+		Periodic_Constrain_Particle_To_Box(ipart);
 
 	return ;
 }
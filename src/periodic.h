@@ -9,9 +9,28 @@ void Periodic_Constrain_Particles_To_Box();
 void Periodic_Nearest(Float dr[3]);
 void Init_Periodic();
 
+/*
+ * Map particle ipart back into the box, used inside the drift loops.
+ */
+
+static inline void Periodic_Constrain_Particle_To_Box(const int ipart)
+{
+	for (int i = 0; i < 3; i++) {
+
+		while (P.Pos[i][ipart] < 0)
+			P.Pos[i][ipart] += Sim.Boxsize[i];
+
+		while (P.Pos[i][ipart] >= Sim.Boxsize[i])
+			P.Pos[i][ipart] -= Sim.Boxsize[i];
+	}
+
+	return ;
+}
+
 #else // PERIODIC
 
 static inline void Periodic_Constrain_Particles_To_Box() {};
+static inline void Periodic_Constrain_Particle_To_Box(const int ipart) {};
 static inline void Periodic_Nearest(Float dr[3]) {};
 static inline void Init_Periodic() {};
 
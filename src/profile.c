@@ -215,6 +215,19 @@ void Profile_Report_Last(FILE *stream)
 	return ;
 }
 
+/*
+ * Wall time of the last completed measurement of section "name"
+ */
+
+double Profile_Last(const char *name)
+{
+	const int i = find_index_from_name(name);
+
+	Assert(i < NProfObjs, "Profiling section '%s' not found", name);
+
+	return Prof[i].ThisLast;
+}
+
 double Runtime()
 {
 	double now = measure_time();
@@ -10,6 +10,7 @@ void Profile_Info(const char* file, const char* func, const int line,
 		const char *name);
 void Profile_Report(FILE *);
 void Profile_Report_Last(FILE *);
+double Profile_Last(const char *name);
 void Write_Logs();
 double Runtime();
 
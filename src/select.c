@@ -118,7 +118,9 @@ Float Median(const int ndata, Float * restrict data)
 	#pragma omp single
 	Results = Malloc(nPart * sizeof(*Results), "Results");
 
-	Float *buf = Get_Thread_Safe_Buffer(nBytes);
+	const size_t mark = Scratch_Push();
+
+	Float *buf = Scratch_Alloc(nBytes + sizeof(*data) * nPart); // last one
 
 	#pragma omp for schedule(dynamic)
 	for (int i = 0; i < nPart; i++) {
@@ -138,6 +140,8 @@ Float Median(const int ndata, Float * restrict data)
 
 	}
 
+	Scratch_Pop(mark);
+
 
 	Float median = 0;
 
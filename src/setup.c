@@ -16,10 +16,16 @@ void Setup()
 
 	Setup_Leaf_Vectors();
 
+	Setup_Peano_Keys();
+
 	Setup_Domain_Decomposition();
 	
 	Setup_Gravity_Tree(); // GRAVITY_TREE
 
+	Setup_Map(); // MAP
+
+	Setup_Lightcone(); // LIGHTCONE
+
 	Compute_Current_Simulation_Properties(); // <- Add your setups above
 
 	sanity_check_simulation_setup();
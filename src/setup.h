@@ -6,6 +6,8 @@
 #include "domain.h"
 #include "Gravity/tree.h"
 #include "properties.h"
+#include "Map/map.h"
+#include "lightcone.h"
 
 void Setup();
 
@@ -1,4 +1,5 @@
 #include "timestep.h"
+#include "Gravity/tree.h"
 
 /* 
  * The number of bins is given by the number of bits in an integer time 
@@ -6,11 +7,16 @@
 
 #define N_INT_BINS (sizeof(intime_t) * CHAR_BIT)
 #define COUNT_TRAILING_ZEROS(x) __builtin_ctzll(x)
+#define ACTIVE_VECTOR_SIZE 256 // max length of an active particle vector
 
 static int max_active_time_bin();
 static void set_new_particle_timebins();
 static void set_system_timestep();
 static void print_timebins();
+static void set_step_factor_caches();
+static void sort_by_timebin(int * restrict, const int);
+static void set_active_particles();
+static bool starts_vector(const int, const bool);
 
 static void set_global_timestep_constraint();
 static float get_physical_timestep(const int);
@@ -23,6 +29,15 @@ struct IntegerTimeLine Int_Time = { 0 };
 static float Dt_Max_Global = FLT_MAX;
 static int Time_Bin_Min = N_INT_BINS-1, Time_Bin_Max = 0;
 
+static int Bin_Count[N_INT_BINS] = { 0 }; // npart per timebin on this rank
+static int Sorted_Count[N_INT_BINS] = { 0 }; // npart per bin in last sort
+static int (*Thread_Bin_Offset)[N_INT_BINS] = NULL;
+static int * restrict Sort_Buf = NULL;
+static int *Thread_NVec = NULL;
+
+struct Step_Factor_Cache First_Kick_Cache = { { 0 } },
+						 Second_Kick_Cache = { { 0 } }, Drift_Cache = { { 0 } };
+
 struct Particle_Vector_Blocks V = { NULL };
 int * restrict First = NULL;
 int * restrict Last = NULL;
@@ -30,6 +45,10 @@ int * restrict Last = NULL;
 /* 
  * All active particles get a new step that is smaller than or equal to 
  * the largest active bin. We also set the fullstep signal. 
+ * Active_Particle_List holds all particles sorted by timebin, so the active 
+ * particles are its first NActive_Particles entries. Only these change their
+ * bin and only stay below the largest active bin, hence we re-sort the
+ * active part of the list. Everything here is O(NActive_Particles).
  */
 
 void Set_New_Timesteps()
@@ -41,9 +60,26 @@ void Set_New_Timesteps()
 
 	set_new_particle_timebins();
 
+	sort_by_timebin(Active_Particle_List, NActive_Particles);
+
 	#pragma omp single
 	{
 
+	for (int i = 0; i <= Time.Max_Active_Bin; i++) // rest unchanged
+		Bin_Count[i] = Sorted_Count[i];
+
+	Time_Bin_Min = N_INT_BINS-1;
+	Time_Bin_Max = 0;
+
+	for (int i = 0; i < N_INT_BINS; i++) {
+
+		if (Bin_Count[i] == 0)
+			continue;
+
+		Time_Bin_Min = MIN(Time_Bin_Min, i);
+		Time_Bin_Max = MAX(Time_Bin_Max, i);
+	}
+
 	MPI_Allreduce(MPI_IN_PLACE, &Time_Bin_Min, 1, MPI_INT, MPI_MIN,
 			MPI_COMM_WORLD);
 
@@ -54,6 +90,8 @@ void Set_New_Timesteps()
 
 	Time.Max_Active_Bin = max_active_time_bin();
 
+	set_step_factor_caches();
+
 	} // omp single
 
 	Sig.Sync_Point = false;
@@ -68,8 +106,9 @@ void Set_New_Timesteps()
 		Int_Time.Next_Sync_Point += 1ULL << Time_Bin_Max;
 	}
 
-	//Make_Active_Particle_Vectors();
-	Make_Active_Particle_List();
+	set_active_particles();
+
+	Make_Active_Particle_Vectors();
 
 	#pragma omp master
 	{
@@ -157,23 +196,28 @@ void Setup_Time_Integration()
 
 	Time.Max_Active_Bin = N_INT_BINS - 1;
 
-	size_t nBytes = Task.Npart_Total_Max * sizeof(*Active_Particle_List);
+	Active_Particle_List = Reserve_Particle_Array(
+			sizeof(*Active_Particle_List), "Active Part List");
 
-	Active_Particle_List = Malloc(nBytes, "Active Part List");
+	Sort_Buf = Reserve_Particle_Array(sizeof(*Sort_Buf), "Timebin Sort Buf");
 
-	NActive_Particles = Task.Npart_Total;
+	Thread_Bin_Offset = Malloc(NThreads * sizeof(*Thread_Bin_Offset),
+			"Thread Bin Offset");
 
-	#pragma omp parallel for	
-	for (int i = 0; i < Task.Npart_Total; i++) 
-		Active_Particle_List[i] = i;
+	V.First = Reserve_Particle_Array(sizeof(*V.First), "V.First");
+	V.Last = Reserve_Particle_Array(sizeof(*V.Last), "V.Last");
 
-	nBytes = Task.Npart_Total_Max * sizeof(int);
-		
-	V.First = Malloc(nBytes, "V.First");
-	V.Last = Malloc(nBytes, "V.Last");
+	Thread_NVec = Malloc(NThreads * sizeof(*Thread_NVec), "Thread NVec");
+
+	#pragma omp parallel
+	{
+
+	Make_Active_Particle_List();
 
  	Make_Active_Particle_Vectors();
 
+	} // omp parallel
+
 	return ;
 }
 
@@ -199,16 +243,10 @@ static inline Float convert_dt_to_dlna(const Float dt)
 
 static void set_new_particle_timebins()
 {
-	#pragma omp single
-	{
-
-	Time_Bin_Min = N_INT_BINS-1;
-	Time_Bin_Max = 0;
-
-	} // omp single
+	#pragma omp for
+	for (int i = 0; i < NActive_Particles; i++) {
 
-	#pragma omp for reduction(min:Time_Bin_Min) reduction(max:Time_Bin_Max)
-	for (int ipart = 0; ipart < Task.Npart_Total; ipart++) {
+		int ipart = Active_Particle_List[i];
 
 		Float dt = get_physical_timestep(ipart);
 
@@ -223,14 +261,14 @@ static void set_new_particle_timebins()
 
 		int want = timestep2timebin(dt);
 
-		int allowed = MAX(Time.Max_Active_Bin, P.Time_Bin[ipart]);
+		int old_bin = P.Time_Bin[ipart];
+
+		int allowed = MAX(Time.Max_Active_Bin, old_bin);
 		
 		P.Time_Bin[ipart] = MIN(want, allowed);
-		
-		Time_Bin_Min = MIN(Time_Bin_Min, P.Time_Bin[ipart]);
-		Time_Bin_Max = MAX(Time_Bin_Max, P.Time_Bin[ipart]);
-	}
 
+		Gravity_Tree_Update_Timebin(ipart, old_bin); // HOLD
+	}
 
 	return ;
 }
@@ -277,21 +315,77 @@ static int max_active_time_bin()
 	return COUNT_TRAILING_ZEROS(Int_Time.Next);
 }
 
+/*
+ * A particle on an active bin starts its step at Int_Time.Next - it_step and
+ * is kicked twice by half a step. Inactive and too large bins get a key that
+ * never matches.
+ */
+
+static void set_step_factor_caches()
+{
+	const intime_t no_key = ~((intime_t) 0);
+
+	for (int bin = 0; bin < N_INT_BINS; bin++) {
+
+		First_Kick_Cache.It_Curr[bin] = Second_Kick_Cache.It_Curr[bin] =
+			Drift_Cache.It_Curr[bin] = no_key;
+
+		intime_t it_step = Timebin2It_Timestep(bin);
+
+		if (bin > Time.Max_Active_Bin || it_step > Int_Time.Next)
+			continue;
+
+		intime_t it_beg = Int_Time.Next - it_step;
+		intime_t it_half = it_beg + (it_step >> 1);
+
+		First_Kick_Cache.It_Curr[bin] = it_beg;
+		First_Kick_Cache.Dt[bin] = Particle_Kick_Step(it_beg, it_half);
+
+		Second_Kick_Cache.It_Curr[bin] = it_half;
+		Second_Kick_Cache.Dt[bin] = Particle_Kick_Step(it_half,
+				it_half + (it_step >> 1));
+
+		Drift_Cache.It_Curr[bin] = it_beg;
+		Drift_Cache.Dt[bin] = Particle_Drift_Step(it_beg, Int_Time.Next);
+	}
+
+	return ;
+}
+
+/*
+ * Rebuild the timebin sorted particle list from scratch, e.g. after the 
+ * particles were reordered in memory. Within a bin particles stay in memory
+ * order.
+ */
+
 void Make_Active_Particle_List()
 {
+	#pragma omp for
+	for (int i = 0; i < Task.Npart_Total; i++)
+		Active_Particle_List[i] = i;
+
+	sort_by_timebin(Active_Particle_List, Task.Npart_Total);
+
 	#pragma omp single
-	{
+	memcpy(Bin_Count, Sorted_Count, sizeof(Bin_Count));
 
-	int i = 0;
+	set_active_particles();
 
-	for (int ipart = 0; ipart < Task.Npart_Total; ipart++) 
-		if (P.Time_Bin[ipart] <= Time.Max_Active_Bin)
-			Active_Particle_List[i++] = ipart;
+	return ;
+}
 
-	NActive_Particles = i;
+static void set_active_particles()
+{
+	#pragma omp single
+	{
+
+	NActive_Particles = 0;
+
+	for (int i = 0; i <= Time.Max_Active_Bin; i++)
+		NActive_Particles += Bin_Count[i];
 
 	Assert(NActive_Particles > 0, "No Active Particles, instead %d, bin max %d"
-			, i, Time.Max_Active_Bin);
+			, NActive_Particles, Time.Max_Active_Bin);
 
 	} // omp single
 
@@ -299,58 +393,136 @@ void Make_Active_Particle_List()
 }
 
 /*
- * To be able to vectorize particle accesses, we find vectors of particles
- * that are adjacent in memory and on the same timestep. We end up with 
- * NParticle_Vectors vectors starting at First and ending before Last.
+ * Stable parallel counting sort of list[0, n) by timebin. Every thread 
+ * counts the bins in its static chunk, the prefix sum over bins and threads
+ * then gives each thread its write position in every bin. Both loops need the
+ * same static schedule. Sets Sorted_Count.
  */
 
-void Make_Active_Particle_Vectors(const int max_active_bin)
+static void sort_by_timebin(int * restrict list, const int n)
 {
+	int * restrict offset = Thread_Bin_Offset[Task.Thread_ID];
+
+	memset(offset, 0, N_INT_BINS * sizeof(*offset));
+
+	#pragma omp for schedule(static)
+	for (int i = 0; i < n; i++)
+		offset[P.Time_Bin[list[i]]]++;
+
 	#pragma omp single
 	{
 
-	size_t nBytes = Task.Npart_Total * sizeof(*V.First);
+	int sum = 0;
 
-	memset(V.First, 0, nBytes);
-	memset(V.Last, 0, nBytes);
-	
-	NParticle_Vectors = 0;
+	for (int i = 0; i < N_INT_BINS; i++) {
 
-	int i = -1;
-	int last_pos = -1; // last position on integer timeline
+		Sorted_Count[i] = 0;
 
-	for (int ipart = 0; ipart < Task.Npart_Total; ipart++) {
+		for (int j = 0; j < NThreads; j++) {
 
-		if (P.Time_Bin[ipart] <= Time.Max_Active_Bin) {
-			
-			if (P.It_Drift_Pos[ipart] != last_pos)
-				i++;
+			int cnt = Thread_Bin_Offset[j][i];
 
-			V.Last[i]++;
-			last_pos = P.It_Drift_Pos[ipart];
-			
-			if (V.First[i] <= 0) // vector starts
-				V.First[i] = ipart;
+			Thread_Bin_Offset[j][i] = sum;
 
-		} else if (V.Last[i] > 0) { // vector ends
-		
-			V.Last[i]++; // so we can write canonical loops
-			i++;
+			sum += cnt;
+			Sorted_Count[i] += cnt;
 		}
+	}
 
-	} // ipart
+	} // omp single
 
-	NParticle_Vectors = i+1;
+	#pragma omp for schedule(static)
+	for (int i = 0; i < n; i++) {
 
-	} // omp single
+		int ipart = list[i];
+
+		Sort_Buf[offset[P.Time_Bin[ipart]]++] = ipart;
+	}
 
 	#pragma omp for
-	for (int i = 0; i < NParticle_Vectors; i++) 
-		V.Last[i] += V.First[i];
+	for (int i = 0; i < n; i++)
+		list[i] = Sort_Buf[i];
+
+	return ;
+}
+
+/*
+ * To be able to vectorize particle accesses, we find vectors of active 
+ * particles that are adjacent in memory, on the same timebin and at the same
+ * position on the integer timeline. Kick and drift are then unit stride loops
+ * with one factor per vector. We end up with NParticle_Vectors vectors 
+ * starting at V.First and ending before V.Last. Vectors are split every 
+ * ACTIVE_VECTOR_SIZE active particles to balance the threads. Both loops 
+ * need the same static schedule, a thread's chunk always starts a vector.
+ */
+
+static bool starts_vector(const int i, const bool first_iter)
+{
+	if (first_iter || (i % ACTIVE_VECTOR_SIZE == 0))
+		return true;
+
+	const int ipart = Active_Particle_List[i];
+	const int jpart = Active_Particle_List[i-1];
+
+	return (ipart != jpart + 1) 
+		|| (P.Time_Bin[ipart] != P.Time_Bin[jpart])
+		|| (P.It_Kick_Pos[ipart] != P.It_Kick_Pos[jpart])
+		|| (P.It_Drift_Pos[ipart] != P.It_Drift_Pos[jpart]);
+}
+
+void Make_Active_Particle_Vectors()
+{
+	int nVec = 0;
+	bool first_iter = true;
+
+	#pragma omp for schedule(static)
+	for (int i = 0; i < NActive_Particles; i++) {
+
+		nVec += starts_vector(i, first_iter);
+
+		first_iter = false;
+	}
+
+	Thread_NVec[Task.Thread_ID] = nVec;
+
+	#pragma omp barrier
+
+	#pragma omp single
+	{
+
+	NParticle_Vectors = 0;
+
+	for (int i = 0; i < NThreads; i++) {
+
+		int cnt = Thread_NVec[i];
+
+		Thread_NVec[i] = NParticle_Vectors;
+
+		NParticle_Vectors += cnt;
+	}
 
 	Assert(NParticle_Vectors > 0, "Invalid Active Particle Vectors : %d", 
 			NParticle_Vectors);
 
+	} // omp single
+
+	int v = Thread_NVec[Task.Thread_ID] - 1;
+
+	first_iter = true;
+
+	#pragma omp for schedule(static)
+	for (int i = 0; i < NActive_Particles; i++) {
+
+		int ipart = Active_Particle_List[i];
+
+		if (starts_vector(i, first_iter))
+			V.First[++v] = ipart;
+
+		V.Last[v] = ipart + 1; // so we can write canonical loops
+
+		first_iter = false;
+	}
+
 	return ;
 }
 
@@ -420,8 +592,7 @@ static void print_timebins()
 {
 	int npart[N_INT_BINS] = { 0 };
 
-	for (int ipart = 0; ipart < Task.Npart_Total; ipart++)
-		npart[P.Time_Bin[ipart]]++;
+	memcpy(npart, Bin_Count, sizeof(npart));
 
 	MPI_Reduce(MPI_IN_PLACE, npart, N_INT_BINS, MPI_INT, MPI_SUM, Master,
 			MPI_COMM_WORLD);
@@ -505,6 +676,8 @@ static float get_physical_timestep(const int ipart)
 	dt = fmin(dt, dt_cosmo);
 #endif
 
+	dt = fmin(dt, Hermite_Timestep(ipart)); // HERMITE
+
 	// add yours here
 
 	return dt;
@@ -516,7 +689,11 @@ static float get_physical_timestep(const int ipart)
 
 static float cosmological_timestep(const int ipart, const Float acc_phys)
 {
+#ifdef ADAPTIVE_SOFTENING
+	const Float epsilon = 105.0/41.0 * P.Softening[ipart]; // from K1 scale
+#else
 	const Float epsilon = 105.0/32.0 * Param.Grav_Softening[1];
+#endif
 
 #ifdef COMOVING
 	return Param.Time_Int_Accuracy * sqrt(2 * Cosmo.Expansion_Factor
@@ -3,6 +3,7 @@
 
 #include "includes.h"
 #include "comoving.h"
+#include "hermite.h"
 #include "IO/restart_file.h"
 
 extern struct TimeData {
@@ -31,6 +32,39 @@ struct IntegerTimeLine {
 	intime_t Next_Sync_Point;// next full step on integer timeline
 } Int_Time;
 
+/*
+ * All active particles of a timebin share their kick & drift factors, so we
+ * compute these once per step. The cache is keyed by the integer time the
+ * bin starts from, particles off that time (after a bin change or a drift to
+ * a snapshot) fall back to the full evaluation.
+ */
+
+extern struct Step_Factor_Cache {
+	intime_t It_Curr[N_TIME_BINS];	// key
+	double Dt[N_TIME_BINS];			// kick or drift factor
+} First_Kick_Cache, Second_Kick_Cache, Drift_Cache;
+
+double Particle_Kick_Step(const intime_t, const intime_t);
+double Particle_Drift_Step(const intime_t, const intime_t);
+
+static inline double Cached_Kick_Step(const struct Step_Factor_Cache *c,
+		const int bin, const intime_t it_curr, const intime_t it_next)
+{
+	if (it_curr == c->It_Curr[bin])
+		return c->Dt[bin];
+
+	return Particle_Kick_Step(it_curr, it_next);
+}
+
+static inline double Cached_Drift_Step(const int bin, const intime_t it_curr,
+		const intime_t it_next)
+{
+	if (it_curr == Drift_Cache.It_Curr[bin])
+		return Drift_Cache.Dt[bin];
+
+	return Particle_Drift_Step(it_curr, it_next);
+}
+
 void Set_New_Timesteps();
 void Make_Active_Particle_List();
 void Make_Active_Particle_Vectors();
@@ -57,6 +57,10 @@ double Acceleration_Physical(const int ipart)
 	double grav_accel = sqrt( p2(P.Grav_Acc[0][ipart]) 
 			+ p2(P.Grav_Acc[1][ipart]) + p2(P.Grav_Acc[2][ipart]) );
 
+#ifdef HOLD
+	grav_accel = fmax(grav_accel, P.Pair_Acc[ipart]); // symmetric timesteps
+#endif
+
 #ifdef COMOVING
 	grav_accel *= Cosmo.Grav_Accel_Factor;
 #endif
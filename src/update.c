@@ -24,8 +24,12 @@ void Update(enum Update_Parameters stage)
 
 		Print_Memory_Usage();
 
-		if (Time_For_Snapshot())
+		if (Time_For_Snapshot()) {
+
+			FoF(); // FOF
+
 			Write_Snapshot();
+		}
 
 		Sig.Prepare_Step = false;
 
@@ -47,6 +51,8 @@ void Update(enum Update_Parameters stage)
 
 	case BEFORE_SNAPSHOT:
 
+		FoF(); // FOF
+
 		break;
 
 	case BEFORE_DRIFT:
@@ -57,7 +63,7 @@ void Update(enum Update_Parameters stage)
 
 		Compute_Current_Simulation_Properties();
 
-		Periodic_Constrain_Particles_To_Box(); // PERIODIC
+		Map(); // MAP
 
 		break;
 
@@ -10,6 +10,8 @@
 #include "periodic.h"
 #include "vector.h"
 #include "Gravity/tree.h" // <-- add your module .h below
+#include "FoF/fof.h"
+#include "Map/map.h"
 
 
 
@@ -21,17 +21,19 @@ void Find_Leaf_Vectors()
 {
 	Profile("Find Vec");
 
-	int *first = Get_Thread_Safe_Buffer(Task.Npart_Total_Max*sizeof(*first));
-
 	#pragma omp single
 	NVec = sum = 0;
 
-	#pragma omp for schedule(static,1) nowait
+	#pragma omp for schedule(static,1)
 	for (int i = 0; i < NTop_Nodes; i++) {
 
 		int first_part = D[i].TNode.First_Part;
 		int last_part = first_part + D[i].TNode.Npart - 1;
 
+		const size_t mark = Scratch_Push();
+
+		int *first = Scratch_Alloc(D[i].TNode.Npart * sizeof(*first));
+
 		int nVec = 0;
 		int ipart = first_part;
 
@@ -56,11 +58,13 @@ void Find_Leaf_Vectors()
 	
 				npart = 1; // account for ipart
 
-				const peanoKey triplet_i = P.Key[ipart] & mask;
+				const peanoKey triplet_i = REVERSED_PART_KEY(ipart, lvl)
+																	& mask;
 
 				for (int jpart = ipart+1; jpart < jmax; jpart++) {
 
-					peanoKey triplet_j = P.Key[jpart] & mask;
+					peanoKey triplet_j = REVERSED_PART_KEY(jpart, lvl) 
+																	& mask;
 
 					if (triplet_j != triplet_i)
 						break;	
@@ -83,7 +87,8 @@ void Find_Leaf_Vectors()
 			lvl = D[i].TNode.Level + 1; // find next lvl 
 			mask = ((peanoKey) 0x7) << (3*lvl);
 
-			while ((P.Key[ipart] & mask) == (P.Key[ipart-1] & mask)) {
+			while ((REVERSED_PART_KEY(ipart, lvl) & mask)
+					== (REVERSED_PART_KEY(ipart-1, lvl) & mask)) {
 
 				lvl++;
 				mask <<= 3;
@@ -103,6 +108,8 @@ void Find_Leaf_Vectors()
 	
 		memcpy(&Vec[dest], first, nVec*sizeof(*first));
 
+		Scratch_Pop(mark);
+
 	} // for i
 
 	Vec[NVec] = Task.Npart_Total; // terminate for loops
@@ -123,9 +130,7 @@ void Find_Leaf_Vectors()
 
 void Setup_Leaf_Vectors()
 {
-	size_t nBytes = Task.Npart_Total_Max*sizeof(*Vec);
-	
-	Vec = Malloc(nBytes, "Leaf Vectors");
+	Vec = Reserve_Particle_Array(sizeof(*Vec), "Leaf Vectors");
 
 	return;
 }
@@ -135,6 +140,6 @@ static int compare_vectors(const void *a, const void *b)
 	const int i = *((const int *) a);
 	const int j = *((const int *) b);
 	
-	return (int) (Vec[i] < Vec[j]) - (Vec[i] > Vec[j]);
+	return (int) (i > j) - (i < j);
 }
 